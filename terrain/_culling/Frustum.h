@@ -0,0 +1,51 @@
+#pragma once
+#include <cmath>
+#include "icg_common.h"
+
+/// View frustum planes extracted from a view-projection matrix
+/// (Gribb & Hartmann), with room for extra clip planes such as the water
+/// plane of the reflection pass. Points p with dot(n, p) + d >= 0 are inside.
+class Frustum {
+protected:
+    static const int MAX_PLANES = 8;
+    float _planes[MAX_PLANES][4];   ///< normal xyz and distance, normalized
+    int _num_planes;
+
+public:
+    Frustum() : _num_planes(0) {}
+    explicit Frustum(const mat4& VP) { set(VP); }
+
+    void set(const mat4& VP) {
+        _num_planes = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int sign = -1; sign <= 1; sign += 2) {
+                add_plane(VP(3, 0) + sign * VP(axis, 0), VP(3, 1) + sign * VP(axis, 1),
+                          VP(3, 2) + sign * VP(axis, 2), VP(3, 3) + sign * VP(axis, 3));
+            }
+        }
+    }
+
+    /// Adds the half-space a*x + b*y + c*z + d >= 0
+    void add_plane(float a, float b, float c, float d) {
+        if (_num_planes == MAX_PLANES) return;
+        float length = std::sqrt(a * a + b * b + c * c);
+        float* p = _planes[_num_planes++];
+        p[0] = a / length;
+        p[1] = b / length;
+        p[2] = c / length;
+        p[3] = d / length;
+    }
+
+    /// False only if the box is entirely outside one of the planes
+    bool intersects(float x0, float y0, float z0, float x1, float y1, float z1) const {
+        for (int i = 0; i < _num_planes; i++) {
+            const float* p = _planes[i];
+            // corner furthest along the plane normal
+            float x = p[0] >= 0.0f ? x1 : x0;
+            float y = p[1] >= 0.0f ? y1 : y0;
+            float z = p[2] >= 0.0f ? z1 : z0;
+            if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f) return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+#include <cmath>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/// Elevation data set of any size, tiled and mipmapped on disk so that it
+/// is read a tile at a time from a memory mapping:
+///
+///     Header | Level[levels] | per level: tiles | bounds
+///
+/// Level l has one sample for every 2^l of level 0 (a [1 2 1] tent of the
+/// level below), levels are added until one tile covers the whole set.
+/// Tiles hold tile + 3 samples per side, samples [t*tile - 1, t*tile +
+/// tile + 1] clamped to the level, so a tile can be filtered and
+/// differentiated without its neighbours. Bounds are the min and max of the
+/// samples a tile covers, [t*tile, t*tile + tile], and of the bounds of the
+/// tiles under it in the finer levels: the tent flattens peaks, and culling
+/// a coarse tile must not lose a peak of its children. Samples are
+/// unsigned 16 bit as in the source; the header has their range.
+class DemFile {
+public:
+    typedef unsigned short Sample;
+
+    struct Level {
+        int width, height;          ///< samples
+        int tiles_x, tiles_z;
+        unsigned long long tiles;   ///< offset of the tiles, rows along +z
+        unsigned long long bounds;  ///< offset of the min, max pairs
+    };
+
+    /// Bump whenever the layout changes
+    static const unsigned int VERSION = 2;
+
+protected:
+    struct Header {
+        char magic[4];          ///< "TDEM"
+        unsigned int version;
+        int width, height;      ///< samples of level 0
+        int tile;               ///< cells per tile side
+        int levels;
+        Sample min, max;        ///< of all samples
+    };
+
+    const char* _data;          ///< mapped file, NULL if none is open
+    size_t _size;
+    const Header* _header;
+    const Level* _levels;
+#ifdef _WIN32
+    std::vector<char> _buffer;
+#endif
+
+public:
+    DemFile() : _data(NULL), _size(0), _header(NULL), _levels(NULL) {}
+
+    ~DemFile() {
+        close();
+    }
+
+    /// Maps a file written by import(), false if it is not one
+    bool open(const std::string& path) {
+        close();
+        if (!map(path)) return false;
+        _header = (const Header*) _data;
+        _levels = (const Level*) (_data + sizeof(Header));
+        bool valid = _size >= sizeof(Header) && !memcmp(_header->magic, "TDEM", 4) &&
+                     _header->version == VERSION && _header->levels > 0 && _header->tile > 0 &&
+                     _size >= sizeof(Header) + _header->levels * sizeof(Level);
+        for (int l = 0; valid && l < _header->levels; l++) {
+            const Level& level = _levels[l];
+            size_t tiles = (size_t) level.tiles_x * level.tiles_z;
+            valid = level.tiles + tiles * page_bytes() <= _size && level.bounds + tiles * 2 * sizeof(Sample) <= _size;
+        }
+        if (!valid) {
+            std::cerr << "!!!ERROR: " << path << " is not a DEM of version " << VERSION << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (!_data) return;
+#ifdef _WIN32
+        std::vector<char>().swap(_buffer);
+#else
+        munmap((void*) _data, _size);
+#endif
+        _data = NULL;
+        _size = 0;
+        _header = NULL;
+        _levels = NULL;
+    }
+
+    bool is_open() const { return _data != NULL; }
+    int width() const { return _header->width; }
+    int height() const { return _header->height; }
+    int tile() const { return _header->tile; }
+    int page_side() const { return _header->tile + 3; }
+    size_t page_bytes() const { return (size_t) page_side() * page_side() * sizeof(Sample); }
+    int levels() const { return _header->levels; }
+    const Level& level(int l) const { return _levels[l]; }
+    Sample min() const { return _header->min; }
+    Sample max() const { return _header->max; }
+
+    /// Samples of tile (tx, tz) of level l, page_side()^2 in place in the mapping
+    const Sample* page(int l, int tx, int tz) const {
+        const Level& level = _levels[l];
+        return (const Sample*) (_data + level.tiles + ((size_t) tz * level.tiles_x + tx) * page_bytes());
+    }
+
+    /// Sample range covered by a tile
+    void bounds(int l, int tx, int tz, Sample& min, Sample& max) const {
+        const Level& level = _levels[l];
+        const Sample* pair = (const Sample*) (_data + level.bounds) + 2 * ((size_t) tz * level.tiles_x + tx);
+        min = pair[0];
+        max = pair[1];
+    }
+
+    /// Asks the OS to start reading a tile, so that it is in memory by the
+    /// time page() is used
+    void prefetch(int l, int tx, int tz) const {
+#ifndef _WIN32
+        static const size_t PAGE = sysconf(_SC_PAGESIZE);
+        size_t begin = (const char*) page(l, tx, tz) - _data;
+        size_t end = begin + page_bytes();
+        begin &= ~(PAGE - 1);
+        madvise((void*) (_data + begin), end - begin, MADV_WILLNEED);
+#endif
+    }
+
+    /// Level 0 sample nearest to (x, z), clamped to the set
+    Sample sample(int x, int z) const {
+        x = std::min(std::max(x, 0), width() - 1);
+        z = std::min(std::max(z, 0), height() - 1);
+        int tx = std::min(std::max(x - 1, 0) / tile(), level(0).tiles_x - 1);
+        int tz = std::min(std::max(z - 1, 0) / tile(), level(0).tiles_z - 1);
+        return page(0, tx, tz)[(size_t) (z - tz * tile() + 1) * page_side() + x - tx * tile() + 1];
+    }
+
+    /// Converts a raw or PGM DEM to input's tiled format at output, reading
+    /// and writing a row of tiles at a time. PGM (P5) may have 8 or 16 bit
+    /// samples; raw files are 16 bit little endian, width x height, or
+    /// square if width is 0.
+    static bool import(const std::string& input, const std::string& output, int tile = 128, int width = 0,
+                       int height = 0) {
+        FILE* in = fopen(input.c_str(), "rb");
+        if (!in) {
+            std::cerr << "!!!ERROR: cannot read " << input << std::endl;
+            return false;
+        }
+        Source source = { in, width, height, 2, false, 0 };
+        if (!read_source_header(source, input)) {
+            fclose(in);
+            return false;
+        }
+
+        ///--- Level sizes, until one tile covers the whole set
+        Header header;
+        memcpy(header.magic, "TDEM", 4);
+        header.version = VERSION;
+        header.width = source.width;
+        header.height = source.height;
+        header.tile = tile;
+        std::vector<Level> levels;
+        int w = source.width, h = source.height;
+        for (;;) {
+            Level level;
+            level.width = w;
+            level.height = h;
+            level.tiles_x = std::max(1, (w - 1 + tile - 1) / tile);
+            level.tiles_z = std::max(1, (h - 1 + tile - 1) / tile);
+            levels.push_back(level);
+            if (level.tiles_x == 1 && level.tiles_z == 1) break;
+            ///--- Half the cells, rounded up
+            w = w / 2 + 1;
+            h = h / 2 + 1;
+        }
+        header.levels = levels.size();
+
+        ///--- Tiles start on OS pages, bounds follow them
+        size_t page_side = tile + 3, page_bytes = page_side * page_side * sizeof(Sample);
+        unsigned long long offset = sizeof(Header) + levels.size() * sizeof(Level);
+        for (size_t l = 0; l < levels.size(); l++) {
+            size_t tiles = (size_t) levels[l].tiles_x * levels[l].tiles_z;
+            offset = (offset + 4095) & ~4095ull;
+            levels[l].tiles = offset;
+            offset += tiles * page_bytes;
+            levels[l].bounds = offset;
+            offset += tiles * 2 * sizeof(Sample);
+        }
+
+        std::string temp_path = output + ".tmp";
+        FILE* out = fopen(temp_path.c_str(), "w+b");
+        if (!out) {
+            std::cerr << "!!!ERROR: cannot write " << temp_path << std::endl;
+            fclose(in);
+            return false;
+        }
+        header.min = 0xffff;
+        header.max = 0;
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                  fwrite(&levels[0], sizeof(Level), levels.size(), out) == levels.size();
+
+        ///--- Level 0 from bands of tile + 3 source rows
+        std::vector<Sample> band, row(page_side * page_side * levels[0].tiles_x);
+        std::vector<Sample> bounds;
+        for (int tz = 0; ok && tz < levels[0].tiles_z; tz++) {
+            int first = tz * tile - 1;
+            ok = read_band(source, first, page_side, band);
+            for (int tx = 0; ok && tx < levels[0].tiles_x; tx++) {
+                Sample* page = &row[tx * page_side * page_side];
+                for (size_t j = 0; j < page_side; j++) {
+                    for (size_t i = 0; i < page_side; i++) {
+                        int x = std::min(std::max(tx * tile - 1 + (int) i, 0), source.width - 1);
+                        page[j * page_side + i] = band[j * source.width + x];
+                    }
+                }
+                add_bounds(page, tile, tx, tz, levels[0], bounds);
+            }
+            ok = ok && write_row(out, levels[0].tiles + (unsigned long long) tz * levels[0].tiles_x * page_bytes, row);
+        }
+        fclose(in);
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            header.min = std::min(header.min, bounds[i]);
+            header.max = std::max(header.max, bounds[i + 1]);
+        }
+        ok = ok && write_row(out, levels[0].bounds, bounds);
+
+        ///--- Every coarser level from the rows of tiles it covers in the one below
+        for (size_t l = 1; ok && l < levels.size(); l++) {
+            const Level& fine = levels[l - 1];
+            const Level& level = levels[l];
+            TileRows rows = { out, &fine, tile, page_bytes, std::vector<std::vector<Sample> >(fine.tiles_z),
+                              true };
+            row.resize(page_side * page_side * level.tiles_x);
+            std::vector<Sample> fine_bounds;
+            fine_bounds.swap(bounds);
+            for (int tz = 0; ok && tz < level.tiles_z; tz++) {
+                for (int tx = 0; ok && tx < level.tiles_x; tx++) {
+                    Sample* page = &row[tx * page_side * page_side];
+                    for (size_t j = 0; j < page_side; j++) {
+                        int z = std::min(std::max(tz * tile - 1 + (int) j, 0), level.height - 1);
+                        for (size_t i = 0; i < page_side; i++) {
+                            int x = std::min(std::max(tx * tile - 1 + (int) i, 0), level.width - 1);
+                            page[j * page_side + i] = rows.tent(2 * x, 2 * z);
+                        }
+                    }
+                    add_bounds(page, tile, tx, tz, level, bounds);
+                    ///--- and of its (up to) four children
+                    Sample& lo = bounds[bounds.size() - 2];
+                    Sample& hi = bounds[bounds.size() - 1];
+                    for (int cz = 2 * tz; cz < std::min(2 * tz + 2, fine.tiles_z); cz++) {
+                        for (int cx = 2 * tx; cx < std::min(2 * tx + 2, fine.tiles_x); cx++) {
+                            size_t child = 2 * ((size_t) cz * fine.tiles_x + cx);
+                            lo = std::min(lo, fine_bounds[child]);
+                            hi = std::max(hi, fine_bounds[child + 1]);
+                        }
+                    }
+                }
+                ok = rows.ok && write_row(out, level.tiles + (unsigned long long) tz * level.tiles_x * page_bytes, row);
+                rows.release(2 * (tz + 1) * tile - 3);
+            }
+            ok = ok && write_row(out, level.bounds, bounds);
+        }
+
+        ok = ok && seek(out, 0) && fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = fclose(out) == 0 && ok;
+        if (!ok || rename(temp_path.c_str(), output.c_str()) != 0) {
+            std::cerr << "!!!ERROR: cannot write " << output << std::endl;
+            remove(temp_path.c_str());
+            return false;
+        }
+        std::cout << input << ": " << source.width << "x" << source.height << " samples, " << levels.size()
+                  << " levels of " << tile << "^2 tiles, " << offset / (1024.0 * 1024.0) << " MB -> " << output
+                  << std::endl;
+        return true;
+    }
+
+protected:
+    /// A DEM being imported
+    struct Source {
+        FILE* file;
+        int width, height;
+        int bytes;              ///< per sample
+        bool big_endian;
+        long long data;         ///< offset of the first sample
+    };
+
+    /// Rows of tiles of a level written to the file, read back when needed
+    struct TileRows {
+        FILE* file;
+        const Level* level;
+        int tile;
+        size_t page_bytes;
+        std::vector<std::vector<Sample> > rows;
+        bool ok;
+
+        /// [1 2 1]^2 tent around sample (x, z), clamped to the level
+        Sample tent(int x, int z) {
+            static const int WEIGHT[3] = { 1, 2, 1 };
+            unsigned int sum = 0;
+            for (int dz = -1; dz <= 1; dz++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    sum += WEIGHT[dx + 1] * WEIGHT[dz + 1] * at(x + dx, z + dz);
+                }
+            }
+            return (sum + 8) / 16;
+        }
+
+        Sample at(int x, int z) {
+            x = std::min(std::max(x, 0), level->width - 1);
+            z = std::min(std::max(z, 0), level->height - 1);
+            int tx = std::min(std::max(x - 1, 0) / tile, level->tiles_x - 1);
+            int tz = std::min(std::max(z - 1, 0) / tile, level->tiles_z - 1);
+            std::vector<Sample>& row = rows[tz];
+            if (row.empty()) {
+                row.resize(level->tiles_x * page_bytes / sizeof(Sample));
+                ok = ok && seek(file, level->tiles + (unsigned long long) tz * level->tiles_x * page_bytes) &&
+                     fread(&row[0], page_bytes, level->tiles_x, file) == (size_t) level->tiles_x;
+            }
+            int side = tile + 3;
+            return row[(size_t) tx * side * side + (size_t) (z - tz * tile + 1) * side + x - tx * tile + 1];
+        }
+
+        /// Frees the rows of tiles wholly above sample row z
+        void release(int z) {
+            for (int tz = 0; tz < (int) rows.size() && (tz + 1) * tile + 1 < z; tz++) {
+                std::vector<Sample>().swap(rows[tz]);
+            }
+        }
+    };
+
+    static bool seek(FILE* file, unsigned long long offset) {
+#ifdef _WIN32
+        return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+        return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+    }
+
+    static bool write_row(FILE* file, unsigned long long offset, const std::vector<Sample>& samples) {
+        return seek(file, offset) && fwrite(&samples[0], sizeof(Sample), samples.size(), file) == samples.size();
+    }
+
+    /// Appends the min and max of the samples tile (tx, tz) covers
+    static void add_bounds(const Sample* page, int tile, int tx, int tz, const Level& level,
+                           std::vector<Sample>& bounds) {
+        int side = tile + 3;
+        int w = std::min(tile, level.width - 1 - tx * tile), h = std::min(tile, level.height - 1 - tz * tile);
+        Sample lo = 0xffff, hi = 0;
+        for (int j = 1; j <= h + 1; j++) {
+            for (int i = 1; i <= w + 1; i++) {
+                lo = std::min(lo, page[j * side + i]);
+                hi = std::max(hi, page[j * side + i]);
+            }
+        }
+        bounds.push_back(lo);
+        bounds.push_back(hi);
+    }
+
+    /// PGM header, or the size of a raw file
+    static bool read_source_header(Source& source, const std::string& path) {
+        char magic[3] = {0};
+        if (fread(magic, 1, 2, source.file) == 2 && !strcmp(magic, "P5")) {
+            int values[3];
+            for (int v = 0; v < 3; v++) {
+                int c = fgetc(source.file);
+                while (c == '#' || isspace(c)) {
+                    if (c == '#') while (c != '\n' && c != EOF) c = fgetc(source.file);
+                    c = fgetc(source.file);
+                }
+                ungetc(c, source.file);
+                if (fscanf(source.file, "%d", &values[v]) != 1) {
+                    std::cerr << "!!!ERROR: bad PGM header in " << path << std::endl;
+                    return false;
+                }
+            }
+            fgetc(source.file);     // the single whitespace before the samples
+            source.width = values[0];
+            source.height = values[1];
+            source.bytes = values[2] > 255 ? 2 : 1;
+            source.big_endian = true;
+            source.data = ftell(source.file);
+        } else {
+            seek(source.file, 0);
+#ifdef _WIN32
+            _fseeki64(source.file, 0, SEEK_END);
+            long long size = _ftelli64(source.file);
+#else
+            fseeko(source.file, 0, SEEK_END);
+            long long size = ftello(source.file);
+#endif
+            if (source.width <= 0) {
+                source.width = source.height = (int) std::sqrt(size / 2.0);
+            } else if (source.height <= 0) {
+                source.height = size / 2 / source.width;
+            }
+            source.data = 0;
+            if ((long long) source.width * source.height * 2 > size) {
+                std::cerr << "!!!ERROR: " << path << " holds fewer than " << source.width << "x" << source.height
+                          << " 16 bit samples" << std::endl;
+                return false;
+            }
+        }
+        if (source.width < 2 || source.height < 2) {
+            std::cerr << "!!!ERROR: " << path << " is smaller than 2x2 samples" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /// count rows from first on, clamped to the source, widened to 16 bit
+    static bool read_band(const Source& source, int first, int count, std::vector<Sample>& band) {
+        size_t row_bytes = (size_t) source.width * source.bytes;
+        std::vector<unsigned char> bytes(row_bytes);
+        band.resize((size_t) count * source.width);
+        for (int j = 0; j < count; j++) {
+            int z = std::min(std::max(first + j, 0), source.height - 1);
+            if (!seek(source.file, source.data + (unsigned long long) z * row_bytes) ||
+                fread(&bytes[0], 1, row_bytes, source.file) != row_bytes) {
+                std::cerr << "!!!ERROR: the DEM ends before row " << z << std::endl;
+                return false;
+            }
+            Sample* out = &band[(size_t) j * source.width];
+            for (int i = 0; i < source.width; i++) {
+                if (source.bytes == 1) {
+                    out[i] = bytes[i] * 257;
+                } else if (source.big_endian) {
+                    out[i] = (bytes[2 * i] << 8) | bytes[2 * i + 1];
+                } else {
+                    out[i] = bytes[2 * i] | (bytes[2 * i + 1] << 8);
+                }
+            }
+        }
+        return true;
+    }
+
+    bool map(const std::string& path) {
+#ifdef _WIN32
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        _fseeki64(file, 0, SEEK_END);
+        _buffer.resize(_ftelli64(file));
+        _fseeki64(file, 0, SEEK_SET);
+        bool ok = !_buffer.empty() && fread(&_buffer[0], 1, _buffer.size(), file) == _buffer.size();
+        fclose(file);
+        if (!ok) return false;
+        _data = &_buffer[0];
+        _size = _buffer.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        _data = (const char*) data;
+        _size = info.st_size;
+#endif
+        return true;
+    }
+};
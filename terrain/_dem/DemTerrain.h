@@ -0,0 +1,168 @@
+#pragma once
+#include "icg_common.h"
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "../_culling/Frustum.h"
+#include "../_render/GLState.h"
+#include "../_grid/Grid.h"
+#include "../_grid/PatchMesh.h"
+#include "DemFile.h"
+#include "VirtualHeightmap.h"
+
+/// Nodes drawn and culled by the last DemTerrain::draw
+struct DemStats {
+    int nodes;
+    int culled;
+    size_t triangles;
+};
+
+/// Terrain of a DEM too large for memory, from a DemFile. The quadtree of
+/// the file's tiles is walked from its coarsest tile: nodes outside the
+/// frustum are culled by the tile bounds, and nodes closer than lod_range
+/// times their size are split into the four tiles of the finer level. Each
+/// selected tile is requested from the VirtualHeightmap and drawn as one
+/// patch of tile^2 quads at its level; dem_vshader.glsl reads its heights
+/// through the page table, and a skirt hides the cracks between levels.
+/// The DEM spans [-1, 1] along its longer side.
+class DemTerrain {
+protected:
+    struct Node {
+        int level, tx, tz;
+        float skirt;            ///< world depth, the height range of the tile
+    };
+
+    DemFile _file;
+    VirtualHeightmap _heights;
+    PatchMesh _patch;           ///< a tile and the ring of its skirt
+    GLuint _pid;                ///< GLSL shader program ID
+    Grid* _materials;           ///< provides the material textures
+    float _spacing;             ///< world distance between level 0 samples
+    float _height_scale;        ///< world height of a normalized sample
+    float _height_offset;       ///< world height of sample 0
+    float _lod_range;
+    std::vector<Node> _selection;
+    DemStats _stats;
+
+public:
+    /// Opens the file at path; the atlas takes budget_mb, the highest
+    /// sample is height world units above the lowest
+    bool init(const std::string& path, Grid* materials, size_t budget_mb, float height = 0.5f,
+              float lod_range = 2.0f) {
+        if (!_file.open(path)) return false;
+        if (_file.page_side() > 256) {
+            std::cerr << "!!!ERROR: " << path << " has tiles over 253 cells, too many for 16 bit indices"
+                      << std::endl;
+            return false;
+        }
+        _materials = materials;
+        _lod_range = lod_range;
+        _spacing = 2.0f / (std::max(_file.width(), _file.height()) - 1);
+        float range = std::max(1, _file.max() - _file.min());
+        _height_scale = 65535.0f * height / range;
+        _height_offset = -_file.min() * height / range;
+        _stats = DemStats();
+
+        _pid = opengp::load_shaders("_dem/dem_vshader.glsl", "_stream/tile_fshader.glsl");
+        if(!_pid) exit(EXIT_FAILURE);
+
+        _patch.init(_file.tile() + 2, std::vector<int>(1, 1), false);
+        _heights.init(&_file, budget_mb);
+        std::cout << path << ": " << _file.width() << "x" << _file.height() << " samples, " << _file.levels()
+                  << " levels, " << _heights.pages() << " atlas pages" << std::endl;
+        return true;
+    }
+
+    void cleanup() {
+        _heights.cleanup();
+        _patch.cleanup();
+        glDeleteProgram(_pid);
+        _file.close();
+    }
+
+    /// Selects the tiles for a camera at camera_pos, pages in the missing
+    /// ones and draws those in frustum
+    void draw(const mat4& VP, const Frustum& frustum, const vec3& camera_pos) {
+        _selection.clear();
+        _stats.nodes = 0;
+        _stats.culled = 0;
+        _stats.triangles = 0;
+        _heights.begin_frame();
+        select(_file.levels() - 1, 0, 0, frustum, camera_pos);
+        _heights.update();
+
+        GLState& state = GLState::instance();
+        state.use_program(_pid);
+        state.bind_vertex_array(_patch.vao());
+        _materials->bind_materials(_pid);
+        _heights.bind(_pid, 2);
+        glUniformMatrix4fv(glGetUniformLocation(_pid, "mvp"), 1, GL_FALSE, VP.data());
+        glUniform2i(glGetUniformLocation(_pid, "last_sample"), _file.width() - 1, _file.height() - 1);
+        glUniform1f(glGetUniformLocation(_pid, "sample_spacing"), _spacing);
+        glUniform2f(glGetUniformLocation(_pid, "height_range"), _height_scale, _height_offset);
+        GLint node_id = glGetUniformLocation(_pid, "node");
+        GLint skirt_id = glGetUniformLocation(_pid, "skirt");
+        for (size_t i = 0; i < _selection.size(); i++) {
+            const Node& node = _selection[i];
+            glUniform3i(node_id, node.tx, node.tz, node.level);
+            glUniform1f(skirt_id, node.skirt);
+            _patch.draw(0);
+        }
+        _stats.nodes = _selection.size();
+        ///--- the whole patch, the skirt ring included
+        size_t cells = _file.tile() + 2;
+        _stats.triangles = 2 * cells * cells * _selection.size();
+    }
+
+    /// Height of the level 0 sample nearest to world (x, z)
+    float height(float x, float z) const {
+        int i = (int) std::floor((x + 1.0f) / _spacing + 0.5f);
+        int j = (int) std::floor((z + 1.0f) / _spacing + 0.5f);
+        return _file.sample(i, j) / 65535.0f * _height_scale + _height_offset;
+    }
+
+    const DemStats& stats() const { return _stats; }
+
+    void print(std::ostream& out) const {
+        out << "DEM tiles: " << _stats.nodes << " drawn, " << _stats.culled << " culled, "
+            << _stats.triangles / 1000 << "k triangles" << std::endl;
+        _heights.print(out);
+    }
+
+protected:
+    void select(int level, int tx, int tz, const Frustum& frustum, const vec3& camera_pos) {
+        ///--- World bounds of the tile
+        const DemFile::Level& info = _file.level(level);
+        int tile = _file.tile();
+        float cell = _spacing * (1 << level);
+        float x0 = -1.0f + tx * tile * cell, z0 = -1.0f + tz * tile * cell;
+        float x1 = std::min(-1.0f + std::min((tx + 1) * tile, info.width - 1) * cell,
+                            -1.0f + (_file.width() - 1) * _spacing);
+        float z1 = std::min(-1.0f + std::min((tz + 1) * tile, info.height - 1) * cell,
+                            -1.0f + (_file.height() - 1) * _spacing);
+        DemFile::Sample lo, hi;
+        _file.bounds(level, tx, tz, lo, hi);
+        float y0 = lo / 65535.0f * _height_scale + _height_offset;
+        float y1 = hi / 65535.0f * _height_scale + _height_offset;
+        if (!frustum.intersects(x0, y0, z0, x1, y1, z1)) {
+            _stats.culled++;
+            return;
+        }
+
+        vec3 nearest(std::min(std::max(camera_pos.x(), x0), x1), std::min(std::max(camera_pos.y(), y0), y1),
+                     std::min(std::max(camera_pos.z(), z0), z1));
+        if (level > 0 && (camera_pos - nearest).norm() < _lod_range * tile * cell) {
+            const DemFile::Level& finer = _file.level(level - 1);
+            for (int cz = 2 * tz; cz < std::min(2 * tz + 2, finer.tiles_z); cz++) {
+                for (int cx = 2 * tx; cx < std::min(2 * tx + 2, finer.tiles_x); cx++) {
+                    select(level - 1, cx, cz, frustum, camera_pos);
+                }
+            }
+            return;
+        }
+        Node node = { level, tx, tz, std::max(y1 - y0, cell) };
+        _selection.push_back(node);
+        _heights.request(level, tx, tz);
+    }
+};
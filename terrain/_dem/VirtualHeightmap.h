@@ -0,0 +1,258 @@
+#pragma once
+#include "icg_common.h"
+#include <list>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include "../_render/GLState.h"
+#include "DemFile.h"
+
+/// What the last VirtualHeightmap::update did
+struct VirtualHeightmapStats {
+    int requested;      ///< tiles asked for this frame
+    int missing;        ///< of them not resident after the update
+    int uploaded;
+    int evicted;
+    int resident;
+};
+
+/// Tiles of a DemFile paged into a fixed GPU atlas. Every level of the
+/// file has a mip level of a page table texture with an entry per tile:
+/// the atlas page of the finest resident tile covering it, and that tile's
+/// level. The vertex shader reads the entry and samples the page, so a
+/// tile that is not resident yet shows its resident ancestor, coarser but
+/// never missing. The coarsest tile is always resident; the others are
+/// uploaded on request, coarse levels first and a few per frame, into the
+/// pages of the least recently used tiles that were not requested in the
+/// frame. The atlas size is the memory budget.
+class VirtualHeightmap {
+protected:
+    typedef long long TileKey;
+
+    /// A page table texel
+    struct Entry {
+        GLushort x, y;          ///< atlas page
+        GLushort level;         ///< of the page's tile
+        GLushort unused;
+    };
+
+    struct Page {
+        int level, tx, tz;      ///< tile held, level -1 if none
+        unsigned int frame;     ///< last requested
+        std::list<int>::iterator lru;
+    };
+
+    struct Request {
+        int level, tx, tz;
+    };
+
+    const DemFile* _file;
+    GLuint _atlas;              ///< R16 pages of page_side()^2 samples
+    GLuint _page_table;         ///< RGBA16UI Entry per tile, a mip level per file level
+    int _pages_x;               ///< pages per atlas row
+    int _table_side;            ///< page table texels of level 0, a power of two
+    int _uploads_per_frame;
+    unsigned int _frame;
+
+    std::vector<Page> _pages;
+    std::list<int> _lru;        ///< evictable pages, least recently used last
+    std::unordered_map<TileKey, int> _resident;     ///< page of every resident tile
+    std::vector<Request> _requests;                 ///< missing tiles of this frame
+    std::vector<std::vector<Entry> > _table;        ///< CPU copy, per level
+    bool _table_dirty;
+    VirtualHeightmapStats _stats;
+
+public:
+    /// Pages budget_mb of the atlas, uploads_per_frame tiles at most per update()
+    void init(const DemFile* file, size_t budget_mb, int uploads_per_frame = 8) {
+        _file = file;
+        _uploads_per_frame = uploads_per_frame;
+        _frame = 0;
+        _stats = VirtualHeightmapStats();
+
+        ///--- As many square pages as fit in the budget and a texture
+        GLint max_size;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        int side = file->page_side();
+        int pages = std::max<size_t>(2, (budget_mb << 20) / file->page_bytes());
+        _pages_x = std::min(max_size / side, (int) std::ceil(std::sqrt((double) pages)));
+        int pages_y = std::min(max_size / side, (pages + _pages_x - 1) / _pages_x);
+        pages = std::min(pages, _pages_x * pages_y);
+
+        GLState& state = GLState::instance();
+        glGenTextures(1, &_atlas);
+        state.bind_texture(0, GL_TEXTURE_2D, _atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, _pages_x * side, pages_y * side, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        ///--- Page table mip levels hold the tiles of the file's levels
+        const DemFile::Level& finest = file->level(0);
+        _table_side = 1;
+        while (_table_side < std::max(finest.tiles_x, finest.tiles_z)) _table_side *= 2;
+        _table.resize(file->levels());
+        glGenTextures(1, &_page_table);
+        state.bind_texture(0, GL_TEXTURE_2D, _page_table);
+        for (int l = 0; l < file->levels(); l++) {
+            int n = std::max(1, _table_side >> l);
+            _table[l].assign((size_t) n * n, Entry());
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA16UI, n, n, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, file->levels() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        ///--- Page 0 holds the coarsest tile for good, the others start free
+        _pages.resize(pages);
+        for (int p = 0; p < pages; p++) {
+            Page& page = _pages[p];
+            page.level = -1;
+            page.frame = 0;
+            if (p > 0) page.lru = _lru.insert(_lru.end(), p);
+        }
+        upload(0, file->levels() - 1, 0, 0);
+        _stats.uploaded = 0;
+        _table_dirty = true;
+        update();
+    }
+
+    void cleanup() {
+        glDeleteTextures(1, &_atlas);
+        glDeleteTextures(1, &_page_table);
+        _pages.clear();
+        _lru.clear();
+        _resident.clear();
+    }
+
+    /// Starts collecting the tiles drawn in a frame
+    void begin_frame() {
+        _frame++;
+        _requests.clear();
+        _stats.requested = 0;
+    }
+
+    /// Marks tile (tx, tz) of level l as needed in this frame
+    void request(int l, int tx, int tz) {
+        _stats.requested++;
+        std::unordered_map<TileKey, int>::iterator it = _resident.find(key(l, tx, tz));
+        if (it == _resident.end()) {
+            Request r = { l, tx, tz };
+            _requests.push_back(r);
+            _file->prefetch(l, tx, tz);
+            return;
+        }
+        Page& page = _pages[it->second];
+        page.frame = _frame;
+        if (it->second > 0) _lru.splice(_lru.begin(), _lru, page.lru);
+    }
+
+    /// Uploads missing tiles, coarsest first, and refreshes the page table
+    void update() {
+        std::sort(_requests.begin(), _requests.end(),
+                  [](const Request& a, const Request& b) { return a.level > b.level; });
+        _stats.uploaded = 0;
+        _stats.evicted = 0;
+        size_t r = 0;
+        for (; r < _requests.size() && _stats.uploaded < _uploads_per_frame; r++) {
+            ///--- A free page, or the least recently used one not needed now
+            int p = _lru.back();
+            Page& page = _pages[p];
+            if (page.level >= 0 && page.frame == _frame) break;
+            if (page.level >= 0) {
+                _resident.erase(key(page.level, page.tx, page.tz));
+                _stats.evicted++;
+            }
+            const Request& request = _requests[r];
+            upload(p, request.level, request.tx, request.tz);
+            page.frame = _frame;
+            _lru.splice(_lru.begin(), _lru, page.lru);
+        }
+        _stats.missing = _requests.size() - r;
+        _stats.resident = _resident.size();
+        if (_stats.uploaded > 0 || _stats.evicted > 0) _table_dirty = true;
+        if (_table_dirty) upload_table();
+    }
+
+    /// Binds the atlas and the page table to texture units unit and unit + 1
+    /// for the given program
+    void bind(GLuint pid, int unit) const {
+        GLState& state = GLState::instance();
+        state.bind_texture(unit, GL_TEXTURE_2D, _atlas);
+        state.bind_sampler(unit, 0);
+        glUniform1i(glGetUniformLocation(pid, "atlas"), unit);
+        state.bind_texture(unit + 1, GL_TEXTURE_2D, _page_table);
+        state.bind_sampler(unit + 1, 0);
+        glUniform1i(glGetUniformLocation(pid, "page_table"), unit + 1);
+        glUniform1i(glGetUniformLocation(pid, "tile_cells"), _file->tile());
+    }
+
+    const VirtualHeightmapStats& stats() const { return _stats; }
+    int pages() const { return _pages.size(); }
+    /// GPU memory of the atlas and the page table
+    size_t bytes() const {
+        size_t table = 0;
+        for (size_t l = 0; l < _table.size(); l++) table += _table[l].size() * sizeof(Entry);
+        return _pages.size() * _file->page_bytes() + table;
+    }
+
+    void print(std::ostream& out) const {
+        out << "Tile atlas: " << _stats.resident << "/" << _pages.size() << " pages resident ("
+            << bytes() / (1024.0 * 1024.0) << " MB), " << _stats.requested << " requested, " << _stats.missing
+            << " missing, " << _stats.uploaded << " uploaded, " << _stats.evicted << " evicted" << std::endl;
+    }
+
+protected:
+    static TileKey key(int l, int tx, int tz) {
+        return ((TileKey) l << 48) | ((TileKey) tx << 24) | (TileKey) tz;
+    }
+
+    void upload(int p, int l, int tx, int tz) {
+        Page& page = _pages[p];
+        page.level = l;
+        page.tx = tx;
+        page.tz = tz;
+        _resident[key(l, tx, tz)] = p;
+        int side = _file->page_side();
+        GLState::instance().bind_texture(0, GL_TEXTURE_2D, _atlas);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (p % _pages_x) * side, (p / _pages_x) * side, side, side, GL_RED,
+                        GL_UNSIGNED_SHORT, _file->page(l, tx, tz));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        _stats.uploaded++;
+    }
+
+    /// Every entry points to its own tile's page if resident, else to its
+    /// parent's entry, from the coarsest level down
+    void upload_table() {
+        int levels = _table.size();
+        for (int l = levels - 1; l >= 0; l--) {
+            const DemFile::Level& level = _file->level(l);
+            int n = std::max(1, _table_side >> l);
+            for (int tz = 0; tz < level.tiles_z; tz++) {
+                for (int tx = 0; tx < level.tiles_x; tx++) {
+                    Entry& entry = _table[l][(size_t) tz * n + tx];
+                    std::unordered_map<TileKey, int>::const_iterator it = _resident.find(key(l, tx, tz));
+                    if (it != _resident.end()) {
+                        entry.x = it->second % _pages_x;
+                        entry.y = it->second / _pages_x;
+                        entry.level = l;
+                    } else {
+                        int parent_n = std::max(1, _table_side >> (l + 1));
+                        entry = _table[l + 1][(size_t) (tz / 2) * parent_n + tx / 2];
+                    }
+                }
+            }
+        }
+        GLState::instance().bind_texture(0, GL_TEXTURE_2D, _page_table);
+        for (int l = 0; l < levels; l++) {
+            int n = std::max(1, _table_side >> l);
+            glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, n, n, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, &_table[l][0]);
+        }
+        _table_dirty = false;
+    }
+};
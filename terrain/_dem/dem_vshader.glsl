@@ -0,0 +1,60 @@
+#version 330 core
+uniform mat4 mvp;
+uniform sampler2D atlas;        ///< R16 pages of (tile_cells + 3)^2 samples, see VirtualHeightmap
+uniform usampler2D page_table;  ///< per tile of every level: atlas page xy, level of the page
+uniform int tile_cells;         ///< cells per tile side
+uniform ivec3 node;             ///< tile x, tile z and level drawn
+uniform ivec2 last_sample;      ///< of level 0, along x and z
+uniform float sample_spacing;   ///< world distance between two level 0 samples
+uniform vec2 height_range;      ///< world height of a normalized sample h: h * x + y
+uniform float skirt;            ///< world depth of the skirt around the tile
+
+out vec3 normal;
+out vec2 uv;
+out float height;
+out float gl_ClipDistance[1];
+
+// Last sample of a level, ceil(last_sample / 2^level)
+ivec2 last_at(int level) {
+    return (last_sample + ivec2((1 << level) - 1)) >> level;
+}
+
+// Height at the continuous sample position s of a level. The page table
+// gives the page of the finest resident tile over s, the tile itself or
+// an ancestor, and the page's apron holds the samples the filter needs.
+float height_at(vec2 s, int level) {
+    s = clamp(s, vec2(0.0), vec2(last_at(level)));
+    ivec2 tile = ivec2(max(s - vec2(1.0), vec2(0.0))) / tile_cells;
+    uvec4 entry = texelFetch(page_table, tile, level);
+    int coarser = int(entry.z) - level;
+    vec2 local = s / float(1 << coarser) - vec2((tile >> coarser) * tile_cells) + vec2(1.0);
+    vec2 texel = vec2(entry.xy) * float(tile_cells + 3) + local + vec2(0.5);
+    return texture(atlas, texel / vec2(textureSize(atlas, 0))).x * height_range.x + height_range.y;
+}
+
+void main() {
+    // vertices 1 to tile_cells + 1 of the patch cover the tile, the outer
+    // ring repeats its edge lowered into a skirt
+    int side = tile_cells + 3;
+    ivec2 vertex = ivec2(gl_VertexID % side, gl_VertexID / side);
+    ivec2 inner = clamp(vertex - ivec2(1), ivec2(0), ivec2(tile_cells));
+    int level = node.z;
+    ivec2 s = min(node.xy * tile_cells + inner, last_at(level));
+    vec2 world = vec2(min(s << level, last_sample)) * sample_spacing - vec2(1.0);
+    height = height_at(vec2(s), level);
+
+    // central differences at the tile's level, as tile_vshader
+    float spacing = sample_spacing * float(1 << level);
+    float dx = height_at(vec2(s + ivec2(1, 0)), level) - height_at(vec2(s - ivec2(1, 0)), level);
+    float dz = height_at(vec2(s + ivec2(0, 1)), level) - height_at(vec2(s - ivec2(0, 1)), level);
+    normal = normalize(vec3(-dx, 2.0 * spacing, -dz));
+
+    // material coordinates keep tiling across the whole world
+    uv = (world + vec2(1.0)) * 0.5;
+
+    // no skirt along the border of the DEM, where nothing can crack
+    bool border = any(equal(s, ivec2(0))) || any(equal(s, last_at(level)));
+    float y = vertex == inner + ivec2(1) || border ? height : height - skirt;
+    gl_Position = mvp * vec4(world.x, y, world.y, 1.0);
+    gl_ClipDistance[0] = height;
+}
@@ -0,0 +1,313 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include "../_threads/ThreadPool.h"
+
+/// Parameters of a droplet erosion run, heights in world units with texels
+/// 2 / (dim - 1) apart, like the terrain
+struct ErosionParams {
+    size_t droplets;
+    int lifetime;           ///< steps of one texel before a droplet evaporates
+    int radius;             ///< of the erosion brush, in texels
+    float inertia;          ///< how much a droplet keeps its direction, 0 follows the slope
+    float capacity;         ///< sediment carried per unit of speed, water and drop
+    float min_capacity;     ///< keeps eroding on flat ground
+    float erode_speed;      ///< fraction of the free capacity taken per step
+    float deposit_speed;    ///< fraction of the excess sediment dropped per step
+    float evaporation;      ///< fraction of the water lost per step
+    float gravity;
+    unsigned int seed;
+
+    ErosionParams() : droplets(1000000), lifetime(30), radius(3), inertia(0.05f), capacity(4.0f),
+        min_capacity(0.001f), erode_speed(0.3f), deposit_speed(0.3f), evaporation(0.01f), gravity(4.0f),
+        seed(1) {}
+};
+
+/// Outcome of a droplet erosion run
+struct ErosionStats {
+    int dim;
+    int threads;
+    size_t droplets;
+    size_t steps;           ///< droplet steps simulated
+    size_t stopped;         ///< droplets that rolled off the map
+    double eroded;          ///< height removed, summed over the texels
+    double deposited;       ///< height added, summed over the texels
+    double total_ms;
+
+    void print(std::ostream& out) const {
+        out << "Eroded " << dim << "x" << dim << " with " << droplets << " droplets in " << total_ms << " ms on "
+            << threads << " threads (" << droplets / (total_ms * 1e3) << " M droplets/s), "
+            << (double) steps / std::max<size_t>(droplets, 1) << " steps per droplet, "
+            << 100.0 * stopped / std::max<size_t>(droplets, 1) << "% off the map, "
+            << "eroded " << eroded << ", deposited " << deposited << std::endl;
+    }
+};
+
+/// Hydraulic erosion by water droplets rolling down the heightmap,
+/// picking up sediment where they speed up and dropping it where they slow
+/// down or evaporate.
+///
+/// Droplets spawned in a tile cannot roll more than lifetime texels out of
+/// it and write at most radius texels beyond that, so with tiles wider
+/// than twice this margin, tiles of the same color in a 2x2 checkerboard
+/// never touch each other's texels: each pass runs the four colors one
+/// after the other, the tiles of a color in parallel. The tile grid moves
+/// by a random offset every pass, so no texel is always eroded in the same
+/// color. Every tile has its own random sequence, so the result does not
+/// depend on the number of threads.
+class DropletErosion {
+protected:
+    ThreadPool& _pool;
+    int _tile_size;
+    int _dim;
+    std::vector<float> _eroded;     ///< height removed per texel
+    std::vector<float> _deposited;  ///< height added per texel
+
+    ///--- Erosion brush: texel offsets within radius and their weights
+    std::vector<int> _brush_x, _brush_y;
+    std::vector<float> _brush_weight;
+    int _brush_radius;
+
+    struct Tile {
+        int x0, y0, x1, y1;         ///< droplets spawn in [x0, x1) x [y0, y1)
+        int mx0, my0, mx1, my1;     ///< and roll within [mx0, mx1) x [my0, my1)
+    };
+
+    /// Counters of one tile, summed once all are done
+    struct TileStats {
+        size_t droplets, steps, stopped;
+        double eroded, deposited;
+    };
+
+    /// xorshift64*, one per tile
+    struct Random {
+        unsigned long long state;
+        explicit Random(unsigned long long seed) : state(seed ? seed : 0x9e3779b97f4a7c15ull) {}
+        float next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return (float) ((state * 0x2545f4914f6cdd1dull) >> 40) / 16777216.0f;
+        }
+    };
+
+public:
+    static const int PASSES = 8;    ///< tile grid offsets the droplets are spread over
+
+    explicit DropletErosion(ThreadPool& pool, int tile_size = 128) :
+        _pool(pool), _tile_size(tile_size), _dim(0), _brush_radius(-1) {}
+
+    /// Erodes dim x dim heights in place, rows along +z, and accumulates
+    /// what was removed and added per texel in eroded() and deposited()
+    ErosionStats erode(float* heights, int dim, const ErosionParams& p) {
+        typedef std::chrono::high_resolution_clock Clock;
+        Clock::time_point start = Clock::now();
+        if (_dim != dim) {
+            _dim = dim;
+            _eroded.assign((size_t) dim * dim, 0.0f);
+            _deposited.assign((size_t) dim * dim, 0.0f);
+        }
+        make_brush(p.radius);
+        ///--- Same colored tiles are a tile apart, wider than the writes beyond a tile
+        int margin = p.lifetime;
+        int tile = std::max(_tile_size, 2 * (margin + p.radius) + 2);
+
+        ErosionStats stats = ErosionStats();
+        stats.dim = dim;
+        stats.threads = _pool.size();
+        Random offsets(p.seed);
+        for (int pass = 0; pass < PASSES; pass++) {
+            int ox = (int) (offsets.next() * tile), oy = (int) (offsets.next() * tile);
+            std::vector<Tile> colors[4];
+            for (int j = 0, y = oy - tile; y < dim; j++, y += tile) {
+                for (int i = 0, x = ox - tile; x < dim; i++, x += tile) {
+                    Tile t = { std::max(x, 0), std::max(y, 0), std::min(x + tile, dim - 1), std::min(y + tile, dim - 1),
+                               std::max(x - margin, 0), std::max(y - margin, 0),
+                               std::min(x + tile + margin, dim - 1), std::min(y + tile + margin, dim - 1) };
+                    if (t.x0 < t.x1 && t.y0 < t.y1) colors[(j & 1) * 2 + (i & 1)].push_back(t);
+                }
+            }
+            ///--- Droplets of the pass spread evenly over the map
+            size_t first = p.droplets * pass / PASSES, last = p.droplets * (pass + 1) / PASSES;
+            double density = (double) (last - first) / ((double) (dim - 1) * (dim - 1));
+            for (int c = 0; c < 4; c++) {
+                std::vector<TileStats> tile_stats(colors[c].size());
+                const Tile* tiles = colors[c].empty() ? NULL : &colors[c][0];
+                TileStats* results = tile_stats.empty() ? NULL : &tile_stats[0];
+                DropletErosion* self = this;
+                _pool.parallel_for(0, (int) colors[c].size(), 1, [=, &p](int i, int) {
+                    const Tile& t = tiles[i];
+                    size_t count = (size_t) (density * (t.x1 - t.x0) * (t.y1 - t.y0) + 0.5);
+                    unsigned long long seed = ((unsigned long long) p.seed << 32) ^
+                                              ((unsigned long long) pass << 24) ^ ((unsigned) t.y0 << 12) ^ t.x0;
+                    results[i] = self->erode_tile(heights, t, count, seed * 0x9e3779b97f4a7c15ull, p);
+                });
+                for (size_t i = 0; i < tile_stats.size(); i++) {
+                    stats.droplets += tile_stats[i].droplets;
+                    stats.steps += tile_stats[i].steps;
+                    stats.stopped += tile_stats[i].stopped;
+                    stats.eroded += tile_stats[i].eroded;
+                    stats.deposited += tile_stats[i].deposited;
+                }
+            }
+        }
+        stats.total_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        return stats;
+    }
+
+    /// Forgets the eroded and deposited amounts, e.g. for a new heightmap
+    void reset() {
+        std::fill(_eroded.begin(), _eroded.end(), 0.0f);
+        std::fill(_deposited.begin(), _deposited.end(), 0.0f);
+    }
+
+    /// Height removed and added per texel since the last reset(), dim x dim
+    const float* eroded() const { return _eroded.empty() ? NULL : &_eroded[0]; }
+    const float* deposited() const { return _deposited.empty() ? NULL : &_deposited[0]; }
+
+protected:
+    void make_brush(int radius) {
+        if (radius == _brush_radius) return;
+        _brush_radius = radius;
+        _brush_x.clear();
+        _brush_y.clear();
+        _brush_weight.clear();
+        float sum = 0.0f;
+        for (int y = -radius; y <= radius; y++) {
+            for (int x = -radius; x <= radius; x++) {
+                float w = radius - std::sqrt((float) (x * x + y * y));
+                if (w <= 0.0f && !(x == 0 && y == 0)) continue;
+                w = std::max(w, 1e-3f);
+                _brush_x.push_back(x);
+                _brush_y.push_back(y);
+                _brush_weight.push_back(w);
+                sum += w;
+            }
+        }
+        for (size_t i = 0; i < _brush_weight.size(); i++) _brush_weight[i] /= sum;
+    }
+
+    /// Height and gradient at (x, y), bilinear in the cell of (x, y)
+    void sample(const float* heights, float x, float y, float& h, float& gx, float& gy) const {
+        int ix = (int) x, iy = (int) y;
+        float fx = x - ix, fy = y - iy;
+        const float* cell = heights + (size_t) iy * _dim + ix;
+        float h00 = cell[0], h10 = cell[1], h01 = cell[_dim], h11 = cell[_dim + 1];
+        gx = (h10 - h00) * (1.0f - fy) + (h11 - h01) * fy;
+        gy = (h01 - h00) * (1.0f - fx) + (h11 - h10) * fx;
+        h = h00 * (1.0f - fx) * (1.0f - fy) + h10 * fx * (1.0f - fy) + h01 * (1.0f - fx) * fy + h11 * fx * fy;
+    }
+
+    /// Simulates count droplets spawned in tile t; they stop when leaving
+    /// its margin, i.e. the map
+    TileStats erode_tile(float* heights, const Tile& t, size_t count, unsigned long long seed,
+                         const ErosionParams& p) {
+        TileStats stats = TileStats();
+        Random random(seed);
+        for (size_t d = 0; d < count; d++) {
+            float x = t.x0 + random.next() * (t.x1 - t.x0);
+            float y = t.y0 + random.next() * (t.y1 - t.y0);
+            float dx = 0.0f, dy = 0.0f, speed = 1.0f, water = 1.0f, sediment = 0.0f;
+            stats.droplets++;
+
+            for (int step = 0; step < p.lifetime; step++) {
+                float px = x, py = y;
+                float h, gx, gy;
+                sample(heights, x, y, h, gx, gy);
+
+                ///--- Roll downhill, keeping some of the previous direction
+                dx = dx * p.inertia - gx * (1.0f - p.inertia);
+                dy = dy * p.inertia - gy * (1.0f - p.inertia);
+                float length = std::sqrt(dx * dx + dy * dy);
+                if (length < 1e-12f) break;
+                dx /= length;
+                dy /= length;
+                x += dx;
+                y += dy;
+                stats.steps++;
+                bool inside = x >= t.mx0 && x < t.mx1 && y >= t.my0 && y < t.my1;
+                if (!inside) stats.stopped++;
+
+                ///--- Uphill or over capacity: deposit in the cell left; else erode around it
+                float new_h = h, ngx, ngy;
+                if (inside) sample(heights, x, y, new_h, ngx, ngy);
+                float delta = new_h - h;
+                float capacity = std::max(-delta * speed * water * p.capacity, p.min_capacity);
+                if (!inside || sediment > capacity || delta > 0.0f) {
+                    float amount = !inside ? sediment
+                                 : delta > 0.0f ? std::min(delta, sediment)
+                                 : (sediment - capacity) * p.deposit_speed;
+                    sediment -= amount;
+                    deposit(heights, px, py, amount);
+                    stats.deposited += amount;
+                } else {
+                    float amount = std::min((capacity - sediment) * p.erode_speed, -delta);
+                    sediment += brush(heights, (int) px, (int) py, -amount);
+                    stats.eroded += amount;
+                }
+                if (!inside) break;
+
+                speed = std::sqrt(std::max(0.0f, speed * speed - delta * p.gravity));
+                water *= 1.0f - p.evaporation;
+            }
+            ///--- Evaporated: what is left settles around where the droplet is,
+            /// spread like the erosion or it piles up in spikes
+            if (sediment > 0.0f) {
+                brush(heights, (int) x, (int) y, sediment);
+                stats.deposited += sediment;
+            }
+        }
+        return stats;
+    }
+
+    /// Adds amount bilinearly to the corners of the cell of (x, y)
+    void deposit(float* heights, float x, float y, float amount) {
+        int ix = (int) x, iy = (int) y;
+        float fx = x - ix, fy = y - iy;
+        size_t cell = (size_t) iy * _dim + ix;
+        float w[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+        size_t c[4] = { cell, cell + 1, cell + _dim, cell + _dim + 1 };
+        for (int k = 0; k < 4; k++) {
+            heights[c[k]] += amount * w[k];
+            _deposited[c[k]] += amount * w[k];
+        }
+    }
+
+    /// Adds amount around texel (ix, iy) with the brush weights, removes
+    /// it if negative; returns what was removed
+    float brush(float* heights, int ix, int iy, float amount) {
+        std::vector<float>& changed = amount < 0.0f ? _eroded : _deposited;
+        float sign = amount < 0.0f ? -1.0f : 1.0f;
+        const int r = _brush_radius;
+        if (ix >= r && iy >= r && ix < _dim - r && iy < _dim - r) {
+            float* center = heights + (size_t) iy * _dim + ix;
+            float* total = &changed[(size_t) iy * _dim + ix];
+            for (size_t b = 0; b < _brush_weight.size(); b++) {
+                ptrdiff_t offset = (ptrdiff_t) _brush_y[b] * _dim + _brush_x[b];
+                float share = amount * _brush_weight[b];
+                center[offset] += share;
+                total[offset] += sign * share;
+            }
+            return -amount;
+        }
+        ///--- Near the edges the texels off the map leave their share to the others
+        float inside = 0.0f;
+        for (size_t b = 0; b < _brush_weight.size(); b++) {
+            int x = ix + _brush_x[b], y = iy + _brush_y[b];
+            if (x >= 0 && y >= 0 && x < _dim && y < _dim) inside += _brush_weight[b];
+        }
+        for (size_t b = 0; b < _brush_weight.size(); b++) {
+            int x = ix + _brush_x[b], y = iy + _brush_y[b];
+            if (x < 0 || y < 0 || x >= _dim || y >= _dim) continue;
+            size_t cell = (size_t) y * _dim + x;
+            float share = amount * _brush_weight[b] / inside;
+            heights[cell] += share;
+            changed[cell] += sign * share;
+        }
+        return -amount;
+    }
+};
@@ -1,74 +1,55 @@
 #pragma once
 #include "icg_common.h"
+#include "../_heightmap/HeightPyramid.h"
+#include "../_culling/Frustum.h"
+#include "../_texture/TextureCache.h"
+#include "../_render/GLState.h"
+#include "PatchMesh.h"
+
+/// Chunks submitted and culled by the last Grid::draw
+struct GridStats {
+    int drawn;
+    int culled;
+    size_t triangles;
+};
 
+/// Heightmap terrain at one vertex per texel, in square chunks culled
+/// against the frustum. Every chunk is the same PatchMesh; a row of
+/// visible chunks is one instanced draw, grid_vshader.glsl places the
+/// vertices from gl_VertexID and gl_InstanceID.
 class Grid{
 protected:
-    GLuint _vao;          ///< vertex array object
-    GLuint _vbo_position; ///< memory buffer for positions
-    GLuint _vbo_index;    ///< memory buffer for indice
+    PatchMesh _patch;     ///< one chunk
     GLuint _pid;          ///< GLSL shader program ID
     GLuint _tex;          ///< Height map Texture
-    GLuint _grass;        ///< Grass texture
-    GLuint _rock;         ///< Rock texture
-    GLuint _sand;         ///< Sand texture
-    GLuint _sediment;     ///< Sediment texture;
-    GLuint _snow;         ///< Snow texture;
+    GLuint _materials;    ///< grass, rock, sediment, sand, snow texture array, owned by the TextureCache
     GLuint _mirror_tex;          ///< Height map Texture
-    GLuint _num_indices;  ///< number of vertices to render
+    GLuint _normal_map;   ///< baked normals, 0 if none
+    GLuint _splat;        ///< baked material weights, 0 if none
+    int _grid_dim;        ///< vertices per side
+    int _chunk_cells;     ///< quads per chunk side, a power of two
+    int _chunks;          ///< chunks per side
+    GridStats _stats;
     mat4 _M;              ///< model matrix
     
 public:
     void init(int grid_dim, GLuint texture, GLuint mirror_texture, const char* v_shader,
-                const char* f_shader) {
+                const char* f_shader, int chunk_cells = 64) {
+        _grid_dim = grid_dim;
+        _normal_map = 0;
+        _splat = 0;
+        _chunk_cells = chunk_cells;
+        _chunks = (grid_dim - 2) / chunk_cells + 1;
 
         // Compile the shaders
         _pid = opengp::load_shaders(v_shader, f_shader);
         if(!_pid) exit(EXIT_FAILURE);       
         glUseProgram(_pid);
         
-        // Vertex one vertex Array
-        glGenVertexArrays(1, &_vao);
-        glBindVertexArray(_vao);
-     
-        // Vertex coordinates and indices
-        {
-            std::vector<GLfloat> vertices;
-            std::vector<GLuint> indices;
-
-            for (int y = 0; y < grid_dim; y++) {
-                for (int x = 0; x < grid_dim; x++) {
-                    vertices.push_back(-1.0 + 2.0f * x / (grid_dim - 1.0));
-                    vertices.push_back(1.0 - 2.0f * y / (grid_dim - 1.0));
-                }
-            }
-            int primitive_restart_idx = 0xffffffff;
-            glPrimitiveRestartIndex(primitive_restart_idx);
-            glEnable(GL_PRIMITIVE_RESTART);
-
-            for (int y = 0; y < grid_dim - 1; ++y) {
-                for (int x = 0; x < grid_dim; ++x) {
-                    indices.push_back((y + 1) * grid_dim + x);
-                    indices.push_back(y * grid_dim + x);
-                }
-                indices.push_back(primitive_restart_idx);
-            }  
-            _num_indices = indices.size();
-
-            // position buffer
-            glGenBuffers(1, &_vbo_position);
-            glBindBuffer(GL_ARRAY_BUFFER, _vbo_position);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
-
-            // vertex indices
-            glGenBuffers(1, &_vbo_index);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _vbo_index);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
-
-            // position shader attribute
-            GLuint loc_position = glGetAttribLocation(_pid, "position");
-            glEnableVertexAttribArray(loc_position);
-            glVertexAttribPointer(loc_position, 2, GL_FLOAT, DONT_NORMALIZE, ZERO_STRIDE, ZERO_BUFFER_OFFSET);
-        }
+        // One patch per chunk, instanced along the rows of chunks. Chunk
+        // rows follow the heightmap rows so they line up with HeightPyramid.
+        _patch.init(chunk_cells, std::vector<int>(1, 1), false);
+        _patch.print(std::cout, "Grid");
 
         ///--- Create the model matrix
         typedef Eigen::Transform<float,3,Eigen::Affine> Transform;
@@ -86,117 +67,131 @@ public:
         glBindTexture(GL_TEXTURE_2D, _mirror_tex);
         glBindTexture(GL_TEXTURE_2D, 0);
 
-        ///--- Load Grass texture
-        glGenTextures(1, &_grass);
-        glBindTexture(GL_TEXTURE_2D, _grass);
-        glfwLoadTexture2D("_grid/textures/grass.tga", 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        ///--- Load rock texture
-        glGenTextures(1, &_rock);
-        glBindTexture(GL_TEXTURE_2D, _rock);
-        glfwLoadTexture2D("_grid/textures/rock2.tga", 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        ///--- Load sand texture
-        glGenTextures(1, &_sand);
-        glBindTexture(GL_TEXTURE_2D, _sand);
-        glfwLoadTexture2D("_grid/textures/sand.tga", 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        ///--- Load sediment texture
-        glGenTextures(1, &_sediment);
-        glBindTexture(GL_TEXTURE_2D, _sediment);
-        glfwLoadTexture2D("_grid/textures/sand2.tga", 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        ///--- Load snow texture
-        glGenTextures(1, &_snow);
-        glBindTexture(GL_TEXTURE_2D, _snow);
-        glfwLoadTexture2D("_grid/textures/snow2.tga", 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        _materials = TextureCache::instance().load_array(material_paths());
 
         ///--- to avoid the current object being polluted
         glBindVertexArray(0);
         glUseProgram(0);
     }
            
+    /// Materials, one array layer each in the order of grid_fshader
+    static std::vector<std::string> material_paths() {
+        std::vector<std::string> materials;
+        materials.push_back("_grid/textures/grass.tga");
+        materials.push_back("_grid/textures/rock2.tga");
+        materials.push_back("_grid/textures/sand2.tga");
+        materials.push_back("_grid/textures/sand.tga");
+        materials.push_back("_grid/textures/snow2.tga");
+        return materials;
+    }
+
     void cleanup(){
-        glDeleteBuffers(1, &_vbo_position);
-        glDeleteBuffers(1, &_vbo_index);
-        glDeleteVertexArrays(1, &_vao);
+        _patch.cleanup();
         glDeleteProgram(_pid);
         glDeleteTextures(1, &_tex);
-        glDeleteTextures(1, &_grass);
     }
     
+    /// Maps from TerrainBaker, bound with the materials
+    void set_baked_maps(GLuint normal_map, GLuint splat) {
+        _normal_map = normal_map;
+        _splat = splat;
+    }
+
+    /// Binds the material array to unit 1 and the baked maps to units 7-8
+    /// for the given program
+    void bind_materials(GLuint pid) {
+        GLState& state = GLState::instance();
+        state.bind_texture(1, GL_TEXTURE_2D_ARRAY, _materials);
+        glUniform1i(glGetUniformLocation(pid, "materials"), 1);
+
+        state.bind_texture(7, GL_TEXTURE_2D, _normal_map);
+        glUniform1i(glGetUniformLocation(pid, "normal_map"), 7);
+
+        state.bind_texture(8, GL_TEXTURE_2D, _splat);
+        glUniform1i(glGetUniformLocation(pid, "splat"), 8);
+    }
+
+    /// Draws the whole grid, a call per row of chunks
     void draw(const mat4& VP){
-        glUseProgram(_pid);
-        glBindVertexArray(_vao);
+        bind(VP);
+        for (int cz = 0; cz < _chunks; cz++) draw_chunks(0, cz, _chunks);
+        _stats.drawn = _chunks * _chunks;
+        _stats.culled = 0;
+        _stats.triangles = 2 * (size_t) (_grid_dim - 1) * (_grid_dim - 1);
+    }
+
+    /// Draws the chunks whose bounds, taken from the heightmap's pyramid,
+    /// intersect the frustum. The visible chunks of a row are consecutive,
+    /// the frustum being convex, and drawn in one call.
+    void draw(const mat4& VP, const Frustum& frustum, const HeightPyramid& pyramid){
+        int level = 0;
+        while ((1 << level) < _chunk_cells) level++;
+        float size = 2.0f * _chunk_cells / (_grid_dim - 1);
+
+        bind(VP);
+        _stats.drawn = 0;
+        _stats.culled = 0;
+        _stats.triangles = 0;
+        for (int cz = 0; cz < _chunks; cz++) {
+            int run = -1;       ///< first visible chunk of the run being collected
+            for (int cx = 0; cx <= _chunks; cx++) {
+                float x0 = -1.0f + cx * size, z0 = -1.0f + cz * size;
+                bool visible = cx < _chunks &&
+                    frustum.intersects(x0, pyramid.min_at(level, cx, cz), z0, std::min(x0 + size, 1.0f),
+                                       pyramid.max_at(level, cx, cz), std::min(z0 + size, 1.0f));
+                if (visible) {
+                    if (run < 0) run = cx;
+                    _stats.drawn++;
+                    _stats.triangles += chunk_triangles(cx, cz);
+                    continue;
+                }
+                if (cx < _chunks) _stats.culled++;
+                if (run >= 0) draw_chunks(run, cz, cx - run);
+                run = -1;
+            }
+        }
+    }
+
+    const GridStats& stats() const { return _stats; }
+    const PatchMesh& patch() const { return _patch; }
+
+protected:
+    /// Draws count chunks of row cz from column cx on
+    void draw_chunks(int cx, int cz, int count) {
+        glUniform2i(glGetUniformLocation(_pid, "first_chunk"), cx, cz);
+        _patch.draw(0, count);
+    }
+
+    /// Triangles of one chunk, edge chunks are smaller
+    size_t chunk_triangles(int cx, int cz) const {
+        int w = std::min(_chunk_cells, _grid_dim - 1 - cx * _chunk_cells);
+        int h = std::min(_chunk_cells, _grid_dim - 1 - cz * _chunk_cells);
+        return 2 * (size_t) w * h;
+    }
+
+    /// Program, mesh and textures through GLState, left bound
+    void bind(const mat4& VP){
+        GLState& state = GLState::instance();
+        state.use_program(_pid);
+        state.bind_vertex_array(_patch.vao());
 
         // Bind textures
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _tex);
+        state.bind_texture(0, GL_TEXTURE_2D, _tex);
+        state.bind_sampler(0, 0);
         GLuint tex_id = glGetUniformLocation(_pid, "tex");
         glUniform1i(tex_id, 0);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _grass);
-        GLuint grass_id = glGetUniformLocation(_pid, "grass");
-        glUniform1i(grass_id, 1);
-
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, _rock);
-        GLuint rock_id = glGetUniformLocation(_pid, "rock");
-        glUniform1i(rock_id, 2);
-
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, _sediment);
-        GLuint sediment_id = glGetUniformLocation(_pid, "sediment");
-        glUniform1i(sediment_id, 3);
-
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, _sand);
-        GLuint sand_id = glGetUniformLocation(_pid, "sand");
-        glUniform1i(sand_id, 4);
-
-        glActiveTexture(GL_TEXTURE5);
-        glBindTexture(GL_TEXTURE_2D, _snow);
-        GLuint snow_id = glGetUniformLocation(_pid, "snow");
-        glUniform1i(snow_id, 5);
-        
-        glActiveTexture(GL_TEXTURE6);
-        glBindTexture(GL_TEXTURE_2D, _mirror_tex);
+        bind_materials(_pid);
+
+        state.bind_texture(6, GL_TEXTURE_2D, _mirror_tex);
         GLuint mirror_tex_id = glGetUniformLocation(_pid, "mirror_tex");
         glUniform1i(mirror_tex_id, 6);
         // Setup MVP
         mat4 MVP = VP * _M;
         GLuint MVP_id = glGetUniformLocation(_pid, "mvp");
         glUniformMatrix4fv(MVP_id, 1, GL_FALSE, MVP.data());
-
-        glDrawElements(GL_TRIANGLE_STRIP, _num_indices, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);        
-        glUseProgram(0);
+        glUniform1i(glGetUniformLocation(_pid, "patch_cells"), _chunk_cells);
+        glUniform1i(glGetUniformLocation(_pid, "grid_dim"), _grid_dim);
     }
 };
 
@@ -0,0 +1,106 @@
+#pragma once
+#include <vector>
+#include <iostream>
+#include "icg_common.h"
+#include "VertexCache.h"
+
+/// Square patch of cells^2 quads without vertex buffers: vertex i sits at
+/// column i % (cells + 1) and row i / (cells + 1), and the vertex shader
+/// derives its position from gl_VertexID, the patch's place from uniforms
+/// and gl_InstanceID. Only 16-bit triangle list indices are stored, one
+/// part per vertex step (1 for every vertex, 2 for every other one...),
+/// each in vertex cache optimised order. The vertex array object holds
+/// nothing but the index buffer.
+class PatchMesh {
+public:
+    /// Triangles over every step-th vertex
+    struct Part {
+        int step;
+        GLsizei count;          ///< indices
+        size_t offset;          ///< bytes into the index buffer
+        double acmr_rows;       ///< FIFO 16 miss ratio of the row by row order
+        double acmr;            ///< and of the optimised order
+    };
+
+protected:
+    GLuint _vao;
+    GLuint _ebo;
+    int _cells;
+    std::vector<Part> _parts;
+
+public:
+    /// rising puts the quad diagonals from (x, y) to (x + 1, y + 1),
+    /// otherwise from (x, y + 1) to (x + 1, y)
+    void init(int cells, const std::vector<int>& steps, bool rising) {
+        assert((cells + 1) * (cells + 1) <= 0x10000);
+        _cells = cells;
+        int side = cells + 1;
+        std::vector<GLushort> indices;
+        for (size_t s = 0; s < steps.size(); s++) {
+            int step = steps[s];
+            std::vector<GLushort> part;
+            for (int y = 0; y + step <= cells; y += step) {
+                for (int x = 0; x + step <= cells; x += step) {
+                    ///--- Same triangles and winding as a strip of (a, b) pairs
+                    int a0 = (rising ? y + step : y) * side + x, b0 = (rising ? y : y + step) * side + x;
+                    int a1 = a0 + step, b1 = b0 + step;
+                    GLushort quad[6] = { (GLushort) a0, (GLushort) b0, (GLushort) a1,
+                                         (GLushort) a1, (GLushort) b0, (GLushort) b1 };
+                    part.insert(part.end(), quad, quad + 6);
+                }
+            }
+            Part info = { step, (GLsizei) part.size(), indices.size() * sizeof(GLushort), 0.0, 0.0 };
+            info.acmr_rows = VertexCache::acmr(part);
+            VertexCache::optimize(part, side * side);
+            info.acmr = VertexCache::acmr(part);
+            _parts.push_back(info);
+            indices.insert(indices.end(), part.begin(), part.end());
+        }
+
+        glGenVertexArrays(1, &_vao);
+        glBindVertexArray(_vao);
+        glGenBuffers(1, &_ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+        glBindVertexArray(0);
+    }
+
+    void cleanup() {
+        glDeleteBuffers(1, &_ebo);
+        glDeleteVertexArrays(1, &_vao);
+    }
+
+    GLuint vao() const { return _vao; }
+    int cells() const { return _cells; }
+    const Part& part(int i) const { return _parts[i]; }
+
+    /// Draws part i instances times, the vertex array bound
+    void draw(int i, int instances = 1) const {
+        const Part& p = _parts[i];
+        glDrawElementsInstanced(GL_TRIANGLES, p.count, GL_UNSIGNED_SHORT, (void*) p.offset, instances);
+    }
+
+    /// Bytes of GPU memory, the index buffer
+    size_t bytes() const {
+        const Part& last = _parts.back();
+        return last.offset + last.count * sizeof(GLushort);
+    }
+
+    void print(std::ostream& out, const char* name) const {
+        out << name << " patch " << _cells << "x" << _cells << ": " << bytes() / 1024.0 << " KB of indices, ACMR";
+        for (size_t i = 0; i < _parts.size(); i++) {
+            out << (i ? "," : "") << " step " << _parts[i].step << " " << _parts[i].acmr_rows << " -> "
+                << _parts[i].acmr;
+        }
+        out << " (FIFO 16)" << std::endl;
+    }
+
+    /// {"cells", "bytes", "acmr_rows": [per part], "acmr": [per part]}
+    void print_json(std::ostream& out) const {
+        out << "{\"cells\": " << _cells << ", \"bytes\": " << bytes() << ", \"acmr_rows\": [";
+        for (size_t i = 0; i < _parts.size(); i++) out << (i ? ", " : "") << _parts[i].acmr_rows;
+        out << "], \"acmr\": [";
+        for (size_t i = 0; i < _parts.size(); i++) out << (i ? ", " : "") << _parts[i].acmr;
+        out << "]}";
+    }
+};
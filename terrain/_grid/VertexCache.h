@@ -0,0 +1,133 @@
+#pragma once
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+/// Post-transform vertex cache: a simulator to measure index orders, and
+/// Forsyth's linear-speed optimizer ("Linear-Speed Vertex Cache
+/// Optimisation", 2006) to reorder the triangles of an indexed mesh so
+/// that vertices are reused while still in the cache. Triangles keep their
+/// vertex order, and so their winding.
+class VertexCache {
+public:
+    /// Average cache miss ratio (vertex shader runs per triangle) of
+    /// triangle list indices through a FIFO cache of cache_size vertices;
+    /// 0.5 is the limit of a large regular grid, 3 a cache that never hits
+    template <typename Index>
+    static double acmr(const std::vector<Index>& indices, int cache_size = 16) {
+        if (indices.size() < 3) return 0.0;
+        std::deque<Index> fifo;
+        size_t misses = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (std::find(fifo.begin(), fifo.end(), indices[i]) != fifo.end()) continue;
+            misses++;
+            fifo.push_back(indices[i]);
+            if ((int) fifo.size() > cache_size) fifo.pop_front();
+        }
+        return (double) misses / (indices.size() / 3);
+    }
+
+    /// Reorders the triangles of indices over vertex_count vertices
+    template <typename Index>
+    static void optimize(std::vector<Index>& indices, int vertex_count) {
+        const int CACHE = 32;           ///< modelled LRU cache
+        size_t triangles = indices.size() / 3;
+        if (triangles == 0) return;
+
+        ///--- Triangles of every vertex, as offsets into one array
+        std::vector<int> first(vertex_count + 1, 0), remaining(vertex_count, 0);
+        for (size_t i = 0; i < indices.size(); i++) remaining[indices[i]]++;
+        for (int v = 0; v < vertex_count; v++) first[v + 1] = first[v] + remaining[v];
+        std::vector<int> adjacent(indices.size());
+        std::vector<int> filled(first.begin(), first.end() - 1);
+        for (size_t t = 0; t < triangles; t++) {
+            for (int k = 0; k < 3; k++) adjacent[filled[indices[3 * t + k]]++] = t;
+        }
+
+        std::vector<int> position(vertex_count, -1);   ///< in the cache, -1 outside
+        std::vector<float> vertex_score(vertex_count);
+        for (int v = 0; v < vertex_count; v++) vertex_score[v] = score(-1, remaining[v], CACHE);
+        std::vector<float> triangle_score(triangles);
+        std::vector<bool> emitted(triangles, false);
+        for (size_t t = 0; t < triangles; t++) {
+            triangle_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] +
+                                vertex_score[indices[3 * t + 2]];
+        }
+
+        std::vector<Index> order;
+        order.reserve(indices.size());
+        std::vector<int> cache, next_cache;
+        size_t scan = 0;        ///< no triangle before it is left, for the fallback search
+        int best = -1;
+        for (size_t emitted_count = 0; emitted_count < triangles; emitted_count++) {
+            if (best < 0) {
+                ///--- Nothing in the cache touches a triangle left: best of all
+                float best_score = -1.0f;
+                while (emitted[scan]) scan++;
+                for (size_t t = scan; t < triangles; t++) {
+                    if (!emitted[t] && triangle_score[t] > best_score) {
+                        best_score = triangle_score[t];
+                        best = t;
+                    }
+                }
+            }
+            emitted[best] = true;
+            next_cache.clear();
+            for (int k = 0; k < 3; k++) {
+                Index v = indices[3 * best + k];
+                order.push_back(v);
+                next_cache.push_back(v);
+                ///--- Drop the triangle from the vertex's list
+                int* list = &adjacent[first[v]];
+                int* end = list + remaining[v];
+                std::swap(*std::find(list, end, best), *(end - 1));
+                remaining[v]--;
+            }
+            for (size_t i = 0; i < cache.size(); i++) {
+                int v = cache[i];
+                if (v != (int) indices[3 * best] && v != (int) indices[3 * best + 1] && v != (int) indices[3 * best + 2]) {
+                    next_cache.push_back(v);
+                }
+            }
+            cache.swap(next_cache);
+
+            ///--- Rescore the vertices that moved, and their triangles
+            for (size_t i = 0; i < cache.size(); i++) position[cache[i]] = i < (size_t) CACHE ? i : -1;
+            for (size_t i = 0; i < cache.size(); i++) {
+                int v = cache[i];
+                vertex_score[v] = score(position[v], remaining[v], CACHE);
+            }
+            best = -1;
+            float best_score = -1.0f;
+            for (size_t i = 0; i < cache.size(); i++) {
+                int v = cache[i];
+                for (int a = first[v]; a < first[v] + remaining[v]; a++) {
+                    int t = adjacent[a];
+                    triangle_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] +
+                                        vertex_score[indices[3 * t + 2]];
+                    if (triangle_score[t] > best_score) {
+                        best_score = triangle_score[t];
+                        best = t;
+                    }
+                }
+            }
+            if (cache.size() > (size_t) CACHE) cache.resize(CACHE);
+        }
+        indices.swap(order);
+    }
+
+protected:
+    /// Forsyth's score: recently used vertices and vertices with few
+    /// triangles left are preferred
+    static float score(int cache_position, int remaining, int cache_size) {
+        if (remaining == 0) return -1.0f;
+        float value = 0.0f;
+        if (cache_position >= 3) {
+            value = std::pow(1.0f - (cache_position - 3) / (float) (cache_size - 3), 1.5f);
+        } else if (cache_position >= 0) {
+            value = 0.75f;      // the last triangle's vertices, equal so no strip order is forced
+        }
+        return value + 2.0f * std::pow((float) remaining, -0.5f);
+    }
+};
@@ -1,85 +1,62 @@
 #version 330 core
-uniform sampler2D tex;
-uniform sampler2D grass;
-uniform sampler2D rock;
-uniform sampler2D sediment;
-uniform sampler2D sand;
-uniform sampler2D snow;
+uniform sampler2DArray materials;  ///< one layer per material, see Grid::init
+
+const float GRASS = 0.0;
+const float ROCK = 1.0;
+const float SEDIMENT = 2.0;
+const float SAND = 3.0;
+const float SNOW = 4.0;
+uniform sampler2D normal_map;   ///< baked by TerrainBaker
+uniform sampler2D splat;        ///< grass, rock, sand, snow weights, sediment takes the rest
 
-in vec3 normal;
 in vec2 uv;
+in float height;
 out vec3 color;
 
 const vec3 light_dir = normalize(vec3(1.0, 1.0, 0.0));
-const float WATER_LEVEL = -0.00f;
-const float SNOW_LEVEL = 0.4f;
-
 const vec3 water_color = vec3(0.05, 0.3, 0.5);
 
-float fade(float x) {
-    return x; 
-}
-
-float get_height(vec2 uv) {
-    return texture(tex, uv).x;    
-}
-
-float compute_slope_factor(vec3 normal) {
-    vec3 up = vec3(0,1,0);
-    return dot(normal, up);
-}
-
 vec3 rock_texture(vec2 uv) {
-    return texture(rock, 10*uv).rgb;
+    return texture(materials, vec3(10*uv, ROCK)).rgb;
 }
 
 vec3 grass_texture(vec2 uv) {
-    return texture(grass, 10*uv).rgb;
+    return texture(materials, vec3(10*uv, GRASS)).rgb;
 }
 
 vec3 sediment_texture(vec2 uv) {
-    return texture(sediment, 30*uv).rgb;
+    return texture(materials, vec3(30*uv, SEDIMENT)).rgb;
 }
 
 vec3 sand_texture(vec2 uv) {
-    return texture(sand, 60*uv).rgb;    
+    return texture(materials, vec3(60*uv, SAND)).rgb;    
 }
 
 vec3 snow_texture(vec2 uv) {
-    return texture(snow, 30*uv).rgb;    
-}
-
-vec3 get_sloped_texture(float height, vec2 uv) {
-    float deltaHeight = height - WATER_LEVEL;
-    float alpha = exp(8*deltaHeight);
-    alpha = clamp(alpha,0,1);
-    return mix(sediment_texture(uv), rock_texture(uv), alpha);
+    return texture(materials, vec3(30*uv, SNOW)).rgb;    
 }
 
-vec3 get_plane_texture(float height, vec2 uv) {
-    if (height < WATER_LEVEL + 0.01f) {
-        float deltaHeight = height - WATER_LEVEL;
-        float alpha = exp(20*deltaHeight);
-        alpha = clamp(alpha,0,1);
-        return mix(sand_texture(uv), grass_texture(uv), alpha);
-    }
-    float deltaHeight = height - SNOW_LEVEL;
-    float alpha = exp(8*deltaHeight);
-    alpha = clamp(alpha,0,1);
-    return mix(grass_texture(uv), snow_texture(uv), alpha);
+// Texel k of the baked maps sits at uv k / (size - 1), as the heights
+vec2 baked_uv(sampler2D map, vec2 uv) {
+    vec2 size = vec2(textureSize(map, 0));
+    return (uv * (size - vec2(1.0)) + vec2(0.5)) / size;
 }
 
 void main() {
-    vec3 normal = normalize(normal);
+    vec3 normal = normalize(texture(normal_map, baked_uv(normal_map, uv)).xyz);
     float intensity = max(dot(normal, light_dir), 0.0);
 
-    // get textures adapted to current height
-    float height = get_height(uv);
-    vec3 plane_tex = get_plane_texture(height, uv);
-    vec3 sloped_tex = get_sloped_texture(height, uv);
-
-    float alpha = fade(compute_slope_factor(normal));
-    vec3 tex = mix(sloped_tex, plane_tex, alpha);
+    // only sample the materials present here
+    vec4 weights = texture(splat, baked_uv(splat, uv));
+    // below two quantization steps the remainder is rounding, not sediment
+    float sediment_weight = 1.0 - dot(weights, vec4(1.0));
+    sediment_weight = sediment_weight > 2.0 / 255.0 ? sediment_weight : 0.0;
+    vec3 tex = vec3(0.0);
+    if (weights.r > 0.0) tex += weights.r * grass_texture(uv);
+    if (weights.g > 0.0) tex += weights.g * rock_texture(uv);
+    if (weights.b > 0.0) tex += weights.b * sand_texture(uv);
+    if (weights.a > 0.0) tex += weights.a * snow_texture(uv);
+    if (sediment_weight > 0.0) tex += sediment_weight * sediment_texture(uv);
 
     if(height < .0f) {
         tex = mix(tex, water_color, -height*5.0f);
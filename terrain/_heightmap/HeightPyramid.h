@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+/// Min/max mip pyramid over a square heightmap. Level 0 has one cell per
+/// quad of the grid mesh, (dim - 1)^2 cells whose bounds are those of their
+/// four corner texels; every coarser level merges 2x2 cells, rounding up,
+/// down to a single cell for the whole map. Cells of level l therefore
+/// cover 2^l grid quads, which lines up with power-of-two terrain chunks.
+class HeightPyramid {
+protected:
+    const float* _heights;                  ///< source map, not owned
+    int _dim;                               ///< texels per side of the source map
+    std::vector<int> _cells;                ///< cells per side of every level
+    std::vector<std::vector<float> > _min;  ///< per level min height of every cell
+    std::vector<std::vector<float> > _max;  ///< per level max height of every cell
+
+public:
+    HeightPyramid() : _heights(NULL), _dim(0) {}
+
+    /// heights is dim x dim texels, rows along +z, and must outlive the pyramid
+    void build(const float* heights, int dim) {
+        _heights = heights;
+        _dim = dim;
+        _cells.clear();
+        _min.clear();
+        _max.clear();
+
+        ///--- Level 0 from the corner texels of every quad
+        int n = std::max(1, dim - 1);
+        _cells.push_back(n);
+        _min.push_back(std::vector<float>((size_t) n * n));
+        _max.push_back(std::vector<float>((size_t) n * n));
+        for (int j = 0; j < n; j++) {
+            const float* row0 = heights + (size_t) j * dim;
+            const float* row1 = heights + (size_t) std::min(j + 1, dim - 1) * dim;
+            for (int i = 0; i < n; i++) {
+                int i1 = std::min(i + 1, dim - 1);
+                float a = row0[i], b = row0[i1], c = row1[i], d = row1[i1];
+                _min[0][(size_t) j * n + i] = std::min(std::min(a, b), std::min(c, d));
+                _max[0][(size_t) j * n + i] = std::max(std::max(a, b), std::max(c, d));
+            }
+        }
+
+        ///--- Coarser levels merge up to 2x2 cells of the previous one
+        while (n > 1) {
+            int prev = n;
+            n = (n + 1) / 2;
+            const std::vector<float>& lo = _min.back();
+            const std::vector<float>& hi = _max.back();
+            std::vector<float> level_min((size_t) n * n), level_max((size_t) n * n);
+            for (int j = 0; j < n; j++) {
+                for (int i = 0; i < n; i++) {
+                    float l = FLT_MAX, h = -FLT_MAX;
+                    for (int y = 2 * j; y < std::min(2 * j + 2, prev); y++) {
+                        for (int x = 2 * i; x < std::min(2 * i + 2, prev); x++) {
+                            l = std::min(l, lo[(size_t) y * prev + x]);
+                            h = std::max(h, hi[(size_t) y * prev + x]);
+                        }
+                    }
+                    level_min[(size_t) j * n + i] = l;
+                    level_max[(size_t) j * n + i] = h;
+                }
+            }
+            _cells.push_back(n);
+            _min.push_back(level_min);
+            _max.push_back(level_max);
+        }
+    }
+
+    /// Refreshes the cells touching texels [x, x + w) x [y, y + h) after
+    /// the heights changed there, and their parents up to the root
+    void update(int x, int y, int w, int h) {
+        if (_cells.empty() || w <= 0 || h <= 0) return;
+        ///--- Level 0 cell i spans texels i and i + 1
+        int n = _cells[0];
+        int i0 = std::max(0, x - 1), i1 = std::min(n, x + w);
+        int j0 = std::max(0, y - 1), j1 = std::min(n, y + h);
+        for (int j = j0; j < j1; j++) {
+            const float* row0 = _heights + (size_t) j * _dim;
+            const float* row1 = _heights + (size_t) std::min(j + 1, _dim - 1) * _dim;
+            for (int i = i0; i < i1; i++) {
+                int i_1 = std::min(i + 1, _dim - 1);
+                float a = row0[i], b = row0[i_1], c = row1[i], d = row1[i_1];
+                _min[0][(size_t) j * n + i] = std::min(std::min(a, b), std::min(c, d));
+                _max[0][(size_t) j * n + i] = std::max(std::max(a, b), std::max(c, d));
+            }
+        }
+
+        for (size_t l = 1; l < _cells.size(); l++) {
+            int prev = _cells[l - 1];
+            n = _cells[l];
+            i0 /= 2; j0 /= 2;
+            i1 = std::min(n, (i1 + 1) / 2);
+            j1 = std::min(n, (j1 + 1) / 2);
+            for (int j = j0; j < j1; j++) {
+                for (int i = i0; i < i1; i++) {
+                    float lo = FLT_MAX, hi = -FLT_MAX;
+                    for (int yy = 2 * j; yy < std::min(2 * j + 2, prev); yy++) {
+                        for (int xx = 2 * i; xx < std::min(2 * i + 2, prev); xx++) {
+                            lo = std::min(lo, _min[l - 1][(size_t) yy * prev + xx]);
+                            hi = std::max(hi, _max[l - 1][(size_t) yy * prev + xx]);
+                        }
+                    }
+                    _min[l][(size_t) j * n + i] = lo;
+                    _max[l][(size_t) j * n + i] = hi;
+                }
+            }
+        }
+    }
+
+    int levels() const { return _cells.size(); }
+    int cells(int level) const { return _cells[level]; }
+    int dim() const { return _dim; }
+    const float* heights() const { return _heights; }
+
+    /// Bounds of cell (i, j) of a level, cells past the edge of the map
+    /// take the bounds of the last one so chunks overhanging it still work
+    float min_at(int level, int i, int j) const {
+        int n = _cells[level];
+        return _min[level][(size_t) std::min(j, n - 1) * n + std::min(i, n - 1)];
+    }
+    float max_at(int level, int i, int j) const {
+        int n = _cells[level];
+        return _max[level][(size_t) std::min(j, n - 1) * n + std::min(i, n - 1)];
+    }
+};
@@ -0,0 +1,250 @@
+#pragma once
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <iostream>
+#include "../_noise/NoiseEngine.h"
+#ifdef _WIN32
+#include <vector>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/// Generated heightmaps, and what was derived from them, kept on disk
+/// between launches. Files are named after a key hashing everything the
+/// heightmap depends on (noise parameters, the shader generated from their
+/// noise graph, gradient table, resolution and generator), and hold a
+/// header, a table of sections and the raw data:
+///
+///     Header | Section[NUM_SECTIONS] | heights | normals | splat
+///
+/// open() memory maps the file privately, so sections are used in place
+/// without a copy and writes to them (e.g. an edited heightmap) stay in
+/// this process. Missing derived sections are simply recomputed.
+class HeightmapCache {
+public:
+    typedef unsigned long long Key;
+
+    enum Section {
+        HEIGHTS,    ///< dim x dim float
+        NORMALS,    ///< dim x dim x 3 float, as TerrainBaker
+        SPLAT,      ///< dim x dim x 4 unsigned char, as TerrainBaker
+        NUM_SECTIONS
+    };
+
+    /// Bump whenever the layout or the meaning of a section changes
+    static const unsigned int VERSION = 2;
+
+protected:
+    struct Header {
+        char magic[4];          ///< "THMC"
+        unsigned int version;
+        Key key;
+        int dim;
+        unsigned int sections;  ///< NUM_SECTIONS of the writer
+    };
+
+    struct SectionEntry {
+        unsigned long long offset;  ///< from the start of the file, 0 if absent
+        unsigned long long bytes;
+    };
+
+    std::string _dir;
+    void* _data;        ///< mapped file, NULL if none is open
+    size_t _size;
+    const Header* _header;
+    const SectionEntry* _sections;
+#ifdef _WIN32
+    std::vector<char> _buffer;
+#endif
+
+public:
+    explicit HeightmapCache(const std::string& dir) :
+        _dir(dir), _data(NULL), _size(0), _header(NULL), _sections(NULL) {}
+
+    ~HeightmapCache() {
+        close();
+    }
+
+    /// FNV-1a of the inputs of a generator, source names it ("gpu", "cpu").
+    /// shader is the source PerlinQuad generates for params, which the CPU
+    /// kernels mirror: any change to the noise graph changes the key.
+    static Key key(const NoiseParams& params, const std::string& shader, const float* gradients,
+                   size_t num_gradients, int dim, const char* source) {
+        Key h = 0xcbf29ce484222325ull;
+        unsigned int version = VERSION;
+        h = hash(h, &version, sizeof(version));
+        h = hash(h, &params.frequency, sizeof(params.frequency));
+        h = hash(h, &params.H, sizeof(params.H));
+        h = hash(h, &params.lacunarity, sizeof(params.lacunarity));
+        h = hash(h, &params.octaves, sizeof(params.octaves));
+        h = hash(h, shader.data(), shader.size());
+        h = hash(h, gradients, num_gradients * sizeof(float));
+        h = hash(h, &dim, sizeof(dim));
+        h = hash(h, source, strlen(source));
+        return h;
+    }
+
+    std::string path(Key key) const {
+        char name[64];
+        snprintf(name, sizeof(name), "/heightmap_%016llx.bin", key);
+        return _dir + name;
+    }
+
+    /// Maps the file of key, false if it is missing, stale, truncated or has
+    /// a section of another size than dim gives
+    bool open(Key key, int dim) {
+        close();
+        if (!map(path(key))) return false;
+        _header = (const Header*) _data;
+        _sections = (const SectionEntry*) ((const char*) _data + sizeof(Header));
+        bool valid = _size >= sizeof(Header) && !memcmp(_header->magic, "THMC", 4) &&
+                     _header->version == VERSION && _header->key == key && _header->dim == dim &&
+                     _header->sections == NUM_SECTIONS &&
+                     _size >= sizeof(Header) + NUM_SECTIONS * sizeof(SectionEntry);
+        for (int s = 0; valid && s < NUM_SECTIONS; s++) {
+            const SectionEntry& entry = _sections[s];
+            valid = !entry.offset || (entry.bytes == section_bytes((Section) s, dim) && entry.offset <= _size &&
+                                      entry.bytes <= _size - entry.offset);
+        }
+        if (!valid || !section(HEIGHTS)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool is_open() const {
+        return _data != NULL;
+    }
+
+    /// Start of a section in the mapping, NULL if absent or nothing is open
+    void* section(Section s) const {
+        if (!_data || !_sections[s].offset) return NULL;
+        return (char*) _data + _sections[s].offset;
+    }
+
+    void close() {
+        if (!_data) return;
+#ifdef _WIN32
+        std::vector<char>().swap(_buffer);
+#else
+        munmap(_data, _size);
+#endif
+        _data = NULL;
+        _size = 0;
+        _header = NULL;
+        _sections = NULL;
+    }
+
+    /// Writes the file of key; normals and splat may be NULL. The file is
+    /// written next to its final name and renamed, so a reader never sees
+    /// half of it.
+    bool save(Key key, int dim, const float* heights, const float* normals, const unsigned char* splat) {
+        make_directory();
+        std::string final_path = path(key);
+        std::string temp_path = final_path + ".tmp";
+        FILE* file = fopen(temp_path.c_str(), "wb");
+        if (!file) {
+            std::cerr << "!!!WARNING: cannot write heightmap cache " << temp_path << std::endl;
+            return false;
+        }
+
+        Header header;
+        memcpy(header.magic, "THMC", 4);
+        header.version = VERSION;
+        header.key = key;
+        header.dim = dim;
+        header.sections = NUM_SECTIONS;
+
+        const void* data[NUM_SECTIONS] = { heights, normals, splat };
+        size_t bytes[NUM_SECTIONS] = { section_bytes(HEIGHTS, dim), section_bytes(NORMALS, dim),
+                                       section_bytes(SPLAT, dim) };
+        SectionEntry entries[NUM_SECTIONS];
+        unsigned long long offset = sizeof(Header) + sizeof(entries);
+        for (int s = 0; s < NUM_SECTIONS; s++) {
+            offset = (offset + 63) & ~63ull;  // cache line aligned sections
+            entries[s].offset = data[s] ? offset : 0;
+            entries[s].bytes = data[s] ? bytes[s] : 0;
+            offset += entries[s].bytes;
+        }
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(entries, sizeof(entries), 1, file) == 1;
+        long position = sizeof(header) + sizeof(entries);
+        static const char zeros[64] = {0};
+        for (int s = 0; ok && s < NUM_SECTIONS; s++) {
+            if (!entries[s].offset) continue;
+            ok = fwrite(zeros, 1, entries[s].offset - position, file) == entries[s].offset - position &&
+                 fwrite(data[s], 1, bytes[s], file) == bytes[s];
+            position = entries[s].offset + bytes[s];
+        }
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+            std::cerr << "!!!WARNING: cannot write heightmap cache " << final_path << std::endl;
+            remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+protected:
+    /// Size of a section of a dim x dim heightmap
+    static size_t section_bytes(Section s, int dim) {
+        size_t texels = (size_t) dim * dim;
+        switch (s) {
+        case HEIGHTS: return texels * sizeof(float);
+        case NORMALS: return texels * 3 * sizeof(float);
+        default: return texels * 4;
+        }
+    }
+
+    static Key hash(Key h, const void* data, size_t bytes) {
+        const unsigned char* p = (const unsigned char*) data;
+        for (size_t i = 0; i < bytes; i++) h = (h ^ p[i]) * 0x100000001b3ull;
+        return h;
+    }
+
+    void make_directory() const {
+#ifdef _WIN32
+        _mkdir(_dir.c_str());
+#else
+        mkdir(_dir.c_str(), 0755);
+#endif
+    }
+
+    bool map(const std::string& file_path) {
+#ifdef _WIN32
+        FILE* file = fopen(file_path.c_str(), "rb");
+        if (!file) return false;
+        fseek(file, 0, SEEK_END);
+        _buffer.resize(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        bool ok = !_buffer.empty() && fread(&_buffer[0], 1, _buffer.size(), file) == _buffer.size();
+        fclose(file);
+        if (!ok) return false;
+        _data = &_buffer[0];
+        _size = _buffer.size();
+#else
+        int fd = ::open(file_path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        // private and writable: edits are copy-on-write and never reach the file
+        void* data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        _data = data;
+        _size = info.st_size;
+#endif
+        return true;
+    }
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include <cmath>
+#include <vector>
+#include "icg_common.h"
+#include "TerrainQuery.h"
+#include "../_threads/ThreadPool.h"
+#include "../_texture/TexelRect.h"
+
+/// Bakes, once per generated heightmap, what the terrain shaders used to
+/// recompute for every vertex and fragment:
+///  - a normal map, central differences one texel apart (as TerrainQuery)
+///  - a splat map with the blend weights of the materials, packed as
+///    grass, rock, sand, snow in RGBA; sediment takes the remaining weight,
+///    and covers the others where erosion deposited it (set_sediment)
+/// Texel k of both maps sits at world -1 + 2k / (dim - 1), like the heights.
+class TerrainBaker {
+protected:
+    GLuint _normal_tex;     ///< RGB16F normals
+    GLuint _splat_tex;      ///< RGBA8 material weights
+    int _dim;
+    std::vector<float> _normals;        ///< xyz per texel
+    std::vector<unsigned char> _splat;  ///< rgba per texel
+    const float* _deposited;            ///< height deposited per texel, NULL if none, not owned
+    const float* _eroded;               ///< height eroded per texel, not owned
+    float _full_depth;                  ///< deposit fully covered by sediment
+
+public:
+    ///--- Material levels, same values as the shaders
+    static constexpr float WATER_LEVEL = 0.0f;
+    static constexpr float SNOW_LEVEL = 0.4f;
+
+    void init(int dim) {
+        _dim = dim;
+        _deposited = _eroded = NULL;
+        _full_depth = 1.0f;
+        _normals.resize((size_t) dim * dim * 3);
+        _splat.resize((size_t) dim * dim * 4);
+
+        glGenTextures(1, &_normal_tex);
+        glBindTexture(GL_TEXTURE_2D, _normal_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, dim, dim, 0, GL_RGB, GL_FLOAT, NULL);
+        set_parameters();
+
+        glGenTextures(1, &_splat_tex);
+        glBindTexture(GL_TEXTURE_2D, _splat_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, dim, dim, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        set_parameters();
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void cleanup() {
+        glDeleteTextures(1, &_normal_tex);
+        glDeleteTextures(1, &_splat_tex);
+    }
+
+    /// Bakes both maps from dim x dim heights, in row blocks on pool, and
+    /// uploads them
+    void bake(const float* heights, ThreadPool* pool = NULL) {
+        bake_region(heights, TexelRect(0, 0, _dim, _dim), pool);
+    }
+
+    /// Rebakes the texels whose maps depend on the heights of rect, i.e.
+    /// rect and a one texel border, and uploads just those
+    void bake_region(const float* heights, const TexelRect& changed, ThreadPool* pool = NULL) {
+        TexelRect rect = changed.grow(1).clip(_dim, _dim);
+        if (rect.empty()) return;
+        TerrainQuery query(heights, _dim);
+        const int rows = 16;
+        int blocks = (rect.height + rows - 1) / rows;
+        TerrainBaker* self = this;
+        auto bake_block = [=, &query](int block, int) {
+            int end = std::min(rect.y + rect.height, rect.y + (block + 1) * rows);
+            for (int y = rect.y + block * rows; y < end; y++) {
+                self->bake_row(query, heights, y, rect.x, rect.width);
+            }
+        };
+        if (pool && blocks > 1) {
+            pool->parallel_for(0, blocks, 1, bake_block);
+        } else {
+            for (int b = 0; b < blocks; b++) bake_block(b, 0);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, _dim);
+        glBindTexture(GL_TEXTURE_2D, _normal_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, GL_RGB, GL_FLOAT,
+                        &_normals[((size_t) rect.y * _dim + rect.x) * 3]);
+        glBindTexture(GL_TEXTURE_2D, _splat_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &_splat[((size_t) rect.y * _dim + rect.x) * 4]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    /// Uploads maps baked earlier, laid out as normals() and splat()
+    void upload(const float* normals, const unsigned char* splat) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, _normal_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _dim, _dim, GL_RGB, GL_FLOAT, normals);
+        glBindTexture(GL_TEXTURE_2D, _splat_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _dim, _dim, GL_RGBA, GL_UNSIGNED_BYTE, splat);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    /// Sediment covers the other materials in proportion to the height a
+    /// texel gained, deposited minus eroded (see DropletErosion), fully from
+    /// full_depth on; NULL removes it. Takes effect at the next bake.
+    void set_sediment(const float* deposited, const float* eroded, float full_depth) {
+        _deposited = deposited;
+        _eroded = eroded;
+        _full_depth = full_depth;
+    }
+
+    GLuint normal_texture() const { return _normal_tex; }
+    GLuint splat_texture() const { return _splat_tex; }
+
+    /// CPU copies of the last bake: xyz and rgba per texel, rows along +z
+    const float* normals() const { return &_normals[0]; }
+    const unsigned char* splat() const { return &_splat[0]; }
+
+    /// Material weights of the former per-fragment blend in grid_fshader:
+    /// flat ground goes sand -> grass -> snow with height, slopes go
+    /// sediment -> rock, and the slope factor (normal.y) mixes the two
+    static void splat_weights(float height, float slope, float& grass, float& rock, float& sand, float& snow) {
+        float sloped = std::min(std::exp(8.0f * (height - WATER_LEVEL)), 1.0f);
+        rock = (1.0f - slope) * sloped;
+        if (height < WATER_LEVEL + 0.01f) {
+            float alpha = std::min(std::exp(20.0f * (height - WATER_LEVEL)), 1.0f);
+            sand = slope * (1.0f - alpha);
+            grass = slope * alpha;
+            snow = 0.0f;
+        } else {
+            float alpha = std::min(std::exp(8.0f * (height - SNOW_LEVEL)), 1.0f);
+            grass = slope * (1.0f - alpha);
+            snow = slope * alpha;
+            sand = 0.0f;
+        }
+    }
+
+protected:
+    void set_parameters() {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    static unsigned char unorm8(float w) {
+        return (unsigned char) (std::max(0.0f, std::min(w, 1.0f)) * 255.0f + 0.5f);
+    }
+
+    /// Texels [x0, x0 + width) of row y
+    void bake_row(const TerrainQuery& query, const float* heights, int y, int x0, int width) {
+        std::vector<float> x(width), z(width, -1.0f + 2.0f * y / (_dim - 1));
+        for (int i = 0; i < width; i++) x[i] = -1.0f + 2.0f * (x0 + i) / (_dim - 1);
+
+        float* n = &_normals[((size_t) y * _dim + x0) * 3];
+        std::vector<float> nx(width), ny(width), nz(width);
+        query.normals(&x[0], &z[0], &nx[0], &ny[0], &nz[0], width);
+
+        unsigned char* s = &_splat[((size_t) y * _dim + x0) * 4];
+        const float* h = heights + (size_t) y * _dim + x0;
+        for (int i = 0; i < width; i++) {
+            n[3 * i + 0] = nx[i];
+            n[3 * i + 1] = ny[i];
+            n[3 * i + 2] = nz[i];
+
+            float grass, rock, sand, snow;
+            splat_weights(h[i], ny[i], grass, rock, sand, snow);
+            float cover = 1.0f;
+            if (_deposited) {
+                size_t texel = (size_t) y * _dim + x0 + i;
+                cover -= std::max(0.0f, std::min((_deposited[texel] - _eroded[texel]) / _full_depth, 1.0f));
+            }
+            s[4 * i + 0] = unorm8(grass * cover);
+            s[4 * i + 1] = unorm8(rock * cover);
+            s[4 * i + 2] = unorm8(sand * cover);
+            s[4 * i + 3] = unorm8(snow * cover);
+        }
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include "../_noise/NoiseEngine.h"
+#include "../_threads/ThreadPool.h"
+
+/// Bilinearly filtered height and normal lookups on a square heightmap,
+/// for a single point or for arrays of world positions. Arrays are
+/// processed 8 points at a time with noise::float8 and, given a pool,
+/// split in blocks across its workers.
+///
+/// World x, z in [-1, 1] map onto the texels like the Grid vertices do
+/// (-1 is the first texel, +1 the last one, rows along +z); positions off
+/// the map are clamped to its edge. Normals use central differences one
+/// texel apart, as the terrain vertex shaders do.
+class TerrainQuery {
+protected:
+    const float* _heights;  ///< dim x dim texels, not owned
+    int _dim;
+    float _scale;           ///< texels per world unit / 2
+    float _texel;           ///< world distance between two texels
+
+    static const int BLOCK = 4096;  ///< points per pool task
+
+public:
+    /// Indices are computed in float, exact for maps up to 4096^2
+    TerrainQuery(const float* heights, int dim) :
+        _heights(heights), _dim(dim), _scale(0.5f * (dim - 1)), _texel(2.0f / (dim - 1)) {}
+
+    float height(float x, float z) const { return bilinear(x, z); }
+
+    void normal(float x, float z, float& nx, float& ny, float& nz) const {
+        central_normal(x, z, nx, ny, nz);
+    }
+
+    void heights(const float* x, const float* z, float* h, size_t n, ThreadPool* pool = NULL) const {
+        if (!pool || n <= (size_t) BLOCK) {
+            heights_range(x, z, h, 0, n);
+            return;
+        }
+        const TerrainQuery* self = this;
+        pool->parallel_for(0, (n + BLOCK - 1) / BLOCK, 1, [=](int block, int) {
+            size_t begin = (size_t) block * BLOCK;
+            self->heights_range(x, z, h, begin, std::min(n, begin + BLOCK));
+        });
+    }
+
+    void normals(const float* x, const float* z, float* nx, float* ny, float* nz, size_t n,
+                 ThreadPool* pool = NULL) const {
+        if (!pool || n <= (size_t) BLOCK) {
+            normals_range(x, z, nx, ny, nz, 0, n);
+            return;
+        }
+        const TerrainQuery* self = this;
+        pool->parallel_for(0, (n + BLOCK - 1) / BLOCK, 1, [=](int block, int) {
+            size_t begin = (size_t) block * BLOCK;
+            self->normals_range(x, z, nx, ny, nz, begin, std::min(n, begin + BLOCK));
+        });
+    }
+
+protected:
+    template <class T> T bilinear(T x, T z) const {
+        using namespace noise;
+        T last(_dim - 1.0f);
+        T s = vmin(vmax((x + T(1.0f)) * T(_scale), T(0.0f)), last);
+        T t = vmin(vmax((z + T(1.0f)) * T(_scale), T(0.0f)), last);
+        T i0 = vmin(vfloor(s), last - T(1.0f));
+        T j0 = vmin(vfloor(t), last - T(1.0f));
+        T fx = s - i0, fz = t - j0;
+
+        T base = j0 * T((float) _dim) + i0;
+        T h00 = gather(_heights, base);
+        T h10 = gather(_heights, base + T(1.0f));
+        T h01 = gather(_heights, base + T((float) _dim));
+        T h11 = gather(_heights, base + T(_dim + 1.0f));
+        return lerp(lerp(h00, h10, fx), lerp(h01, h11, fx), fz);
+    }
+
+    /// normalize(cross(y_gradient, x_gradient)) of grid_vshader, simplified
+    template <class T> void central_normal(T x, T z, T& nx, T& ny, T& nz) const {
+        using namespace noise;
+        T e(_texel);
+        T dx = bilinear(x + e, z) - bilinear(x - e, z);
+        T dz = bilinear(x, z + e) - bilinear(x, z - e);
+        T up = e * T(2.0f);
+        T length = vsqrt(dx * dx + up * up + dz * dz);
+        nx = (T(0.0f) - dx) / length;
+        ny = up / length;
+        nz = (T(0.0f) - dz) / length;
+    }
+
+    void heights_range(const float* x, const float* z, float* h, size_t begin, size_t end) const {
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            bilinear(noise::float8::load(x + i), noise::float8::load(z + i)).store(h + i);
+        }
+        for (; i < end; i++) h[i] = bilinear(x[i], z[i]);
+    }
+
+    void normals_range(const float* x, const float* z, float* nx, float* ny, float* nz,
+                       size_t begin, size_t end) const {
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            noise::float8 a, b, c;
+            central_normal(noise::float8::load(x + i), noise::float8::load(z + i), a, b, c);
+            a.store(nx + i);
+            b.store(ny + i);
+            c.store(nz + i);
+        }
+        for (; i < end; i++) central_normal(x[i], z[i], nx[i], ny[i], nz[i]);
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <cmath>
+#include <cfloat>
+#include <cstddef>
+#include "HeightPyramid.h"
+#include "TerrainQuery.h"
+#include "../_threads/ThreadPool.h"
+
+/// World space ray, dx, dy, dz need not be normalized
+struct TerrainRay {
+    float ox, oy, oz;
+    float dx, dy, dz;
+    float max_distance;
+
+    TerrainRay() {}
+    TerrainRay(float ox, float oy, float oz, float dx, float dy, float dz, float max_distance = FLT_MAX) :
+        ox(ox), oy(oy), oz(oz), dx(dx), dy(dy), dz(dz), max_distance(max_distance) {}
+};
+
+struct TerrainHit {
+    bool hit;
+    float x, y, z;      ///< hit point
+    float distance;     ///< from the ray origin
+    float nx, ny, nz;   ///< surface normal at the hit point
+    int steps;          ///< pyramid cells visited
+};
+
+/// Ray casts against the bilinear heightmap surface of TerrainQuery.
+/// Rays walk the HeightPyramid top down: a cell whose max height lies
+/// below the ray over the cell's extent is skipped whole and the walk goes
+/// back up a level, so empty space is crossed in O(log n) steps and only
+/// the level 0 cells under the ray are intersected exactly.
+class TerrainRaycaster {
+protected:
+    const HeightPyramid& _pyramid;  ///< may be (re)built after construction
+
+    static const int BLOCK = 256;   ///< rays per pool task
+
+public:
+    TerrainRaycaster(const HeightPyramid& pyramid) : _pyramid(pyramid) {}
+
+    bool intersect(const TerrainRay& ray, TerrainHit& out) const {
+        out.hit = false;
+        out.steps = 0;
+        float length = std::sqrt(ray.dx * ray.dx + ray.dy * ray.dy + ray.dz * ray.dz);
+        if (length == 0.0f) return false;
+
+        ///--- Grid space: x, z in cells of level 0, y unchanged, t in world units
+        float scale = 0.5f * (_pyramid.dim() - 1);
+        float ox = (ray.ox + 1.0f) * scale, oz = (ray.oz + 1.0f) * scale, oy = ray.oy;
+        float dx = ray.dx / length * scale, dz = ray.dz / length * scale, dy = ray.dy / length;
+
+        ///--- Clip against the map and the space below its highest point
+        int top = _pyramid.levels() - 1;
+        float n = (float) _pyramid.cells(0);
+        float t0 = 0.0f, t1 = ray.max_distance;
+        if (!clip(ox, dx, 0.0f, n, t0, t1) || !clip(oz, dz, 0.0f, n, t0, t1) ||
+            !clip(oy, dy, -FLT_MAX, _pyramid.max_at(top, 0, 0), t0, t1)) {
+            return false;
+        }
+
+        ///--- Hierarchical walk
+        int level = top;
+        float t = t0;
+        while (t <= t1) {
+            out.steps++;
+            float size = (float) (1 << level);
+            // nudge along the ray so cells on a boundary resolve forward
+            float px = ox + dx * t + (dx > 0.0f ? 1e-4f : -1e-4f);
+            float pz = oz + dz * t + (dz > 0.0f ? 1e-4f : -1e-4f);
+            int cx = (int) std::floor(px / size), cz = (int) std::floor(pz / size);
+            int cells = (int) std::ceil(n / size);
+            if (cx < 0 || cz < 0 || cx >= cells || cz >= cells) return false;
+
+            float exit = std::min(t1, std::min(cell_exit(ox, dx, cx, size), cell_exit(oz, dz, cz, size)));
+            exit = std::max(exit, t);
+            float y_low = std::min(oy + dy * t, oy + dy * exit);
+            if (y_low > _pyramid.max_at(level, cx, cz)) {
+                ///--- Whole cell below the ray: skip it and go back up
+                if (exit == t1) return false;
+                t = exit;
+                if (level < top) level++;
+                continue;
+            }
+            if (level > 0) {
+                level--;
+                continue;
+            }
+            float hit_t;
+            if (intersect_cell(cx, cz, ox, oy, oz, dx, dy, dz, t, exit, hit_t)) {
+                out.hit = true;
+                out.distance = hit_t;
+                out.x = ray.ox + ray.dx / length * hit_t;
+                out.y = ray.oy + dy * hit_t;
+                out.z = ray.oz + ray.dz / length * hit_t;
+                TerrainQuery(_pyramid.heights(), _pyramid.dim()).normal(out.x, out.z, out.nx, out.ny, out.nz);
+                return true;
+            }
+            if (exit == t1) return false;
+            t = exit;
+            if (level < top) level++;
+        }
+        return false;
+    }
+
+    /// Casts n rays, split in blocks across pool when given one
+    void intersect(const TerrainRay* rays, TerrainHit* hits, size_t n, ThreadPool* pool = NULL) const {
+        if (!pool || n <= (size_t) BLOCK) {
+            for (size_t i = 0; i < n; i++) intersect(rays[i], hits[i]);
+            return;
+        }
+        const TerrainRaycaster* self = this;
+        pool->parallel_for(0, (n + BLOCK - 1) / BLOCK, 1, [=](int block, int) {
+            size_t end = std::min(n, (size_t) (block + 1) * BLOCK);
+            for (size_t i = (size_t) block * BLOCK; i < end; i++) self->intersect(rays[i], hits[i]);
+        });
+    }
+
+protected:
+    /// Restricts [t0, t1] to where o + d * t lies in [lo, hi]
+    static bool clip(float o, float d, float lo, float hi, float& t0, float& t1) {
+        if (d == 0.0f) return o >= lo && o <= hi;
+        float a = (lo - o) / d, b = (hi - o) / d;
+        if (a > b) std::swap(a, b);
+        t0 = std::max(t0, a);
+        t1 = std::min(t1, b);
+        return t0 <= t1;
+    }
+
+    /// Parameter where the ray leaves cell c of the given size along one axis
+    static float cell_exit(float o, float d, int c, float size) {
+        if (d > 0.0f) return ((c + 1) * size - o) / d;
+        if (d < 0.0f) return (c * size - o) / d;
+        return FLT_MAX;
+    }
+
+    /// First t in [t0, t1] where the ray meets the bilinear patch of cell
+    /// (cx, cz): heights are quadratic in t along the ray
+    bool intersect_cell(int cx, int cz, float ox, float oy, float oz, float dx, float dy, float dz,
+                        float t0, float t1, float& hit_t) const {
+        const float* h = _pyramid.heights();
+        int dim = _pyramid.dim();
+        int x1 = std::min(cx + 1, dim - 1), z1 = std::min(cz + 1, dim - 1);
+        float h00 = h[(size_t) cz * dim + cx], h10 = h[(size_t) cz * dim + x1];
+        float h01 = h[(size_t) z1 * dim + cx], h11 = h[(size_t) z1 * dim + x1];
+
+        // cell local coordinates fx = a0 + a1 u, fz = b0 + b1 u with u = t - t0,
+        // relative to the cell entry to keep the coefficients small
+        float a0 = (ox + dx * t0) - cx, a1 = dx, b0 = (oz + dz * t0) - cz, b1 = dz;
+        float ex = h10 - h00, ez = h01 - h00, exz = h00 - h10 - h01 + h11;
+        // f(u) = ray height - surface height = c0 + c1 u + c2 u^2
+        float c0 = (oy + dy * t0) - (h00 + ex * a0 + ez * b0 + exz * a0 * b0);
+        float c1 = dy - (ex * a1 + ez * b1 + exz * (a0 * b1 + a1 * b0));
+        float c2 = -exz * a1 * b1;
+
+        if (c0 <= 0.0f) {
+            // ray already under the surface, e.g. an origin below ground
+            hit_t = t0;
+            return true;
+        }
+        float roots[2];
+        int count = 0;
+        if (std::fabs(c2) < 1e-12f) {
+            if (c1 != 0.0f) roots[count++] = -c0 / c1;
+        } else {
+            float disc = c1 * c1 - 4.0f * c2 * c0;
+            if (disc < 0.0f) return false;
+            // numerically stable pair of roots
+            float q = -0.5f * (c1 + (c1 >= 0.0f ? 1.0f : -1.0f) * std::sqrt(disc));
+            roots[count++] = q / c2;
+            if (q != 0.0f) roots[count++] = c0 / q;
+        }
+        hit_t = FLT_MAX;
+        for (int i = 0; i < count; i++) {
+            if (roots[i] >= 0.0f && roots[i] <= t1 - t0) hit_t = std::min(hit_t, t0 + roots[i]);
+        }
+        return hit_t != FLT_MAX;
+    }
+};
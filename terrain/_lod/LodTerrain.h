@@ -0,0 +1,200 @@
+#pragma once
+#include <vector>
+#include "icg_common.h"
+#include "../_grid/Grid.h"
+#include "../_grid/PatchMesh.h"
+#include "../_heightmap/HeightPyramid.h"
+#include "../_culling/Frustum.h"
+#include "../_render/GLState.h"
+
+/// Nodes and triangles submitted by the last LodTerrain::draw
+struct LodStats {
+    int nodes;
+    int culled;         ///< nodes skipped by the frustum test
+    size_t triangles;
+};
+
+/// Continuous distance-dependent LOD (CDLOD) for the heightmap terrain.
+/// A quadtree over the map is traversed every frame; each selected node is
+/// drawn with the same patch mesh, scaled to the node, and lod_vshader.glsl
+/// morphs the patch vertices towards the next coarser level as they approach
+/// the end of their level's distance range, so neighbouring levels meet
+/// without cracks or popping. Level 0 has one vertex per heightmap texel,
+/// the same density as the fixed Grid mesh.
+class LodTerrain {
+protected:
+    /// Quadtree node picked for drawing
+    struct Selection {
+        float x, z;     ///< world origin
+        float size;     ///< world edge length
+        int level;      ///< LOD level, 0 is the finest
+        bool half;      ///< quadrant of a coarser node, drawn with the half patch
+    };
+
+    PatchMesh _patch;           ///< full patch, and half patch over every other vertex
+    GLuint _pid;                ///< GLSL shader program ID
+    GLuint _tex;                ///< heightmap texture
+    GLuint _sampler;            ///< linear sampler for the heightmap, morphed vertices fall between texels
+    Grid* _materials;           ///< owner of the material textures
+    int _patch_cells;           ///< cells per patch edge
+    int _levels;                ///< number of LOD levels
+    float _root_size;           ///< world size of the root node
+    float _base_range;          ///< LOD range of level 0
+    int _pyramid_level;         ///< pyramid level of the leaves
+    const HeightPyramid* _pyramid;          ///< node height bounds
+    std::vector<float> _ranges;             ///< LOD range of every level
+    std::vector<Selection> _selection;      ///< nodes picked by the last select
+    LodStats _stats;
+
+public:
+    /// pyramid is built from the CPU copy of texture, patch_cells a power of two
+    void init(GLuint texture, const HeightPyramid* pyramid, Grid* materials,
+              int patch_cells = 32, float base_range = 0.6f) {
+        _tex = texture;
+        _pyramid = pyramid;
+        _materials = materials;
+        _patch_cells = patch_cells;
+        _base_range = base_range;
+
+        ///--- Enough levels for the leaves to cover the map at one vertex per texel
+        int dim = pyramid->dim();
+        int leaves = 1;
+        _levels = 1;
+        while (leaves * _patch_cells < dim - 1) {
+            leaves *= 2;
+            _levels++;
+        }
+        float texel = 2.0f / (dim - 1);
+        _root_size = leaves * _patch_cells * texel;
+        _pyramid_level = 0;
+        while ((1 << _pyramid_level) < _patch_cells) _pyramid_level++;
+
+        _pid = opengp::load_shaders("_lod/lod_vshader.glsl", "_grid/grid_fshader.glsl");
+        if(!_pid) exit(EXIT_FAILURE);
+        glUseProgram(_pid);
+
+        ///--- The half patch uses every other vertex of the full one
+        std::vector<int> steps;
+        steps.push_back(1);
+        steps.push_back(2);
+        _patch.init(_patch_cells, steps, true);
+        _patch.print(std::cout, "CDLOD");
+
+        glGenSamplers(1, &_sampler);
+        glSamplerParameteri(_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+    void cleanup() {
+        _patch.cleanup();
+        glDeleteSamplers(1, &_sampler);
+        glDeleteProgram(_pid);
+    }
+
+    /// Draws the terrain for a camera at camera_pos, skipping nodes outside
+    /// frustum. lod_bias > 1 scales the ranges down for cheaper passes such
+    /// as the reflection.
+    void draw(const mat4& VP, const Frustum& frustum, const vec3& camera_pos, float lod_bias = 1.0f) {
+        _stats.culled = 0;
+        select(frustum, camera_pos, lod_bias);
+
+        GLState& state = GLState::instance();
+        state.use_program(_pid);
+        state.bind_vertex_array(_patch.vao());
+
+        state.bind_texture(0, GL_TEXTURE_2D, _tex);
+        state.bind_sampler(0, _sampler);
+        glUniform1i(glGetUniformLocation(_pid, "tex"), 0);
+        _materials->bind_materials(_pid);
+
+        glUniformMatrix4fv(glGetUniformLocation(_pid, "mvp"), 1, GL_FALSE, VP.data());
+        glUniform3fv(glGetUniformLocation(_pid, "camera_pos"), 1, camera_pos.data());
+        GLint node_id = glGetUniformLocation(_pid, "node");
+        GLint morph_id = glGetUniformLocation(_pid, "morph_range");
+        GLint cells_id = glGetUniformLocation(_pid, "patch_cells");
+        glUniform1i(glGetUniformLocation(_pid, "patch_side"), _patch_cells + 1);
+
+        _stats.nodes = _selection.size();
+        _stats.triangles = 0;
+        for (size_t i = 0; i < _selection.size(); i++) {
+            const Selection& s = _selection[i];
+            int cells = s.half ? _patch_cells / 2 : _patch_cells;
+            float end = _ranges[s.level];
+            float start = s.level > 0 ? _ranges[s.level - 1] : 0.0f;
+            start += 0.7f * (end - start);
+            glUniform3f(node_id, s.x, s.z, s.size);
+            glUniform2f(morph_id, start, end);
+            glUniform1f(cells_id, (float) cells);
+            _patch.draw(s.half ? 1 : 0);
+            _stats.triangles += 2 * cells * cells;
+        }
+    }
+
+    const LodStats& stats() const { return _stats; }
+    const PatchMesh& patch() const { return _patch; }
+    int levels() const { return _levels; }
+
+protected:
+    ///--- Selection
+
+    void select(const Frustum& frustum, const vec3& camera_pos, float lod_bias) {
+        _ranges.resize(_levels);
+        for (int l = 0; l < _levels; l++) {
+            _ranges[l] = _base_range / lod_bias * (1 << l);
+        }
+        ///--- The root covers everything the camera can see
+        _ranges[_levels - 1] = FLT_MAX;
+
+        _selection.clear();
+        select_node(_levels - 1, 0, 0, frustum, camera_pos);
+    }
+
+    float node_size(int level) const {
+        return _root_size / (1 << (_levels - 1 - level));
+    }
+
+    bool intersects_sphere(int level, int i, int j, const vec3& c, float r) const {
+        float size = node_size(level);
+        float x0 = -1.0f + i * size, z0 = -1.0f + j * size;
+        float lo = _pyramid->min_at(_pyramid_level + level, i, j);
+        float hi = _pyramid->max_at(_pyramid_level + level, i, j);
+        float dx = std::max(std::max(x0 - c.x(), 0.0f), c.x() - (x0 + size));
+        float dy = std::max(std::max(lo - c.y(), 0.0f), c.y() - hi);
+        float dz = std::max(std::max(z0 - c.z(), 0.0f), c.z() - (z0 + size));
+        return dx * dx + dy * dy + dz * dz <= r * r;
+    }
+
+    /// Standard CDLOD selection: a node within its range is drawn whole when
+    /// the next finer range does not reach it, otherwise it is split and the
+    /// children out of their own range are drawn as its quadrants. Nodes
+    /// outside the frustum count as handled, so no coarser quadrant is drawn.
+    bool select_node(int level, int i, int j, const Frustum& frustum, const vec3& camera_pos) {
+        if (!intersects_sphere(level, i, j, camera_pos, _ranges[level])) return false;
+
+        float size = node_size(level);
+        float x0 = -1.0f + i * size, z0 = -1.0f + j * size;
+        if (!frustum.intersects(x0, _pyramid->min_at(_pyramid_level + level, i, j), z0, x0 + size,
+                                _pyramid->max_at(_pyramid_level + level, i, j), z0 + size)) {
+            _stats.culled++;
+            return true;
+        }
+        if (level == 0 || !intersects_sphere(level, i, j, camera_pos, _ranges[level - 1])) {
+            Selection s = {x0, z0, size, level, false};
+            _selection.push_back(s);
+            return true;
+        }
+        for (int c = 0; c < 4; c++) {
+            int ci = 2 * i + c % 2, cj = 2 * j + c / 2;
+            if (!select_node(level - 1, ci, cj, frustum, camera_pos)) {
+                Selection s = {x0 + (c % 2) * size * 0.5f, z0 + (c / 2) * size * 0.5f, size * 0.5f, level, true};
+                _selection.push_back(s);
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,46 @@
+#version 330 core
+uniform mat4 mvp;
+uniform sampler2D tex;          ///< heightmap, sampled with a linear sampler
+uniform vec3 camera_pos;
+uniform vec3 node;              ///< xy world origin, z world size
+uniform vec2 morph_range;       ///< distances where morphing starts and ends
+uniform float patch_cells;      ///< cells per edge of the patch mesh
+uniform int patch_side;         ///< vertices per edge of the full patch, indexed by gl_VertexID
+
+out vec2 uv;
+out float height;
+out float gl_ClipDistance[1];
+
+// Continuous texel coordinate: world -1 is texel 0 and world +1 the last
+// texel, the same mapping as the Grid vertices
+float get_height_at(vec2 world) {
+    vec2 size = vec2(textureSize(tex, 0));
+    vec2 s = (world + vec2(1.0)) * 0.5 * (size - vec2(1.0));
+    return texture(tex, (s + vec2(0.5)) / size).x;
+}
+
+vec3 vertex_at(vec2 world) {
+    return vec3(world.x, get_height_at(world), world.y);
+}
+
+// Moves odd vertices onto the grid of the next coarser level as k goes
+// from 0 to 1, so the mesh matches its coarser neighbours at range ends
+vec2 morph_vertex(vec2 grid_pos, vec2 world, float k) {
+    vec2 frac_part = fract(grid_pos * patch_cells * 0.5) * 2.0 / patch_cells;
+    return world - frac_part * node.z * k;
+}
+
+void main() {
+    vec2 position = vec2(gl_VertexID % patch_side, gl_VertexID / patch_side) / float(patch_side - 1);
+    vec2 world = node.xy + position * node.z;
+    float dist = distance(camera_pos, vertex_at(world));
+    float k = clamp((dist - morph_range.x) / (morph_range.y - morph_range.x), 0.0, 1.0);
+    world = min(morph_vertex(position, world, k), vec2(1.0));
+
+    vec3 pos_3d = vertex_at(world);
+    uv = (world + vec2(1.0, 1.0)) * 0.5;
+    height = pos_3d.y;
+
+    gl_Position = mvp * vec4(pos_3d, 1.0);
+    gl_ClipDistance[0] = height;
+}
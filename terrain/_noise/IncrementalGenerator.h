@@ -0,0 +1,197 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include "NoiseEngine.h"
+#include "../_threads/ThreadPool.h"
+#include "../_texture/TexelRect.h"
+
+/// Regenerates a heightmap a few tiles per frame while its noise
+/// parameters are being tuned. Every octave's ridged signal is kept per
+/// texel (NoiseEngine::ridged_octave), and octave i only depends on
+/// octave i - 1 and on its frequency, so a change recomputes the least it
+/// can:
+///  - H reweights the cached octaves, no noise is evaluated
+///  - octaves evaluates the added octaves only, or none when removing
+///  - lacunarity keeps octave 0, frequency recomputes every octave
+/// invalidate() marks a region for a full recompute. Tiles nearest to a
+/// focus point (the camera) are done first, within a time budget. seed()
+/// fills the cache for a map generated elsewhere, without writing its
+/// heights, so that the first change is as cheap as the next ones.
+class IncrementalGenerator {
+protected:
+    struct Tile {
+        int x, y, w, h;
+        int valid;      ///< leading octaves whose cached signal is up to date, may exceed the octaves in use
+        bool dirty;     ///< octaves to evaluate or heights to recombine
+        bool heights;   ///< heights to write, false while only seeding the cache
+    };
+
+    const NoiseEngine& _engine;
+    ThreadPool& _pool;
+    int _dim;
+    int _tile_size;
+    std::vector<Tile> _tiles;
+    std::vector<std::vector<float> > _signals;  ///< per octave, dim x dim
+    NoiseParams _params;        ///< being generated
+    bool _has_params;
+
+    ///--- Statistics
+    size_t _tiles_done;
+    size_t _octaves_evaluated;  ///< tile octaves computed
+    double _last_ms;            ///< time spent by the last update()
+
+public:
+    IncrementalGenerator(const NoiseEngine& engine, ThreadPool& pool) :
+        _engine(engine), _pool(pool), _dim(0), _tile_size(0), _has_params(false),
+        _tiles_done(0), _octaves_evaluated(0), _last_ms(0.0) {}
+
+    /// dim x dim map, laid out as NoiseEngine::fill, in tile_size tiles
+    void init(int dim, int tile_size = 64) {
+        _dim = dim;
+        _tile_size = tile_size;
+        _tiles.clear();
+        for (int y = 0; y < dim; y += tile_size) {
+            for (int x = 0; x < dim; x += tile_size) {
+                Tile tile = { x, y, std::min(tile_size, dim - x), std::min(tile_size, dim - y), 0, false, false };
+                _tiles.push_back(tile);
+            }
+        }
+        _signals.clear();
+        _has_params = false;
+    }
+
+    /// Starts regenerating for new parameters, keeping what still holds
+    void set_params(const NoiseParams& p) {
+        int octaves = std::min(p.octaves, NoiseEngine::MAX_OCTAVES);
+        while ((int) _signals.size() < octaves) {
+            _signals.push_back(std::vector<float>((size_t) _dim * _dim));
+        }
+        int keep = NoiseEngine::MAX_OCTAVES;
+        if (!_has_params || p.frequency != _params.frequency) {
+            keep = 0;
+        } else if (p.lacunarity != _params.lacunarity) {
+            keep = 1;
+        }
+        for (size_t t = 0; t < _tiles.size(); t++) {
+            _tiles[t].valid = std::min(_tiles[t].valid, keep);
+            _tiles[t].dirty = true;
+            _tiles[t].heights = true;
+        }
+        _params = p;
+        _has_params = true;
+    }
+
+    /// The map already holds the heights of p: update() evaluates their
+    /// octaves into the cache and leaves the heights alone
+    void seed(const NoiseParams& p) {
+        set_params(p);
+        for (size_t t = 0; t < _tiles.size(); t++) {
+            _tiles[t].valid = 0;
+            _tiles[t].heights = false;
+        }
+    }
+
+    /// Recomputes every octave of the tiles overlapping rect
+    void invalidate(const TexelRect& rect) {
+        for (size_t t = 0; t < _tiles.size(); t++) {
+            Tile& tile = _tiles[t];
+            if (tile.x < rect.x + rect.width && rect.x < tile.x + tile.w &&
+                tile.y < rect.y + rect.height && rect.y < tile.y + tile.h) {
+                tile.valid = 0;
+                tile.dirty = true;
+                tile.heights = true;
+            }
+        }
+    }
+
+    bool busy() const {
+        return remaining() > 0;
+    }
+
+    size_t remaining() const {
+        size_t n = 0;
+        for (size_t t = 0; t < _tiles.size(); t++) n += _tiles[t].dirty;
+        return n;
+    }
+
+    /// Regenerates dirty tiles into heights, nearest to texel (focus_x,
+    /// focus_y) first, in batches of one tile per worker until budget_ms
+    /// is spent (at least one batch). Returns the texels updated, which
+    /// leaves out the tiles only seeded.
+    TexelRect update(float* heights, double budget_ms, float focus_x = 0.0f, float focus_y = 0.0f) {
+        typedef std::chrono::high_resolution_clock Clock;
+        Clock::time_point start = Clock::now();
+        TexelRect updated;
+
+        std::vector<Tile*> order;
+        for (size_t t = 0; t < _tiles.size(); t++) {
+            if (_tiles[t].dirty) order.push_back(&_tiles[t]);
+        }
+        std::sort(order.begin(), order.end(), [=](const Tile* a, const Tile* b) {
+            return distance2(*a, focus_x, focus_y) < distance2(*b, focus_x, focus_y);
+        });
+
+        const size_t batch = _pool.size() + 1;
+        double batch_ms = 0.0;
+        for (size_t first = 0; first < order.size(); first += batch) {
+            double spent = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (first > 0 && spent + batch_ms > budget_ms) break;
+
+            Clock::time_point t0 = Clock::now();
+            size_t count = std::min(batch, order.size() - first);
+            Tile** tiles = &order[first];
+            IncrementalGenerator* self = this;
+            _pool.parallel_for(0, count, 1, [=](int i, int) { self->generate(*tiles[i], heights); });
+            batch_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+            int octaves = std::min(_params.octaves, NoiseEngine::MAX_OCTAVES);
+            for (size_t i = 0; i < count; i++) {
+                Tile& tile = *tiles[i];
+                _octaves_evaluated += std::max(0, octaves - tile.valid);
+                tile.valid = std::max(tile.valid, octaves);
+                tile.dirty = false;
+                if (tile.heights) updated = updated.merge(TexelRect(tile.x, tile.y, tile.w, tile.h));
+                _tiles_done++;
+            }
+        }
+        _last_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        return updated;
+    }
+
+    double last_ms() const { return _last_ms; }
+
+    void print(std::ostream& out) const {
+        out << "Incremental generation: " << _tiles_done << " tiles, " << _octaves_evaluated
+            << " tile octaves evaluated, " << remaining() << " tiles left" << std::endl;
+    }
+
+protected:
+    static float distance2(const Tile& tile, float x, float y) {
+        float dx = tile.x + 0.5f * tile.w - x, dy = tile.y + 0.5f * tile.h - y;
+        return dx * dx + dy * dy;
+    }
+
+    /// Brings the octaves of a tile up to date and recombines its heights;
+    /// tiles are disjoint, so workers never share texels
+    void generate(const Tile& tile, float* heights) {
+        int octaves = std::min(_params.octaves, NoiseEngine::MAX_OCTAVES);
+        std::vector<float> u(tile.w), v(tile.w);
+        const float du = 1.0f / _dim;
+        for (int x = 0; x < tile.w; x++) u[x] = (tile.x + x + 0.5f) * du;
+
+        std::vector<float*> signals(octaves);
+        for (int o = 0; o < octaves; o++) signals[o] = &_signals[o][0];
+
+        for (int y = tile.y; y < tile.y + tile.h; y++) {
+            size_t row = (size_t) y * _dim + tile.x;
+            std::fill(v.begin(), v.end(), (y + 0.5f) * du);
+            for (int o = tile.valid; o < octaves; o++) {
+                _engine.ridged_octave(&u[0], &v[0], NoiseEngine::octave_frequency(_params, o),
+                                      o > 0 ? signals[o - 1] + row : NULL, signals[o] + row, tile.w);
+            }
+            if (tile.heights) _engine.ridged_combine(&signals[0], row, tile.w, _params, heights + row);
+        }
+    }
+};
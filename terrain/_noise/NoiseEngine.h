@@ -0,0 +1,759 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+#include "NoiseGraph.h"
+
+///--- Pick the widest instruction set the compiler was allowed to use
+/// (see TERRAIN_SIMD in terrain/CMakeLists.txt)
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define NOISE_SIMD_AVX2
+#elif defined(__SSE4_1__)
+    #include <smmintrin.h>
+    #define NOISE_SIMD_SSE4
+#endif
+
+#ifndef GRAD_SIZE
+#define GRAD_SIZE 16
+#endif
+
+/// Gradient table shared by the GLSL path (uploaded as a 1D RGB texture by
+/// PerlinQuad) and the CPU engine below. Only xy is used, z pads to RGB.
+static const float perlin_gradients[GRAD_SIZE * 3] = {
+    0.7603266842957805,-0.6495408633394705,0, 0.8809657602279946,0.47318001786414404,0, -0.5466367864419548,0.8373698249330536,0, -0.13296468949966458,-0.9911207753580074,0, 0.201892960546683,-0.9794075926199958,0, -0.04842254529095715,0.9988269405195002,0, 0.8367694012715634,0.5475554484210976,0, 0.9727549736470312,-0.2318356341138343,0, 0.7923240671229802,0.6101004611190678,0, -0.0018588171345380177,-0.9999982723979378,0, -0.6190943565348803,0.7853166098502327,0, 0.41455599418515415,0.9100238061090262,0, -0.8799918653547627,0.4749887545084044,0, -0.9837026492057273,-0.17980294198269908,0, -0.7117149151989826,0.7024684188512,0, -0.806249556332093,-0.5915755682195666,0
+};
+
+/// Parameters of the heightmap's ridged fBm (same names and defaults as
+/// PerlinQuad), see NoiseEngine::graph()
+struct NoiseParams {
+    float frequency;
+    float H;
+    float lacunarity;
+    int octaves;
+
+    NoiseParams() : frequency(0.9f), H(1.0f), lacunarity(2.7f), octaves(8) {}
+    NoiseParams(float frequency, float H, float lacunarity, int octaves) :
+        frequency(frequency), H(H), lacunarity(lacunarity), octaves(octaves) {}
+};
+
+/// Result of comparing the CPU engine against a heightmap read back from the GPU
+struct NoiseValidation {
+    float max_error;
+    float mean_error;
+    size_t samples;
+    size_t outliers;    ///< samples with an error above the tolerance
+    bool passed;
+};
+
+namespace noise {
+
+///--- Lane group of 8 floats: one AVX2 register, two SSE4 registers or
+/// a plain array. All backends use the same IEEE operations in the same
+/// order, so they produce bit-identical results.
+#if defined(NOISE_SIMD_AVX2)
+struct float8 {
+    __m256 v;
+    float8() {}
+    float8(__m256 v) : v(v) {}
+    explicit float8(float s) : v(_mm256_set1_ps(s)) {}
+    static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline float8 vmin(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+inline float8 vmax(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+inline float8 vfloor(float8 a) { return _mm256_floor_ps(a.v); }
+inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+inline float8 vsqrt(float8 a) { return _mm256_sqrt_ps(a.v); }
+/// 1 where a > b, 0 elsewhere
+inline float8 vgreater(float8 a, float8 b) { return _mm256_and_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ), _mm256_set1_ps(1.0f)); }
+/// p[index] for integral, in-range float indices
+inline float8 gather(const float* p, float8 index) { return _mm256_i32gather_ps(p, _mm256_cvttps_epi32(index.v), 4); }
+
+/// Gradient of the lattice corners (cx, cy): hash the integer coordinates
+/// (see hash() in noise.glsl), then look the 16-entry table up with
+/// two in-register permutes blended on bit 3
+inline void grad_at(float8 cx, float8 cy, const float* gx, const float* gy, float8& x, float8& y) {
+    __m256i h = _mm256_xor_si256(_mm256_mullo_epi32(_mm256_cvtps_epi32(cx.v), _mm256_set1_epi32(0x8da6b343)),
+                                 _mm256_mullo_epi32(_mm256_cvtps_epi32(cy.v), _mm256_set1_epi32(0xd8163841)));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x7feb352d));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x846ca68b));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    __m256i idx = _mm256_and_si256(h, _mm256_set1_epi32(GRAD_SIZE - 1));
+    __m256 hi = _mm256_castsi256_ps(_mm256_slli_epi32(idx, 28));
+    x = _mm256_blendv_ps(_mm256_permutevar8x32_ps(_mm256_loadu_ps(gx), idx),
+                         _mm256_permutevar8x32_ps(_mm256_loadu_ps(gx + 8), idx), hi);
+    y = _mm256_blendv_ps(_mm256_permutevar8x32_ps(_mm256_loadu_ps(gy), idx),
+                         _mm256_permutevar8x32_ps(_mm256_loadu_ps(gy + 8), idx), hi);
+}
+#elif defined(NOISE_SIMD_SSE4)
+struct float8 {
+    __m128 lo, hi;
+    float8() {}
+    float8(__m128 lo, __m128 hi) : lo(lo), hi(hi) {}
+    explicit float8(float s) : lo(_mm_set1_ps(s)), hi(_mm_set1_ps(s)) {}
+    static float8 load(const float* p) { return float8(_mm_loadu_ps(p), _mm_loadu_ps(p + 4)); }
+    void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+};
+inline float8 operator+(float8 a, float8 b) { return float8(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)); }
+inline float8 operator-(float8 a, float8 b) { return float8(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)); }
+inline float8 operator*(float8 a, float8 b) { return float8(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)); }
+inline float8 vmin(float8 a, float8 b) { return float8(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)); }
+inline float8 vmax(float8 a, float8 b) { return float8(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)); }
+inline float8 vfloor(float8 a) { return float8(_mm_floor_ps(a.lo), _mm_floor_ps(a.hi)); }
+inline float8 operator/(float8 a, float8 b) { return float8(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)); }
+inline float8 vsqrt(float8 a) { return float8(_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi)); }
+inline float8 vgreater(float8 a, float8 b) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    return float8(_mm_and_ps(_mm_cmpgt_ps(a.lo, b.lo), one), _mm_and_ps(_mm_cmpgt_ps(a.hi, b.hi), one));
+}
+inline float8 gather(const float* p, float8 index) {
+    int i[8];
+    _mm_storeu_si128((__m128i*)i, _mm_cvttps_epi32(index.lo));
+    _mm_storeu_si128((__m128i*)(i + 4), _mm_cvttps_epi32(index.hi));
+    return float8(_mm_setr_ps(p[i[0]], p[i[1]], p[i[2]], p[i[3]]), _mm_setr_ps(p[i[4]], p[i[5]], p[i[6]], p[i[7]]));
+}
+
+inline __m128i hash4(__m128 cx, __m128 cy) {
+    __m128i h = _mm_xor_si128(_mm_mullo_epi32(_mm_cvtps_epi32(cx), _mm_set1_epi32(0x8da6b343)),
+                              _mm_mullo_epi32(_mm_cvtps_epi32(cy), _mm_set1_epi32(0xd8163841)));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    h = _mm_mullo_epi32(h, _mm_set1_epi32(0x7feb352d));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    h = _mm_mullo_epi32(h, _mm_set1_epi32(0x846ca68b));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    return _mm_and_si128(h, _mm_set1_epi32(GRAD_SIZE - 1));
+}
+
+inline void grad_at(float8 cx, float8 cy, const float* gx, const float* gy, float8& x, float8& y) {
+    int idx[8];
+    _mm_storeu_si128((__m128i*)idx, hash4(cx.lo, cy.lo));
+    _mm_storeu_si128((__m128i*)(idx + 4), hash4(cx.hi, cy.hi));
+    x = float8(_mm_setr_ps(gx[idx[0]], gx[idx[1]], gx[idx[2]], gx[idx[3]]),
+               _mm_setr_ps(gx[idx[4]], gx[idx[5]], gx[idx[6]], gx[idx[7]]));
+    y = float8(_mm_setr_ps(gy[idx[0]], gy[idx[1]], gy[idx[2]], gy[idx[3]]),
+               _mm_setr_ps(gy[idx[4]], gy[idx[5]], gy[idx[6]], gy[idx[7]]));
+}
+#else
+struct float8 {
+    float f[8];
+    float8() {}
+    explicit float8(float s) { for (int i = 0; i < 8; i++) f[i] = s; }
+    static float8 load(const float* p) { float8 r; for (int i = 0; i < 8; i++) r.f[i] = p[i]; return r; }
+    void store(float* p) const { for (int i = 0; i < 8; i++) p[i] = f[i]; }
+};
+#define NOISE_LANEWISE(expr) float8 r; for (int i = 0; i < 8; i++) r.f[i] = (expr); return r;
+inline float8 operator+(float8 a, float8 b) { NOISE_LANEWISE(a.f[i] + b.f[i]) }
+inline float8 operator-(float8 a, float8 b) { NOISE_LANEWISE(a.f[i] - b.f[i]) }
+inline float8 operator*(float8 a, float8 b) { NOISE_LANEWISE(a.f[i] * b.f[i]) }
+inline float8 vmin(float8 a, float8 b) { NOISE_LANEWISE(b.f[i] < a.f[i] ? b.f[i] : a.f[i]) }
+inline float8 vmax(float8 a, float8 b) { NOISE_LANEWISE(b.f[i] > a.f[i] ? b.f[i] : a.f[i]) }
+inline float8 vfloor(float8 a) { NOISE_LANEWISE(std::floor(a.f[i])) }
+inline float8 operator/(float8 a, float8 b) { NOISE_LANEWISE(a.f[i] / b.f[i]) }
+inline float8 vsqrt(float8 a) { NOISE_LANEWISE(std::sqrt(a.f[i])) }
+inline float8 vgreater(float8 a, float8 b) { NOISE_LANEWISE(a.f[i] > b.f[i] ? 1.0f : 0.0f) }
+inline float8 gather(const float* p, float8 index) { NOISE_LANEWISE(p[(int) index.f[i]]) }
+#undef NOISE_LANEWISE
+
+inline unsigned int hash(float cx, float cy);
+
+inline void grad_at(float8 cx, float8 cy, const float* gx, const float* gy, float8& x, float8& y) {
+    for (int i = 0; i < 8; i++) {
+        unsigned int idx = hash(cx.f[i], cy.f[i]) & (GRAD_SIZE - 1);
+        x.f[i] = gx[idx];
+        y.f[i] = gy[idx];
+    }
+}
+#endif
+
+///--- Scalar versions of the same primitives (used for single queries)
+inline float vmin(float a, float b) { return b < a ? b : a; }
+inline float vmax(float a, float b) { return b > a ? b : a; }
+inline float vfloor(float a) { return std::floor(a); }
+inline float vsqrt(float a) { return std::sqrt(a); }
+inline float vgreater(float a, float b) { return a > b ? 1.0f : 0.0f; }
+inline float gather(const float* p, float index) { return p[(int) index]; }
+
+/// lowbias32 integer hash of a lattice corner, exact on every GPU and CPU
+inline unsigned int hash(float cx, float cy) {
+    unsigned int h = (unsigned int)(int) cx * 0x8da6b343u ^ (unsigned int)(int) cy * 0xd8163841u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+inline void grad_at(float cx, float cy, const float* gx, const float* gy, float& x, float& y) {
+    unsigned int idx = hash(cx, cy) & (GRAD_SIZE - 1);
+    x = gx[idx];
+    y = gy[idx];
+}
+
+template <class T> inline T vabs(T a) { return vmax(a, T(0.0f) - a); }
+template <class T> inline T fract(T a) { return a - vfloor(a); }
+
+template <class T> inline T fade(T t) {
+    return t * t * t * (t * (t * T(6.0f) - T(15.0f)) + T(10.0f));
+}
+
+template <class T> inline T lerp(T x, T y, T alpha) {
+    return (T(1.0f) - alpha) * x + alpha * y;
+}
+
+/// Mirror of pnoise() in noise.glsl
+template <class T> inline T pnoise(T x, T y, const float* gx, const float* gy) {
+    T x0 = vfloor(x);
+    T y0 = vfloor(y);
+    T x1 = x0 + T(1.0f);
+    T y1 = y0 + T(1.0f);
+
+    T ax = x - x0, ay = y - y0;
+    T bx = x - x1, cy = y - y1;
+
+    T g0x, g0y, g1x, g1y, g2x, g2y, g3x, g3y;
+    grad_at(x0, y0, gx, gy, g0x, g0y);
+    grad_at(x1, y0, gx, gy, g1x, g1y);
+    grad_at(x0, y1, gx, gy, g2x, g2y);
+    grad_at(x1, y1, gx, gy, g3x, g3y);
+
+    T s = g0x * ax + g0y * ay;
+    T t = g1x * bx + g1y * ay;
+    T u = g2x * ax + g2y * cy;
+    T v = g3x * bx + g3y * cy;
+
+    T fx = fade(ax);
+    T st = lerp(s, t, fx);
+    T uv = lerp(u, v, fx);
+    return lerp(st, uv, fade(ay));
+}
+
+/// Contribution of the simplex corner (cx, cy) at offset (dx, dy)
+template <class T> inline T simplex_corner(T cx, T cy, T dx, T dy, const float* gx, const float* gy) {
+    T t = vmax(T(0.5f) - dx * dx - dy * dy, T(0.0f));
+    t = t * t;
+    T g0, g1;
+    grad_at(cx, cy, gx, gy, g0, g1);
+    return t * t * (g0 * dx + g1 * dy);
+}
+
+/// Mirror of snoise() in noise.glsl: 3 corners of the simplex lattice
+template <class T> inline T snoise(T x, T y, const float* gx, const float* gy) {
+    const T F2(0.366025403f), G2(0.211324865f), G2_1(-0.577350269f);
+    T s = (x + y) * F2;
+    T i = vfloor(x + s);
+    T j = vfloor(y + s);
+    T t = (i + j) * G2;
+    T x0 = x - (i - t), y0 = y - (j - t);
+    T i1 = vgreater(x0, y0);
+    T j1 = T(1.0f) - i1;
+    T one(1.0f);
+    return T(70.0f) * (simplex_corner(i, j, x0, y0, gx, gy) +
+                       simplex_corner(i + i1, j + j1, x0 - i1 + G2, y0 - j1 + G2, gx, gy) +
+                       simplex_corner(i + one, j + one, x0 + G2_1, y0 + G2_1, gx, gy));
+}
+
+///--- Kernels of NoiseGraph nodes. The node types are template arguments,
+/// octave counts too (DYNAMIC takes the node's, up to MAX_OCTAVES), and
+/// every kernel is built from the node of the graph it mirrors and takes
+/// its folded constants. The generated GLSL and these compute the same
+/// operations in the same order.
+
+static const int MAX_OCTAVES = 32;
+static const int DYNAMIC = 0;
+
+/// Gradient components the sources look up
+struct Gradients {
+    const float* x;
+    const float* y;
+};
+
+/// Node n of graph, which a kernel of the given type (and octave count,
+/// -1 for any) is built from. A kernel whose shape no longer matches its
+/// graph would compute something else: that stops the program, in release
+/// builds too.
+inline const NoiseNode& expect(const NoiseGraph& graph, int n, NoiseNode::Type type, int octaves = -1) {
+    if (n < 0 || n >= graph.size() || graph.node(n).type != type ||
+        (octaves >= 0 && graph.node(n).octaves() != octaves)) {
+        std::cerr << "!!!ERROR: noise kernel does not match node " << n << " of its graph" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return graph.node(n);
+}
+
+class Perlin {
+protected:
+    Gradients _grad;
+
+public:
+    Perlin(const NoiseGraph& graph, int node, const Gradients& grad) : _grad(grad) {
+        expect(graph, node, NoiseNode::PERLIN);
+    }
+    template <class T> T operator()(T u, T v) const { return pnoise(u, v, _grad.x, _grad.y); }
+};
+
+class Simplex {
+protected:
+    Gradients _grad;
+
+public:
+    Simplex(const NoiseGraph& graph, int node, const Gradients& grad) : _grad(grad) {
+        expect(graph, node, NoiseNode::SIMPLEX);
+    }
+    template <class T> T operator()(T u, T v) const { return snoise(u, v, _grad.x, _grad.y); }
+};
+
+/// Octave frequencies and weights of a FBM or RIDGED node
+template <int OCTAVES> class Octaves {
+protected:
+    static const int CAPACITY = OCTAVES == DYNAMIC ? MAX_OCTAVES : OCTAVES;
+    float _frequency[CAPACITY];
+    float _weight[CAPACITY];
+    int _octaves;
+
+    /// Checks the node's type and octave count before anything reads it
+    Octaves(const NoiseGraph& graph, int n, NoiseNode::Type type) :
+        _octaves(std::min(expect(graph, n, type, OCTAVES == DYNAMIC ? -1 : OCTAVES).octaves(), CAPACITY)) {
+        const NoiseNode& node = graph.node(n);
+        std::copy(node.frequency.begin(), node.frequency.begin() + _octaves, _frequency);
+        std::copy(node.weight.begin(), node.weight.begin() + _octaves, _weight);
+    }
+    /// A constant the compiler unrolls for when specialised
+    int octaves() const { return OCTAVES == DYNAMIC ? _octaves : OCTAVES; }
+};
+
+template <class Source, int OCTAVES> class Fbm : protected Octaves<OCTAVES> {
+protected:
+    Source _source;
+
+public:
+    Fbm(const NoiseGraph& graph, int node, const Gradients& grad) :
+        Octaves<OCTAVES>(graph, node, NoiseNode::FBM), _source(graph, graph.node(node).inputs[0], grad) {}
+
+    template <class T> T operator()(T u, T v) const {
+        T value(0.0f);
+        for (int i = 0; i < this->octaves(); i++) {
+            T f(this->_frequency[i]);
+            value = value + _source(u * f, v * f) * T(this->_weight[i]);
+        }
+        return value;
+    }
+};
+
+template <class Source, int OCTAVES> class Ridged : protected Octaves<OCTAVES> {
+protected:
+    Source _source;
+    float _offset, _gain, _scale, _bias;
+
+public:
+    Ridged(const NoiseGraph& graph, int node, const Gradients& grad) :
+        Octaves<OCTAVES>(graph, node, NoiseNode::RIDGED), _source(graph, graph.node(node).inputs[0], grad) {
+        const NoiseNode& n = graph.node(node);
+        _offset = n.offset;
+        _gain = n.gain;
+        _scale = n.scale;
+        _bias = n.bias;
+    }
+
+    template <class T> T operator()(T u, T v) const {
+        T value(0.0f);
+        T weight(1.0f);
+        for (int i = 0; i < this->octaves(); i++) {
+            T f(this->_frequency[i]);
+            T signal = T(_offset) - vabs(_source(u * f, v * f));
+            signal = signal * signal * weight;
+            weight = vmin(vmax(signal * T(_gain), T(0.0f)), T(1.0f));
+            value = value + signal * T(this->_weight[i]);
+        }
+        return value * T(_scale) + T(_bias);
+    }
+};
+
+template <class Input, class Displacement> class Warp {
+protected:
+    Input _input;
+    Displacement _displacement;
+    float _strength, _shift;
+
+public:
+    Warp(const NoiseGraph& graph, int node, const Gradients& grad) :
+        _input(graph, expect(graph, node, NoiseNode::WARP).inputs[0], grad),
+        _displacement(graph, graph.node(node).inputs[1], grad), _strength(graph.node(node).strength),
+        _shift(graph.node(node).shift) {}
+
+    template <class T> T operator()(T u, T v) const {
+        T shift(_shift), strength(_strength);
+        T du = _displacement(u, v);
+        T dv = _displacement(u + shift, v + shift);
+        return _input(u + du * strength, v + dv * strength);
+    }
+};
+
+template <class Input> class Terrace {
+protected:
+    Input _input;
+    float _steps, _sharpness, _inv_steps;
+
+public:
+    Terrace(const NoiseGraph& graph, int node, const Gradients& grad) :
+        _input(graph, expect(graph, node, NoiseNode::TERRACE).inputs[0], grad), _steps(graph.node(node).steps),
+        _sharpness(graph.node(node).sharpness), _inv_steps(1.0f / _steps) {}
+
+    template <class T> T operator()(T u, T v) const {
+        T k = _input(u, v) * T(_steps);
+        T f = vfloor(k);
+        T t = k - f;
+        T s = t * t * (T(3.0f) - T(2.0f) * t);
+        return (f + (t + (s - t) * T(_sharpness))) * T(_inv_steps);
+    }
+};
+
+template <class Input> class Clamp {
+protected:
+    Input _input;
+    float _lo, _hi;
+
+public:
+    Clamp(const NoiseGraph& graph, int node, const Gradients& grad) :
+        _input(graph, expect(graph, node, NoiseNode::CLAMP).inputs[0], grad), _lo(graph.node(node).lo),
+        _hi(graph.node(node).hi) {}
+
+    template <class T> T operator()(T u, T v) const { return vmin(vmax(_input(u, v), T(_lo)), T(_hi)); }
+};
+
+template <class A, class B, class Control> class Blend {
+protected:
+    A _a;
+    B _b;
+    Control _control;
+
+public:
+    Blend(const NoiseGraph& graph, int node, const Gradients& grad) :
+        _a(graph, expect(graph, node, NoiseNode::BLEND).inputs[0], grad), _b(graph, graph.node(node).inputs[1], grad),
+        _control(graph, graph.node(node).inputs[2], grad) {}
+
+    template <class T> T operator()(T u, T v) const {
+        T a = _a(u, v);
+        T t = vmin(vmax(_control(u, v) * T(0.5f) + T(0.5f), T(0.0f)), T(1.0f));
+        return a + (_b(u, v) - a) * t;
+    }
+};
+
+/// A whole graph whose output node is Root
+template <class Root> class Kernel {
+protected:
+    Root _root;
+    float _bias;
+
+public:
+    Kernel(const NoiseGraph& graph, const Gradients& grad) :
+        _root(graph, graph.output(), grad), _bias(graph.output_bias()) {}
+
+    template <class T> T operator()(T u, T v) const { return _root(u, v) + T(_bias); }
+};
+
+} // noise::
+
+/// CPU side of the heightmap's noise graph(). Sampling at the texel centers
+/// of a W x H map reproduces what PerlinQuad renders into the FrameBuffer.
+class NoiseEngine {
+protected:
+    float _gx[GRAD_SIZE]; ///< gradient x components
+    float _gy[GRAD_SIZE]; ///< gradient y components
+
+public:
+    /// maximum number of octaves for which weights are precomputed
+    static const int MAX_OCTAVES = noise::MAX_OCTAVES;
+    /// octave counts the fills have a kernel specialised for
+    static const int MAX_SPECIALISED = 16;
+
+    /// Kernel of graph() for N octaves
+    template <int N> using Height = noise::Kernel<noise::Ridged<noise::Perlin, N> >;
+
+    NoiseEngine() {
+        init(perlin_gradients);
+    }
+
+    /// @param grad GRAD_SIZE RGB triplets, same layout as the gradient texture
+    void init(const float* grad) {
+        for (int i = 0; i < GRAD_SIZE; i++) {
+            _gx[i] = unorm8(grad[3 * i + 0]);
+            _gy[i] = unorm8(grad[3 * i + 1]);
+        }
+    }
+
+    /// The heightmap: ridged fBm of Perlin noise, offset to [-0.5, 0.5] or so
+    static NoiseGraph graph(const NoiseParams& p) {
+        NoiseGraph graph;
+        int ridged = graph.ridged(graph.perlin(), std::min(std::max(p.octaves, 0), MAX_OCTAVES), p.frequency,
+                                  p.lacunarity, p.H);
+        graph.set_output(ridged, 0.5f);
+        return graph;
+    }
+
+    /// For the kernels of noise::, as the GPU sees the gradients
+    noise::Gradients gradients() const {
+        noise::Gradients grad = { _gx, _gy };
+        return grad;
+    }
+
+    static const char* isa() {
+#if defined(NOISE_SIMD_AVX2)
+        return "AVX2";
+#elif defined(NOISE_SIMD_SSE4)
+        return "SSE4.1";
+#else
+        return "scalar";
+#endif
+    }
+
+    float pnoise(float x, float y) const {
+        return noise::pnoise(x, y, _gx, _gy);
+    }
+
+    float fBm(float u, float v, const NoiseParams& p) const {
+        return fBm_kernel(u, v, p);
+    }
+
+    float ridged_fBm(float u, float v, const NoiseParams& p) const {
+        return ridged_kernel(u, v, p);
+    }
+
+    /// Value stored in the heightmap texture, the output of graph()
+    float height(float u, float v, const NoiseParams& p) const {
+        return ridged_kernel(u, v, p) + 0.5f;
+    }
+
+    /// Heights for 8 (u,v) pairs at once, looping over p.octaves at run
+    /// time; the fills below run the kernel specialised for p.octaves
+    void height8(const float* u, const float* v, float* out, const NoiseParams& p) const {
+        noise::float8 h = ridged_kernel(noise::float8::load(u), noise::float8::load(v), p);
+        (h + noise::float8(0.5f)).store(out);
+    }
+
+    ///--- ridged_fBm one octave at a time, for generators caching octaves
+
+    /// Frequency of octave i, accumulated in float like the kernel does
+    static float octave_frequency(const NoiseParams& p, int i) {
+        float frequency = p.frequency;
+        for (int k = 0; k < i; k++) frequency *= p.lacunarity;
+        return frequency;
+    }
+
+    /// Ridged signal of one octave before its octave weight, for n samples.
+    /// prev holds the signals of the previous octave, NULL for octave 0.
+    void ridged_octave(const float* u, const float* v, float frequency, const float* prev,
+                       float* out, int n) const {
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            noise::float8 weight = prev ? ridged_weight(noise::float8::load(prev + i)) : noise::float8(1.0f);
+            ridged_signal(noise::float8::load(u + i), noise::float8::load(v + i), frequency, weight).store(out + i);
+        }
+        for (; i < n; i++) {
+            out[i] = ridged_signal(u[i], v[i], frequency, prev ? ridged_weight(prev[i]) : 1.0f);
+        }
+    }
+
+    /// Heights, as height(), from the signals of octaves 0 to p.octaves - 1
+    /// (signals[k] + offset for sample k of every octave)
+    void ridged_combine(const float* const* signals, size_t offset, int n, const NoiseParams& p,
+                        float* out) const {
+        float w[MAX_OCTAVES];
+        octave_weights(p, w);
+        int octaves = std::min(p.octaves, MAX_OCTAVES);
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            noise::float8 value(0.0f);
+            for (int o = 0; o < octaves; o++) {
+                value = value + noise::float8::load(signals[o] + offset + i) * noise::float8(w[o]);
+            }
+            (value * noise::float8(0.70f) - noise::float8(1.0f) + noise::float8(0.5f)).store(out + i);
+        }
+        for (; i < n; i++) {
+            float value = 0.0f;
+            for (int o = 0; o < octaves; o++) value = value + signals[o][offset + i] * w[o];
+            out[i] = value * 0.70f - 1.0f + 0.5f;
+        }
+    }
+
+    /// Fills a width x height map, row-major with row 0 at v = 0 (same
+    /// layout glGetTexImage returns for the FrameBuffer texture)
+    void fill(float* out, int width, int height, const NoiseParams& p) const {
+        fill_region(out, width, 0, 0, width, height, width, height, p);
+    }
+
+    /// Fills the [x0, x0+w) x [y0, y0+h) window of a full_width x full_height
+    /// map; out points at the window origin, rows are stride floats apart
+    void fill_region(float* out, int stride, int x0, int y0, int w, int h,
+                     int full_width, int full_height, const NoiseParams& p) const {
+        const float du = 1.0f / full_width;
+        const float dv = 1.0f / full_height;
+        std::vector<float> u(w), v(h);
+        for (int x = 0; x < w; x++) u[x] = (x0 + x + 0.5f) * du;
+        for (int y = 0; y < h; y++) v[y] = (y0 + y + 0.5f) * dv;
+        fill_grid(out, stride, &u[0], &v[0], w, h, p);
+    }
+
+    /// Fills w x h samples of the unbounded lattice u = (x0 + i) * step,
+    /// v = (y0 + j) * step. Coordinates are derived from the integer sample
+    /// index, so overlapping windows agree bit for bit on shared samples.
+    void fill_lattice(float* out, int stride, long long x0, long long y0, int w, int h,
+                      double step, const NoiseParams& p) const {
+        std::vector<float> u(w), v(h);
+        for (int x = 0; x < w; x++) u[x] = float((x0 + x) * step);
+        for (int y = 0; y < h; y++) v[y] = float((y0 + y) * step);
+        fill_grid(out, stride, &u[0], &v[0], w, h, p);
+    }
+
+    /// Heights at (u[i], v[j]) for i < w, j < h, rows stride floats apart
+    void fill_grid(float* out, int stride, const float* u, const float* v, int w, int h,
+                   const NoiseParams& p) const {
+        NoiseGraph g = graph(p);
+        fill_dispatch(std::integral_constant<int, MAX_SPECIALISED>(), g, out, stride, u, v, w, h);
+    }
+
+    /// Fills with any noise:: kernel
+    template <class Kernel>
+    static void fill_kernel(const Kernel& kernel, float* out, int stride, const float* u, const float* v,
+                            int w, int h) {
+        float tail[8];
+        for (int y = 0; y < h; y++) {
+            float* row = out + (size_t) y * stride;
+            noise::float8 vy(v[y]);
+            int x = 0;
+            for (; x + 8 <= w; x += 8) {
+                kernel(noise::float8::load(u + x), vy).store(row + x);
+            }
+            if (x < w) {
+                for (int i = 0; i < 8; i++) tail[i] = u[std::min(x + i, w - 1)];
+                kernel(noise::float8::load(tail), vy).store(tail);
+                std::copy(tail, tail + (w - x), row + x);
+            }
+        }
+    }
+
+    /// Compares the engine against a map rendered by PerlinQuad
+    NoiseValidation validate(const float* reference, int width, int height, const NoiseParams& p,
+                             float tolerance = 1e-4f, float max_outlier_ratio = 0.0f) const {
+        std::vector<float> values((size_t) width * height);
+        fill(&values[0], width, height, p);
+        return compare(&values[0], reference, values.size(), tolerance, max_outlier_ratio);
+    }
+
+    /// Compares a noise:: kernel against a width x height map rendered by
+    /// PerlinQuad from the graph it was built from
+    template <class Kernel>
+    static NoiseValidation validate_kernel(const Kernel& kernel, const float* reference, int width, int height,
+                                           float tolerance = 1e-4f, float max_outlier_ratio = 0.0f) {
+        std::vector<float> u(width), v(height), values((size_t) width * height);
+        for (int x = 0; x < width; x++) u[x] = (x + 0.5f) / width;
+        for (int y = 0; y < height; y++) v[y] = (y + 0.5f) / height;
+        fill_kernel(kernel, &values[0], width, &u[0], &v[0], width, height);
+        return compare(&values[0], reference, values.size(), tolerance, max_outlier_ratio);
+    }
+
+protected:
+    /// The gradient texture is stored as GL_RGB8: components are clamped
+    /// to [0, 1] and quantized to 8 bits before the shader sees them
+    static float unorm8(float g) {
+        return std::floor(std::min(std::max(g, 0.0f), 1.0f) * 255.0f + 0.5f) / 255.0f;
+    }
+
+    static NoiseValidation compare(const float* values, const float* reference, size_t samples,
+                                   float tolerance, float max_outlier_ratio) {
+        NoiseValidation res;
+        res.max_error = 0.0f;
+        res.samples = samples;
+        res.outliers = 0;
+        double sum = 0.0;
+        for (size_t i = 0; i < samples; i++) {
+            float err = std::fabs(values[i] - reference[i]);
+            res.max_error = std::max(res.max_error, err);
+            sum += err;
+            if (err > tolerance) res.outliers++;
+        }
+        res.mean_error = samples ? float(sum / samples) : 0.0f;
+        res.passed = res.outliers <= max_outlier_ratio * samples;
+        return res;
+    }
+
+    /// Picks the kernel specialised for the graph's octave count
+    template <int N>
+    void fill_dispatch(std::integral_constant<int, N>, const NoiseGraph& g, float* out, int stride,
+                       const float* u, const float* v, int w, int h) const {
+        if (g.node(g.output()).octaves() == N) {
+            fill_kernel(Height<N>(g, gradients()), out, stride, u, v, w, h);
+        } else {
+            fill_dispatch(std::integral_constant<int, N - 1>(), g, out, stride, u, v, w, h);
+        }
+    }
+
+    /// Other octave counts run their loop at run time
+    void fill_dispatch(std::integral_constant<int, noise::DYNAMIC>, const NoiseGraph& g, float* out, int stride,
+                       const float* u, const float* v, int w, int h) const {
+        fill_kernel(Height<noise::DYNAMIC>(g, gradients()), out, stride, u, v, w, h);
+    }
+
+    /// pow(lacunarity, -H*i) for every octave, as NoiseGraph folds it
+    static void octave_weights(const NoiseParams& p, float* w) {
+        for (int i = 0; i < p.octaves && i < MAX_OCTAVES; i++) {
+            w[i] = std::pow(p.lacunarity, -p.H * i);
+        }
+    }
+
+    template <class T> T fBm_kernel(T u, T v, const NoiseParams& p) const {
+        float w[MAX_OCTAVES];
+        octave_weights(p, w);
+        T value(0.0f);
+        float frequency = p.frequency;
+        for (int i = 0; i < p.octaves && i < MAX_OCTAVES; i++) {
+            value = value + noise::pnoise(u * T(frequency), v * T(frequency), _gx, _gy) * T(w[i]);
+            frequency *= p.lacunarity;
+        }
+        return value;
+    }
+
+    /// Ridged fBm of graph() before its offset, with the octave loop and
+    /// weights of the original shader computed at run time
+    template <class T> T ridged_kernel(T u, T v, const NoiseParams& p) const {
+        float w[MAX_OCTAVES];
+        octave_weights(p, w);
+        T value(0.0f);
+        T weight(1.0f);
+        float frequency = p.frequency;
+        for (int i = 0; i < p.octaves && i < MAX_OCTAVES; i++) {
+            T signal = ridged_signal(u, v, frequency, weight);
+            weight = ridged_weight(signal);
+            value = value + signal * T(w[i]);
+            frequency *= p.lacunarity;
+        }
+        return value * T(0.70f) - T(1.0f);
+    }
+
+    /// Ridge of one octave, scaled by the weight left by the previous one
+    template <class T> T ridged_signal(T u, T v, float frequency, T weight) const {
+        const T offset(1.0f);
+        T signal = noise::pnoise(u * T(frequency), v * T(frequency), _gx, _gy);
+
+        ///--- make the ridges
+        signal = offset - noise::vabs(signal);
+        signal = signal * signal;
+        return signal * weight;
+    }
+
+    /// Weight an octave's signal leaves to the next octave
+    template <class T> static T ridged_weight(T signal) {
+        const T gain(1.2f);
+        return noise::vmin(noise::vmax(signal * gain, T(0.0f)), T(1.0f));
+    }
+};
@@ -0,0 +1,237 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cassert>
+
+/// A node of a NoiseGraph, reading the nodes in inputs (added before it)
+struct NoiseNode {
+    enum Type {
+        PERLIN,     ///< gradient noise at the sample position
+        SIMPLEX,    ///< same gradients on the simplex lattice, 3 corners instead of 4
+        FBM,        ///< sum of octaves of inputs[0]
+        RIDGED,     ///< ridged multifractal of inputs[0], as libnoise's RidgedMulti
+        WARP,       ///< inputs[0] at the position displaced by inputs[1]
+        TERRACE,    ///< inputs[0] in steps
+        CLAMP,      ///< inputs[0] clamped to [lo, hi]
+        BLEND       ///< inputs[0] to inputs[1] as inputs[2] goes from -1 to 1
+    };
+
+    Type type;
+    int inputs[3];                  ///< -1 if unused
+    std::vector<float> frequency;   ///< of every octave of FBM and RIDGED
+    std::vector<float> weight;      ///< pow(lacunarity, -H * octave)
+    float offset, gain;             ///< RIDGED signal: (offset - |n|)^2, next weight signal * gain
+    float scale, bias;              ///< RIDGED value * scale + bias
+    float strength, shift;          ///< WARP by strength * (d(p), d(p + shift))
+    float steps, sharpness;         ///< TERRACE steps per unit, 0 linear to 1 smoothstep
+    float lo, hi;                   ///< CLAMP
+
+    int octaves() const { return frequency.size(); }
+};
+
+/// Composable noise: sources, octave combiners and filters wired into a
+/// graph whose parameters are folded when a node is added, so evaluating
+/// it never computes an octave's frequency or weight. glsl() generates a
+/// fragment shader with a function per node, octave loops unrolled and
+/// every constant a literal; the templates of noise:: in NoiseEngine.h
+/// (noise::Kernel<noise::Ridged<noise::Perlin, 8> >...) are the matching
+/// C++ kernels, specialised on the graph's shape at compile time and
+/// taking its folded constants, which compute the same operations in the
+/// same order.
+class NoiseGraph {
+protected:
+    std::vector<NoiseNode> _nodes;
+    int _output;
+    float _output_bias;
+
+public:
+    NoiseGraph() : _output(-1), _output_bias(0.0f) {}
+
+    ///--- Sources
+    int perlin() { return add(NoiseNode::PERLIN); }
+    int simplex() { return add(NoiseNode::SIMPLEX); }
+
+    ///--- Octave combiners: octave i samples source at frequency *
+    /// lacunarity^i (accumulated in float) and weighs lacunarity^(-H i)
+
+    int fbm(int source, int octaves, float frequency, float lacunarity, float H) {
+        int n = add(NoiseNode::FBM, source);
+        fold_octaves(_nodes[n], octaves, frequency, lacunarity, H);
+        return n;
+    }
+
+    int ridged(int source, int octaves, float frequency, float lacunarity, float H, float offset = 1.0f,
+               float gain = 1.2f, float scale = 0.70f, float bias = -1.0f) {
+        int n = add(NoiseNode::RIDGED, source);
+        NoiseNode& node = _nodes[n];
+        fold_octaves(node, octaves, frequency, lacunarity, H);
+        node.offset = offset;
+        node.gain = gain;
+        node.scale = scale;
+        node.bias = bias;
+        return n;
+    }
+
+    ///--- Filters
+
+    int warp(int input, int displacement, float strength, float shift = 5.2f) {
+        int n = add(NoiseNode::WARP, input, displacement);
+        _nodes[n].strength = strength;
+        _nodes[n].shift = shift;
+        return n;
+    }
+
+    int terrace(int input, float steps, float sharpness = 1.0f) {
+        int n = add(NoiseNode::TERRACE, input);
+        _nodes[n].steps = steps;
+        _nodes[n].sharpness = sharpness;
+        return n;
+    }
+
+    int clamp(int input, float lo, float hi) {
+        int n = add(NoiseNode::CLAMP, input);
+        _nodes[n].lo = lo;
+        _nodes[n].hi = hi;
+        return n;
+    }
+
+    int blend(int a, int b, int control) { return add(NoiseNode::BLEND, a, b, control); }
+
+    /// The graph evaluates to node + bias
+    void set_output(int node, float bias = 0.0f) {
+        _output = node;
+        _output_bias = bias;
+    }
+
+    const NoiseNode& node(int n) const { return _nodes[n]; }
+    int size() const { return _nodes.size(); }
+    int output() const { return _output; }
+    float output_bias() const { return _output_bias; }
+
+    /// Fragment shader writing the output at uv to color, after library
+    /// (hash, pnoise() and snoise() over the grad texture, see noise.glsl)
+    std::string glsl(const std::string& library) const {
+        std::ostringstream out;
+        out << "#version 330 core\n" << library << "\n";
+        for (int n = 0; n < size(); n++) emit(out, n);
+        out << "in vec2 uv;\n"
+            << "out vec3 color;\n\n"
+            << "void main() {\n"
+            << "    color = vec3(" << offset_by("node" + std::to_string(_output) + "(uv)", _output_bias) << ");\n"
+            << "}\n";
+        return out.str();
+    }
+
+protected:
+    int add(NoiseNode::Type type, int a = -1, int b = -1, int c = -1) {
+        assert(a < size() && b < size() && c < size());
+        NoiseNode node = NoiseNode();
+        node.type = type;
+        node.inputs[0] = a;
+        node.inputs[1] = b;
+        node.inputs[2] = c;
+        _nodes.push_back(node);
+        return size() - 1;
+    }
+
+    static void fold_octaves(NoiseNode& node, int octaves, float frequency, float lacunarity, float H) {
+        for (int i = 0; i < octaves; i++) {
+            node.frequency.push_back(frequency);
+            node.weight.push_back(std::pow(lacunarity, -H * i));
+            frequency *= lacunarity;
+        }
+    }
+
+    ///--- GLSL generation
+
+    /// Shortest literal that reads back as the same float
+    static std::string literal(float f) {
+        char s[32];
+        for (int digits = 1; digits <= 9; digits++) {
+            snprintf(s, sizeof(s), "%.*g", digits, f);
+            if (strtof(s, NULL) == f) break;
+        }
+        std::string res(s);
+        if (res.find_first_of(".en") == std::string::npos) res += ".0";
+        return res;
+    }
+
+    /// expr + bias, as the kernels add it
+    static std::string offset_by(const std::string& expr, float bias) {
+        if (bias == 0.0f) return expr;
+        return expr + (bias < 0.0f ? " - " + literal(-bias) : " + " + literal(bias));
+    }
+
+    /// expr * weight, the product dropped when exact
+    static std::string weighted(const std::string& expr, float weight) {
+        return weight == 1.0f ? expr : expr + " * " + literal(weight);
+    }
+
+    static std::string call(int input, const std::string& p) {
+        return "node" + std::to_string(input) + "(" + p + ")";
+    }
+
+    void emit(std::ostringstream& out, int n) const {
+        const NoiseNode& node = _nodes[n];
+        out << "float node" << n << "(vec2 p) {\n";
+        switch (node.type) {
+        case NoiseNode::PERLIN:
+            out << "    return pnoise(p);\n";
+            break;
+        case NoiseNode::SIMPLEX:
+            out << "    return snoise(p);\n";
+            break;
+        case NoiseNode::FBM:
+            out << "    float value = 0.0;\n";
+            for (int i = 0; i < node.octaves(); i++) {
+                out << "    value += " << weighted(call(node.inputs[0], "p * " + literal(node.frequency[i])),
+                                         node.weight[i]) << ";\n";
+            }
+            out << "    return value;\n";
+            break;
+        case NoiseNode::RIDGED:
+            ///--- Octave 0 has weight 1 and leaves the signal's weight to
+            /// octave 1, the last one leaves none
+            out << "    float value = 0.0, signal, weight;\n";
+            for (int i = 0; i < node.octaves(); i++) {
+                out << "    signal = " << literal(node.offset) << " - abs("
+                    << call(node.inputs[0], "p * " + literal(node.frequency[i])) << ");\n"
+                    << "    signal *= signal;\n";
+                if (i > 0) out << "    signal *= weight;\n";
+                if (i + 1 < node.octaves()) {
+                    out << "    weight = clamp(signal * " << literal(node.gain) << ", 0.0, 1.0);\n";
+                }
+                out << "    value += " << weighted("signal", node.weight[i]) << ";\n";
+            }
+            out << "    return " << offset_by("value * " + literal(node.scale), node.bias) << ";\n";
+            break;
+        case NoiseNode::WARP:
+            out << "    vec2 d = vec2(" << call(node.inputs[1], "p") << ", "
+                << call(node.inputs[1], "p + " + literal(node.shift)) << ");\n"
+                << "    return " << call(node.inputs[0], "p + d * " + literal(node.strength)) << ";\n";
+            break;
+        case NoiseNode::TERRACE:
+            out << "    float k = " << call(node.inputs[0], "p") << " * " << literal(node.steps) << ";\n"
+                << "    float f = floor(k);\n"
+                << "    float t = k - f;\n"
+                << "    float s = t * t * (3.0 - 2.0 * t);\n"
+                << "    return (f + (t + (s - t) * " << literal(node.sharpness) << ")) * "
+                << literal(1.0f / node.steps) << ";\n";
+            break;
+        case NoiseNode::CLAMP:
+            out << "    return min(max(" << call(node.inputs[0], "p") << ", " << literal(node.lo) << "), "
+                << literal(node.hi) << ");\n";
+            break;
+        case NoiseNode::BLEND:
+            out << "    float a = " << call(node.inputs[0], "p") << ";\n"
+                << "    float t = min(max(" << call(node.inputs[2], "p") << " * 0.5 + 0.5, 0.0), 1.0);\n"
+                << "    return a + (" << call(node.inputs[1], "p") << " - a) * t;\n";
+            break;
+        }
+        out << "}\n\n";
+    }
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include "NoiseEngine.h"
+#include "../_threads/ThreadPool.h"
+
+/// Timing of one generated tile
+struct TileStats {
+    int x, y;       ///< tile origin in samples
+    int w, h;       ///< tile size in samples
+    int worker;     ///< worker that generated it
+    double ms;      ///< generation time
+};
+
+/// Timing of a whole tiled generation
+struct GenerationStats {
+    int width, height;
+    int threads;
+    double total_ms;
+    size_t steals;
+    std::vector<TileStats> tiles;
+
+    void print(std::ostream& out) const {
+        std::vector<double> ms;
+        std::vector<int> per_worker(threads + 1, 0);
+        for (size_t i = 0; i < tiles.size(); i++) {
+            ms.push_back(tiles[i].ms);
+            per_worker[tiles[i].worker]++;
+        }
+        std::sort(ms.begin(), ms.end());
+        double sum = 0.0;
+        for (size_t i = 0; i < ms.size(); i++) sum += ms[i];
+
+        out << "Generated " << width << "x" << height << " in " << total_ms << " ms on "
+            << threads << " threads (" << (double) width * height / (total_ms * 1e3) << " Msamples/s)" << std::endl;
+        if (ms.empty()) return;
+        out << "  " << tiles.size() << " tiles: min " << ms.front() << " ms, mean " << sum / ms.size()
+            << " ms, p95 " << ms[ms.size() * 95 / 100] << " ms, max " << ms.back() << " ms, "
+            << steals << " stolen" << std::endl;
+        out << "  tiles per worker:";
+        for (size_t i = 0; i < per_worker.size(); i++) out << " " << per_worker[i];
+        out << std::endl;
+    }
+};
+
+/// Splits a heightmap into tiles and generates them on a ThreadPool. Tiles
+/// are disjoint rectangles of the output, so workers write straight into
+/// the caller's storage without any locking.
+class TiledGenerator {
+protected:
+    const NoiseEngine& _engine;
+    ThreadPool& _pool;
+    int _tile_size;
+
+public:
+    TiledGenerator(const NoiseEngine& engine, ThreadPool& pool, int tile_size = 128) :
+        _engine(engine), _pool(pool), _tile_size(std::max(8, tile_size)) {}
+
+    /// Fills a width x height map laid out as NoiseEngine::fill
+    GenerationStats generate(float* out, int width, int height, const NoiseParams& p) {
+        typedef std::chrono::high_resolution_clock Clock;
+        GenerationStats stats;
+        stats.width = width;
+        stats.height = height;
+        stats.threads = _pool.size();
+        size_t steals = _pool.steals();
+
+        int tiles_x = (width + _tile_size - 1) / _tile_size;
+        int tiles_y = (height + _tile_size - 1) / _tile_size;
+        stats.tiles.resize(tiles_x * tiles_y);
+
+        Clock::time_point start = Clock::now();
+        const NoiseEngine* engine = &_engine;
+        TileStats* tiles = &stats.tiles[0];
+        int tile_size = _tile_size;
+        _pool.parallel_for(0, tiles_x * tiles_y, 1, [=](int t, int worker) {
+            Clock::time_point t0 = Clock::now();
+            TileStats* tile = &tiles[t];
+            tile->x = t % tiles_x * tile_size;
+            tile->y = t / tiles_x * tile_size;
+            tile->w = std::min(tile_size, width - tile->x);
+            tile->h = std::min(tile_size, height - tile->y);
+            engine->fill_region(out + (size_t) tile->y * width + tile->x, width,
+                                tile->x, tile->y, tile->w, tile->h, width, height, p);
+            tile->worker = worker;
+            tile->ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        });
+        stats.total_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        stats.steals = _pool.steals() - steals;
+        return stats;
+    }
+};
@@ -0,0 +1,96 @@
+// Noise sources of the shaders NoiseGraph::glsl() generates; NoiseEngine
+// mirrors every function on the CPU
+uniform sampler1D grad;
+
+// lowbias32 integer hash of a lattice corner: unlike the usual
+// fract(sin(x) * 43758.5453) trick it does not depend on the precision of
+// the GPU sin(), so the CPU NoiseEngine reproduces it exactly
+uint hash(vec2 corner) {
+    uvec2 p = uvec2(ivec2(corner));
+    uint h = (p.x * 0x8da6b343u) ^ (p.y * 0xd8163841u);
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+vec2 bottom_left_corner(vec2 pos) {
+    return floor(pos);
+}
+
+vec2 top_left_corner(vec2 pos) {
+    vec2 res = bottom_left_corner(pos);
+    res.y = res.y + 1;
+    return res;
+}
+
+vec2 top_right_corner(vec2 pos) {
+    vec2 res = top_left_corner(pos);
+    res.x = res.x + 1;
+    return res;
+}
+
+vec2 bottom_right_corner(vec2 pos) {
+    vec2 res = bottom_left_corner(pos);
+    res.x = res.x + 1;
+    return res;
+}
+
+vec2 random_grad_at(vec2 pos) {
+    int index = int(hash(pos) & uint(textureSize(grad, 0) - 1));
+    return texelFetch(grad, index, 0).xy;
+}
+
+float fade(float t) {
+    return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);    
+}
+
+float lerp(float x, float y, float alpha) {
+    return (1 - alpha) * x + alpha * y;    
+}
+
+float pnoise(vec2 pos) {
+    vec2 bottom_left = bottom_left_corner(pos); 
+    vec2 top_left = top_left_corner(pos);
+    vec2 bottom_right = bottom_right_corner(pos);
+    vec2 top_right = top_right_corner(pos);
+
+    vec2 a = pos - bottom_left;
+    vec2 b = pos - bottom_right;
+    vec2 c = pos - top_left;
+    vec2 d = pos - top_right;
+
+    float s = dot(random_grad_at(bottom_left), a);
+    float t = dot(random_grad_at(bottom_right), b);
+    float u = dot(random_grad_at(top_left), c);
+    float v = dot(random_grad_at(top_right), d);
+
+    float st = lerp(s, t, fade(fract(pos.x)));
+    float uV = lerp(u, v, fade(fract(pos.x)));
+    
+    float noise = lerp(st, uV, fade(fract(pos.y)));
+    return noise;
+}
+
+// Contribution of a simplex corner c at offset d from the sample
+float simplex_corner(vec2 c, vec2 d) {
+    float t = max(0.5 - d.x * d.x - d.y * d.y, 0.0);
+    t *= t;
+    return t * t * dot(random_grad_at(c), d);
+}
+
+// Simplex noise over the same hashed gradients: the skewed lattice puts
+// every sample in a triangle, so it blends 3 corners where pnoise blends 4
+float snoise(vec2 pos) {
+    const float F2 = 0.366025403;   // (sqrt(3) - 1) / 2
+    const float G2 = 0.211324865;   // (3 - sqrt(3)) / 6
+    const float G2_1 = -0.577350269;    // 2 G2 - 1
+    vec2 cell = floor(pos + (pos.x + pos.y) * F2);
+    vec2 d0 = pos - (cell - (cell.x + cell.y) * G2);
+    vec2 i1 = d0.x > d0.y ? vec2(1.0, 0.0) : vec2(0.0, 1.0);
+    vec2 d1 = d0 - i1 + G2;
+    vec2 d2 = d0 + G2_1;
+    return 70.0 * (simplex_corner(cell, d0) + simplex_corner(cell + i1, d1) + simplex_corner(cell + 1.0, d2));
+}
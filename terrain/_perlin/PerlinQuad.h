@@ -1,7 +1,13 @@
 #pragma once
 #include "icg_common.h"
-#define GRAD_SIZE 16
+#include <string>
+#include <fstream>
+#include <iterator>
+#include "../_noise/NoiseEngine.h"
 
+/// Renders NoiseEngine::graph() over the whole FrameBuffer. The fragment
+/// shader is generated from the graph of the current parameters, and
+/// generated again when they change; draw(graph) renders any other graph.
 class PerlinQuad {
 protected:
     GLuint _vao;
@@ -9,6 +15,10 @@ protected:
     GLuint _vbo;
     GLuint _grad_tex;
     GLfloat _grad[GRAD_SIZE * 3];
+    std::string _vshader;
+    std::string _library;       ///< noise sources the generated shaders call
+    std::string _fshader;       ///< generated source of the program in _pid
+    NoiseParams _compiled;      ///< parameters it was generated for, octaves 0 if another graph
 public:
     GLfloat frequency = 0.9f;
     GLfloat H = 1.0f; 
@@ -16,9 +26,11 @@ public:
     GLuint octaves = 8;
 
     void init() {
-        _pid = opengp::load_shaders("_perlin/perlin_vshader.glsl",
-                "_perlin/perlin_fshader.glsl");
-        if (!_pid) exit(EXIT_FAILURE);
+        _vshader = read("_perlin/perlin_vshader.glsl");
+        _library = read("_noise/noise.glsl");
+        _pid = 0;
+        _compiled = params();
+        compile(NoiseEngine::graph(_compiled));
         glUseProgram(_pid);
         
         ///--- Vertex one vertex Array
@@ -65,7 +77,7 @@ public:
             glGenTextures(1, &_grad_tex);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_1D, _grad_tex);
-            glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, GRAD_SIZE, 0, GL_RGB, GL_FLOAT, _grad);
+            glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, GRAD_SIZE, 0, GL_RGB, GL_FLOAT, _grad);
             glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
             glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
             glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -81,34 +93,71 @@ public:
     }
 
     void draw() {
+        NoiseParams p = params();
+        if (p.frequency != _compiled.frequency || p.H != _compiled.H || p.lacunarity != _compiled.lacunarity ||
+            p.octaves != _compiled.octaves) {
+            _compiled = p;
+            compile(NoiseEngine::graph(p));
+        }
+        render();
+    }
+
+    /// Renders graph instead of the one of the current parameters
+    void draw(const NoiseGraph& graph) {
+        _compiled.octaves = 0;
+        compile(graph);
+        render();
+    }
+
+    NoiseParams params() const {
+        return NoiseParams(frequency, H, lacunarity, octaves);
+    }
+
+    /// Generated source of the fragment shader for the current parameters
+    std::string fragment_shader() const {
+        return NoiseEngine::graph(params()).glsl(_library);
+    }
+private:
+    void render() {
         glUseProgram(_pid);
         glBindVertexArray(_vao);
             ///--- Bind textures
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_1D, _grad_tex);
 
-            // Setup uniforms
-            GLuint frequency_id = glGetUniformLocation(_pid, "initial_freq");
-            GLuint H_id = glGetUniformLocation(_pid, "H");
-            GLuint lacunarity_id = glGetUniformLocation(_pid, "lacunarity");
-            GLuint octaves_id = glGetUniformLocation(_pid, "octaves");
-            glUniform1f(frequency_id, frequency);
-            glUniform1f(H_id, H);
-            glUniform1f(lacunarity_id, lacunarity);
-            glUniform1i(octaves_id, octaves);
+            glUniform1i(glGetUniformLocation(_pid, "grad"), 0);
 
             ///--- Draw
             glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
         glBindVertexArray(0);
         glUseProgram(0);
     }
-private:
+
+    static std::string read(const char* path) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "!!!ERROR: cannot read " << path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    /// Generates the shader of graph and compiles it unless it is the one
+    /// in _pid; the vertex shader fixes the attribute locations the vertex
+    /// array uses
+    void compile(const NoiseGraph& graph) {
+        std::string fshader = graph.glsl(_library);
+        if (_pid && fshader == _fshader) return;
+        GLuint pid = opengp::compile_shaders(_vshader.c_str(), fshader.c_str());
+        if (!pid) exit(EXIT_FAILURE);
+        if (_pid) glDeleteProgram(_pid);
+        _pid = pid;
+        _fshader = fshader;
+    }
+
     void fill_grad_tex() {
-        GLfloat grad[GRAD_SIZE * 3] = {
-            0.7603266842957805,-0.6495408633394705,0, 0.8809657602279946,0.47318001786414404,0, -0.5466367864419548,0.8373698249330536,0, -0.13296468949966458,-0.9911207753580074,0, 0.201892960546683,-0.9794075926199958,0, -0.04842254529095715,0.9988269405195002,0, 0.8367694012715634,0.5475554484210976,0, 0.9727549736470312,-0.2318356341138343,0, 0.7923240671229802,0.6101004611190678,0, -0.0018588171345380177,-0.9999982723979378,0, -0.6190943565348803,0.7853166098502327,0, 0.41455599418515415,0.9100238061090262,0, -0.8799918653547627,0.4749887545084044,0, -0.9837026492057273,-0.17980294198269908,0, -0.7117149151989826,0.7024684188512,0, -0.806249556332093,-0.5915755682195666,0
-        };
         for (unsigned int i = 0; i < GRAD_SIZE * 3; i++) {
-            _grad[i] = grad[i];
+            _grad[i] = perlin_gradients[i];
         }
     }
 };
@@ -1,6 +1,6 @@
 #version 330 core
-in vec3 vpoint;
-in vec2 vtexcoord;
+layout(location = 0) in vec3 vpoint;
+layout(location = 1) in vec2 vtexcoord;
 out vec2 uv;
 
 void main() {
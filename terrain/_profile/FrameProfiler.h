@@ -0,0 +1,306 @@
+#pragma once
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include "icg_common.h"
+
+/// CPU and GPU time of named, possibly nested scopes of every frame, such
+/// as the passes of the RenderGraph. The CPU side is a steady clock; the
+/// GPU side a pair of timestamp queries per scope, in one query set per
+/// frame of a double buffer: a set is read back when it comes round again,
+/// two frames later, and dropped rather than waited for if the GPU is not
+/// done with it. Scopes are averaged per pass over an interval for
+/// display, and can be
+/// recorded as Chrome trace events (chrome://tracing, Perfetto) with the
+/// CPU and the GPU as two threads.
+class FrameProfiler {
+public:
+    /// Averages of a scope over the frames since the last refresh()
+    struct PassStats {
+        double cpu_ms;
+        double gpu_ms;
+        double max_cpu_ms, max_gpu_ms;      ///< worst frame
+        ///--- Accumulated since the last refresh
+        double cpu_sum, gpu_sum, cpu_max, gpu_max;
+        int cpu_count, gpu_count;
+    };
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int BUFFERS = 2;       ///< frames of GPU queries in flight
+    static const int MAX_SCOPES = 32;   ///< per frame
+
+    struct Scope {
+        std::string name;
+        double cpu_begin, cpu_end;      ///< microseconds since the profiler started
+    };
+
+    struct QuerySet {
+        GLuint begin[MAX_SCOPES];
+        GLuint end[MAX_SCOPES];
+        std::vector<Scope> scopes;
+        GLuint last;                    ///< query issued last, completes last
+        bool pending;                   ///< issued, not read back yet
+    };
+
+    struct TraceEvent {
+        std::string name;
+        int thread;                     ///< 0 CPU, 1 GPU
+        double ts, dur;                 ///< microseconds
+    };
+
+    Clock::time_point _start;
+    QuerySet _sets[BUFFERS];
+    int _frame;
+    std::vector<int> _open;             ///< scopes begun and not ended, innermost last
+    bool _gpu;                          ///< queries created
+
+    ///--- GPU clock in nanoseconds at CPU time 0
+    GLint64 _gpu_origin;
+
+    std::map<std::string, PassStats> _stats;
+    std::vector<std::string> _order;    ///< of first appearance
+    size_t _dropped;                    ///< query sets not ready when reused
+    double _interval;                   ///< microseconds between refreshes
+    double _last_refresh;
+
+    bool _tracing;
+    size_t _max_events;
+    std::vector<TraceEvent> _events;
+
+public:
+    FrameProfiler() : _frame(0), _gpu(false), _gpu_origin(0), _dropped(0), _interval(1e6),
+        _last_refresh(0.0), _tracing(false), _max_events(0) {
+        _start = Clock::now();
+    }
+
+    /// Creates the queries, needs a GL context
+    void init() {
+        for (int b = 0; b < BUFFERS; b++) {
+            glGenQueries(MAX_SCOPES, _sets[b].begin);
+            glGenQueries(MAX_SCOPES, _sets[b].end);
+            _sets[b].pending = false;
+        }
+        _gpu = true;
+        calibrate();
+    }
+
+    void cleanup() {
+        if (!_gpu) return;
+        for (int b = 0; b < BUFFERS; b++) {
+            glDeleteQueries(MAX_SCOPES, _sets[b].begin);
+            glDeleteQueries(MAX_SCOPES, _sets[b].end);
+        }
+        _gpu = false;
+    }
+
+    /// Seconds between refreshes of the averages, 0 leaves them to finish()
+    void set_interval(double seconds) {
+        _interval = seconds * 1e6;
+    }
+
+    /// Records trace events from now on, up to max_events of them
+    void start_trace(size_t max_events = 1000000) {
+        _tracing = true;
+        _max_events = max_events;
+    }
+
+    /// Reads back the queries of the frame that used this set before
+    void begin_frame() {
+        QuerySet& set = _sets[_frame % BUFFERS];
+        if (set.pending) collect(set);
+        set.scopes.clear();
+        _open.clear();
+    }
+
+    /// True when the averages were refreshed, once per interval
+    bool end_frame() {
+        QuerySet& set = _sets[_frame % BUFFERS];
+        set.pending = _gpu && !set.scopes.empty();
+        _frame++;
+        if (_interval <= 0.0 || now() - _last_refresh < _interval) return false;
+        _last_refresh = now();
+        refresh();
+        return true;
+    }
+
+    void begin(const std::string& name) {
+        QuerySet& set = _sets[_frame % BUFFERS];
+        if ((int) set.scopes.size() == MAX_SCOPES) {
+            _open.push_back(-1);
+            return;
+        }
+        Scope scope = { name, now(), 0.0 };
+        if (_gpu) query(set, set.begin[set.scopes.size()]);
+        _open.push_back(set.scopes.size());
+        set.scopes.push_back(scope);
+    }
+
+    void end() {
+        QuerySet& set = _sets[_frame % BUFFERS];
+        int index = _open.back();
+        _open.pop_back();
+        if (index < 0) return;
+        set.scopes[index].cpu_end = now();
+        if (_gpu) query(set, set.end[index]);
+    }
+
+    /// Waits for the queries in flight and refreshes the averages with
+    /// every frame since the last refresh
+    void finish() {
+        if (_gpu) glFinish();
+        for (int b = 0; b < BUFFERS; b++) {
+            QuerySet& set = _sets[(_frame + b) % BUFFERS];
+            if (set.pending) collect(set);
+        }
+        _last_refresh = now();
+        refresh();
+    }
+
+    /// Scopes seen so far, in order of first appearance
+    const std::vector<std::string>& passes() const { return _order; }
+
+    /// Averages of a scope, the address stays valid (for the overlay)
+    PassStats& stats(const std::string& name) {
+        std::map<std::string, PassStats>::iterator it = _stats.find(name);
+        if (it != _stats.end()) return it->second;
+        PassStats zero = {};
+        _order.push_back(name);
+        return _stats[name] = zero;
+    }
+
+    /// Prints the average and worst CPU / GPU ms of every scope
+    void print(std::ostream& out) {
+        out << "Profile (CPU/GPU ms, worst):";
+        for (size_t i = 0; i < _order.size(); i++) {
+            const PassStats& s = _stats[_order[i]];
+            char line[128];
+            snprintf(line, sizeof(line), " %s %.2f/%.2f (%.2f/%.2f)", _order[i].c_str(), s.cpu_ms, s.gpu_ms,
+                     s.max_cpu_ms, s.max_gpu_ms);
+            out << line;
+        }
+        if (_dropped) out << ", " << _dropped << " query sets dropped";
+        out << std::endl;
+    }
+
+    /// Prints the averages as a JSON object keyed by scope, indented as a
+    /// member of a top-level object
+    void print_json(std::ostream& out) {
+        out << "{";
+        for (size_t i = 0; i < _order.size(); i++) {
+            const PassStats& s = _stats[_order[i]];
+            char line[256];
+            snprintf(line, sizeof(line), "%s\n    \"%s\": {\"cpu_ms\": %.4f, \"gpu_ms\": %.4f, "
+                     "\"max_cpu_ms\": %.4f, \"max_gpu_ms\": %.4f}", i ? "," : "", _order[i].c_str(),
+                     s.cpu_ms, s.gpu_ms, s.max_cpu_ms, s.max_gpu_ms);
+            out << line;
+        }
+        out << "\n  }";
+    }
+
+    /// Writes the recorded events as a Chrome trace, false on failure
+    bool write_trace(const char* path) const {
+        FILE* file = fopen(path, "w");
+        if (!file) {
+            std::cerr << "!!!WARNING: cannot write trace " << path << std::endl;
+            return false;
+        }
+        fprintf(file, "{\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}");
+        for (size_t i = 0; i < _events.size(); i++) {
+            const TraceEvent& e = _events[i];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    e.name.c_str(), e.thread, e.ts, e.dur);
+        }
+        fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        bool ok = fclose(file) == 0;
+        std::cout << "Trace of " << _events.size() << " events written to " << path << std::endl;
+        return ok;
+    }
+
+protected:
+    double now() const {
+        return std::chrono::duration<double, std::micro>(Clock::now() - _start).count();
+    }
+
+    /// Pairs the GPU clock with the CPU one; GL_TIMESTAMP is read when the
+    /// commands before it are done, so the queue is drained first
+    void calibrate() {
+        glFinish();
+        GLint64 gpu_now = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        _gpu_origin = gpu_now - (GLint64) (now() * 1000.0);
+    }
+
+    /// Turns the sums since the last call into averages and worst frames
+    void refresh() {
+        for (std::map<std::string, PassStats>::iterator it = _stats.begin(); it != _stats.end(); ++it) {
+            PassStats& s = it->second;
+            s.cpu_ms = s.cpu_count ? s.cpu_sum / s.cpu_count : 0.0;
+            s.gpu_ms = s.gpu_count ? s.gpu_sum / s.gpu_count : 0.0;
+            s.max_cpu_ms = s.cpu_max;
+            s.max_gpu_ms = s.gpu_max;
+            s.cpu_sum = s.gpu_sum = s.cpu_max = s.gpu_max = 0.0;
+            s.cpu_count = s.gpu_count = 0;
+        }
+    }
+
+    void query(QuerySet& set, GLuint query) {
+        glQueryCounter(query, GL_TIMESTAMP);
+        set.last = query;
+    }
+
+    void collect(QuerySet& set) {
+        set.pending = false;
+        ///--- All or nothing
+        GLint available = 0;
+        glGetQueryObjectiv(set.last, GL_QUERY_RESULT_AVAILABLE, &available);
+        bool gpu = available != 0;
+        if (!gpu) _dropped++;
+        for (size_t i = 0; i < set.scopes.size(); i++) {
+            const Scope& scope = set.scopes[i];
+            PassStats& s = stats(scope.name);
+            double cpu_ms = (scope.cpu_end - scope.cpu_begin) / 1000.0;
+            s.cpu_sum += cpu_ms;
+            s.cpu_max = std::max(s.cpu_max, cpu_ms);
+            s.cpu_count++;
+            trace(scope.name, 0, scope.cpu_begin, scope.cpu_end - scope.cpu_begin);
+            if (!gpu) continue;
+
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(set.begin[i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(set.end[i], GL_QUERY_RESULT, &end);
+            double gpu_ms = (end - begin) / 1e6;
+            s.gpu_sum += gpu_ms;
+            s.gpu_max = std::max(s.gpu_max, gpu_ms);
+            s.gpu_count++;
+            trace(scope.name, 1, ((GLint64) begin - _gpu_origin) / 1000.0, (end - begin) / 1000.0);
+        }
+    }
+
+    void trace(const std::string& name, int thread, double ts, double dur) {
+        if (!_tracing || _events.size() >= _max_events) return;
+        TraceEvent event = { name, thread, ts, dur };
+        _events.push_back(event);
+    }
+};
+
+/// Times the enclosing block as a scope of a FrameProfiler, if any
+class ProfileScope {
+protected:
+    FrameProfiler* _profiler;
+
+public:
+    ProfileScope(FrameProfiler* profiler, const std::string& name) : _profiler(profiler) {
+        if (_profiler) _profiler->begin(name);
+    }
+    ~ProfileScope() {
+        if (_profiler) _profiler->end();
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+#include <iostream>
+#include <algorithm>
+#include "icg_common.h"
+
+/// Shadow copy of the GL state the passes of the RenderGraph touch:
+/// program, vertex array, textures and samplers per unit, and the depth,
+/// blend and clip switches. Calls that would not change anything are
+/// dropped before they reach the driver, and both kinds are counted.
+/// Code that calls GL directly must be followed by invalidate(), after
+/// which every binding is issued again once.
+class GLState {
+protected:
+    static const int UNITS = 16;
+    enum Target { TEXTURE_2D, TEXTURE_2D_ARRAY, TEXTURE_CUBE_MAP, TARGETS };
+    enum Switch { BLEND, DEPTH_TEST, CLIP_DISTANCE0, SWITCHES };
+    static const GLuint UNKNOWN = 0xffffffff;   ///< not a name GL hands out
+
+    GLuint _program;
+    GLuint _vao;
+    int _active_unit;
+    GLuint _textures[UNITS][TARGETS];
+    GLuint _samplers[UNITS];
+    GLuint _switches[SWITCHES];     ///< 0, 1 or UNKNOWN
+    GLuint _depth_mask;
+    GLuint _depth_func;
+    GLuint _blend_src, _blend_dst;
+
+    ///--- Statistics, since the last print
+    size_t _changes;        ///< calls passed on to GL
+    size_t _redundant;      ///< calls dropped
+    int _frames;
+
+    GLState() : _changes(0), _redundant(0), _frames(0) {
+        invalidate();
+    }
+
+public:
+    /// State of the one GL context of the application
+    static GLState& instance() {
+        static GLState state;
+        return state;
+    }
+
+    /// Forgets everything, after GL was called behind the cache's back
+    void invalidate() {
+        _program = _vao = UNKNOWN;
+        _active_unit = -1;
+        for (int u = 0; u < UNITS; u++) {
+            for (int t = 0; t < TARGETS; t++) _textures[u][t] = UNKNOWN;
+            _samplers[u] = UNKNOWN;
+        }
+        for (int s = 0; s < SWITCHES; s++) _switches[s] = UNKNOWN;
+        _depth_mask = _depth_func = _blend_src = _blend_dst = UNKNOWN;
+    }
+
+    /// Leaves GL as code outside the render graph expects it: no program,
+    /// no vertex array, unit 0 active, depth test and writes on, no
+    /// blending and no clipping
+    void release() {
+        use_program(0);
+        bind_vertex_array(0);
+        active_unit(0);
+        depth(true);
+        blend(false);
+        clip(false);
+        invalidate();
+    }
+
+    /// Counts a frame for the averages of print()
+    void end_frame() {
+        _frames++;
+    }
+
+    void use_program(GLuint program) {
+        if (!changed(_program, program)) return;
+        glUseProgram(program);
+    }
+
+    void bind_vertex_array(GLuint vao) {
+        if (!changed(_vao, vao)) return;
+        glBindVertexArray(vao);
+    }
+
+    /// Binds texture to target (GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY or
+    /// GL_TEXTURE_CUBE_MAP) of a texture unit
+    void bind_texture(int unit, GLenum target, GLuint texture) {
+        if (!changed(_textures[unit][target_index(target)], texture)) return;
+        active_unit(unit);
+        glBindTexture(target, texture);
+    }
+
+    void bind_sampler(int unit, GLuint sampler) {
+        if (!changed(_samplers[unit], sampler)) return;
+        glBindSampler(unit, sampler);
+    }
+
+    /// Depth test on or off, writes and comparison
+    void depth(bool test, bool write = true, GLenum func = GL_LESS) {
+        set(DEPTH_TEST, GL_DEPTH_TEST, test);
+        if (changed(_depth_mask, write)) glDepthMask(write ? GL_TRUE : GL_FALSE);
+        if (changed(_depth_func, func)) glDepthFunc(func);
+    }
+
+    /// Blending off, or on with the given factors
+    void blend(bool enabled, GLenum src = GL_SRC_ALPHA, GLenum dst = GL_ONE_MINUS_SRC_ALPHA) {
+        set(BLEND, GL_BLEND, enabled);
+        if (!enabled) return;
+        if (_blend_src != src || _blend_dst != dst) {
+            _blend_src = src;
+            _blend_dst = dst;
+            glBlendFunc(src, dst);
+            _changes++;
+        } else {
+            _redundant++;
+        }
+    }
+
+    /// First user clip distance of the vertex shaders
+    void clip(bool enabled) {
+        set(CLIP_DISTANCE0, GL_CLIP_DISTANCE0, enabled);
+    }
+
+    void print(std::ostream& out) {
+        int frames = std::max(1, _frames);
+        out << "GL state: " << _changes / frames << " changes, " << _redundant / frames
+            << " redundant calls skipped per frame" << std::endl;
+        _changes = _redundant = 0;
+        _frames = 0;
+    }
+
+protected:
+    /// Records value, true when it differs from what GL has
+    bool changed(GLuint& current, GLuint value) {
+        if (current == value) {
+            _redundant++;
+            return false;
+        }
+        current = value;
+        _changes++;
+        return true;
+    }
+
+    void active_unit(int unit) {
+        if (_active_unit == unit) return;
+        _active_unit = unit;
+        _changes++;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void set(Switch s, GLenum cap, bool enabled) {
+        if (!changed(_switches[s], enabled)) return;
+        if (enabled) glEnable(cap);
+        else glDisable(cap);
+    }
+
+    static int target_index(GLenum target) {
+        switch (target) {
+            case GL_TEXTURE_2D_ARRAY: return TEXTURE_2D_ARRAY;
+            case GL_TEXTURE_CUBE_MAP: return TEXTURE_CUBE_MAP;
+            default: return TEXTURE_2D;
+        }
+    }
+};
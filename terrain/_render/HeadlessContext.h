@@ -0,0 +1,107 @@
+#pragma once
+#include "icg_common.h"
+#ifdef WITH_EGL
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+#endif
+
+/// OpenGL 3.3 core context without a window, for benchmarks on machines
+/// without a display: EGL on the Mesa surfaceless platform when there is
+/// one (llvmpipe renders on CPU-only machines), with a pbuffer of the
+/// window size standing in for the default framebuffer. Built without
+/// WITH_EGL, init() fails and the caller opens a window instead.
+class HeadlessContext {
+protected:
+#ifdef WITH_EGL
+    EGLDisplay _display;
+    EGLContext _context;
+    EGLSurface _surface;
+#endif
+    bool _current;
+
+public:
+    HeadlessContext() : _current(false) {
+#ifdef WITH_EGL
+        _display = EGL_NO_DISPLAY;
+        _context = EGL_NO_CONTEXT;
+        _surface = EGL_NO_SURFACE;
+#endif
+    }
+
+    /// Creates the context and makes it current, false if there is none
+    bool init(int width, int height) {
+#ifdef WITH_EGL
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        _display = get_platform_display ?
+            get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) :
+            eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major, minor;
+        if (_display == EGL_NO_DISPLAY || !eglInitialize(_display, &major, &minor)) {
+            fprintf(stderr, "!!!WARNING: no EGL display\n");
+            return false;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+
+        EGLint config_attributes[] = {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(_display, config_attributes, &config, 1, &configs) || configs == 0) {
+            fprintf(stderr, "!!!WARNING: no EGL pbuffer configuration\n");
+            return false;
+        }
+        EGLint context_attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE
+        };
+        _context = eglCreateContext(_display, config, EGL_NO_CONTEXT, context_attributes);
+        EGLint surface_attributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        _surface = eglCreatePbufferSurface(_display, config, surface_attributes);
+        if (_context == EGL_NO_CONTEXT || _surface == EGL_NO_SURFACE ||
+            !eglMakeCurrent(_display, _surface, _surface, _context)) {
+            fprintf(stderr, "!!!WARNING: cannot create a headless OpenGL 3.3 context\n");
+            cleanup();
+            return false;
+        }
+        _current = true;
+
+        glewExperimental = true;
+        if (glewInit() != GLEW_NO_ERROR) {
+            fprintf(stderr, "!!!WARNING: failed to initialize GLEW\n");
+            cleanup();
+            return false;
+        }
+        ///--- GLEW asks for the extension string, an error in core profiles
+        while (glGetError() != GL_NO_ERROR) {}
+        return true;
+#else
+        (void) width;
+        (void) height;
+        return false;
+#endif
+    }
+
+    /// Presents a frame, the counterpart of glfwSwapBuffers
+    void swap() {
+#ifdef WITH_EGL
+        if (_current) eglSwapBuffers(_display, _surface);
+#endif
+    }
+
+    void cleanup() {
+#ifdef WITH_EGL
+        if (_display == EGL_NO_DISPLAY) return;
+        eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (_surface != EGL_NO_SURFACE) eglDestroySurface(_display, _surface);
+        if (_context != EGL_NO_CONTEXT) eglDestroyContext(_display, _context);
+        eglTerminate(_display);
+        _display = EGL_NO_DISPLAY;
+        _context = EGL_NO_CONTEXT;
+        _surface = EGL_NO_SURFACE;
+#endif
+        _current = false;
+    }
+};
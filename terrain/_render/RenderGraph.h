@@ -0,0 +1,124 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include "GLState.h"
+#include "../_profile/FrameProfiler.h"
+
+/// The passes of a frame, each declaring the resources it reads and the
+/// ones it writes. compile() orders them so that every pass runs after the
+/// writers of what it reads, keeping the order of declaration where the
+/// dependencies leave a choice; a resource has a single writer, a pass
+/// that builds on another one's output reads it and writes a new name.
+///
+/// Passes draw through GLState, which drops redundant state changes
+/// across passes. Passes declared untracked call GL directly: they start
+/// from the default state and the cache is invalidated after them.
+/// execute() times every pass as a scope of a FrameProfiler, if given one.
+class RenderGraph {
+public:
+    typedef std::function<void()> Execute;
+
+protected:
+    struct Pass {
+        std::string name;
+        std::vector<std::string> reads;
+        std::vector<std::string> writes;
+        Execute execute;
+        bool tracked;
+    };
+
+    std::vector<Pass> _passes;      ///< in declaration order
+    std::vector<int> _order;        ///< of execution, set by compile()
+
+public:
+    void add_pass(const std::string& name, const std::vector<std::string>& reads,
+                  const std::vector<std::string>& writes, const Execute& execute, bool tracked = true) {
+        Pass pass = { name, reads, writes, execute, tracked };
+        _passes.push_back(pass);
+        _order.clear();
+    }
+
+    /// Orders the passes, false (and declaration order) if the
+    /// dependencies are inconsistent
+    bool compile() {
+        std::map<std::string, int> writer;
+        for (size_t p = 0; p < _passes.size(); p++) {
+            for (size_t w = 0; w < _passes[p].writes.size(); w++) {
+                const std::string& resource = _passes[p].writes[w];
+                if (writer.count(resource)) {
+                    std::cerr << "!!!ERROR: " << resource << " written by " << _passes[writer[resource]].name
+                              << " and " << _passes[p].name << std::endl;
+                    return fallback();
+                }
+                writer[resource] = p;
+            }
+        }
+
+        ///--- Kahn's algorithm, always taking the first ready pass in declaration order
+        std::vector<std::vector<int> > dependents(_passes.size());
+        std::vector<int> missing(_passes.size(), 0);
+        for (size_t p = 0; p < _passes.size(); p++) {
+            for (size_t r = 0; r < _passes[p].reads.size(); r++) {
+                std::map<std::string, int>::const_iterator it = writer.find(_passes[p].reads[r]);
+                if (it == writer.end()) continue;   // produced outside the graph
+                dependents[it->second].push_back(p);
+                missing[p]++;
+            }
+        }
+        _order.clear();
+        std::vector<bool> done(_passes.size(), false);
+        while (_order.size() < _passes.size()) {
+            int next = -1;
+            for (size_t p = 0; p < _passes.size() && next < 0; p++) {
+                if (!done[p] && missing[p] == 0) next = p;
+            }
+            if (next < 0) {
+                std::cerr << "!!!ERROR: render graph has a cycle" << std::endl;
+                return fallback();
+            }
+            done[next] = true;
+            _order.push_back(next);
+            for (size_t d = 0; d < dependents[next].size(); d++) missing[dependents[next][d]]--;
+        }
+        return true;
+    }
+
+    /// Runs the passes of one frame and leaves GL in its default state
+    void execute(FrameProfiler* profiler = NULL) {
+        if (_order.size() != _passes.size()) compile();
+        GLState& state = GLState::instance();
+        state.invalidate();
+        for (size_t i = 0; i < _order.size(); i++) {
+            Pass& pass = _passes[_order[i]];
+            ProfileScope scope(profiler, pass.name);
+            if (!pass.tracked) state.release();
+            pass.execute();
+            if (!pass.tracked) state.invalidate();
+        }
+        state.release();
+        state.end_frame();
+    }
+
+    /// Names of the passes, in the order of execution once compiled
+    std::vector<std::string> names() const {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < _order.size(); i++) names.push_back(_passes[_order[i]].name);
+        return names;
+    }
+
+    void print(std::ostream& out) const {
+        out << "Render graph:";
+        for (size_t i = 0; i < _order.size(); i++) out << (i ? " -> " : " ") << _passes[_order[i]].name;
+        out << std::endl;
+    }
+
+protected:
+    bool fallback() {
+        _order.clear();
+        for (size_t p = 0; p < _passes.size(); p++) _order.push_back(p);
+        return false;
+    }
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include "icg_common.h"
+
+/// The free flying camera as the simulation advances it
+struct CameraState {
+    vec3 pos;
+    vec3 front;
+    vec3 up;
+    vec3 mirror_up;         ///< of the reflected camera, pitching the other way
+    vec3 speed;             ///< forward, pitch and yaw rates per tick
+
+    /// Between a and b; the directions are interpolated and renormalized
+    static CameraState lerp(const CameraState& a, const CameraState& b, float alpha) {
+        CameraState state;
+        state.pos = a.pos + alpha * (b.pos - a.pos);
+        state.front = (a.front + alpha * (b.front - a.front)).normalized();
+        state.up = (a.up + alpha * (b.up - a.up)).normalized();
+        state.mirror_up = (a.mirror_up + alpha * (b.mirror_up - a.mirror_up)).normalized();
+        state.speed = b.speed;
+        return state;
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+/// Runs a simulation on its own thread at a fixed tick rate, independent of
+/// the frame rate. Every tick publishes the state before and after it; the
+/// renderer reads them at any time and interpolates to its own clock, one
+/// tick behind. Publishing goes through three slots swapped by an atomic
+/// exchange, so neither thread ever waits for the other. State needs
+/// static State lerp(const State& a, const State& b, float alpha).
+template <typename State>
+class FixedStepLoop {
+public:
+    /// Advances state by dt seconds, on the simulation thread
+    typedef std::function<void(State& state, float dt)> Tick;
+    /// Changes the state between two ticks, on the simulation thread
+    typedef std::function<void(State& state)> Command;
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    /// Two consecutive ticks, handed over as one
+    struct Snapshot {
+        State previous, current;
+        double time;            ///< of current, seconds since start()
+    };
+
+    static const int FRESH = 4;         ///< flag of _middle: published, not read yet
+    static const int MAX_BEHIND = 8;    ///< ticks to catch up on before skipping ahead
+
+    Tick _tick;
+    double _step;               ///< seconds per tick
+    std::thread _thread;
+    std::atomic<bool> _running;
+    Clock::time_point _start;
+
+    ///--- Slots: written by the simulation, read by the renderer, and exchanged
+    Snapshot _slots[3];
+    int _back;                  ///< simulation side
+    std::atomic<int> _middle;   ///< slot index | FRESH
+    int _front;                 ///< renderer side
+    State _state;               ///< simulation side
+
+    std::mutex _mutex;          ///< of _commands
+    std::vector<Command> _commands;
+    std::atomic<bool> _has_commands;
+
+    ///--- Statistics, since the last print
+    std::atomic<size_t> _ticks;
+    std::atomic<size_t> _tick_ns;   ///< total time spent in ticks
+    std::atomic<size_t> _max_ns;
+    std::atomic<size_t> _late;      ///< ticks run behind their schedule
+    std::atomic<size_t> _skipped;   ///< ticks dropped when too far behind
+    Clock::time_point _last_print;
+
+public:
+    /// tick is called rate times per second
+    FixedStepLoop(const Tick& tick, double rate = 60.0) : _tick(tick), _step(1.0 / rate), _running(false),
+        _back(0), _middle(1), _front(2), _has_commands(false), _ticks(0), _tick_ns(0), _max_ns(0), _late(0),
+        _skipped(0) {}
+
+    ~FixedStepLoop() {
+        stop();
+    }
+
+    /// Starts ticking from initial
+    void start(const State& initial) {
+        stop();
+        _state = initial;
+        for (int i = 0; i < 3; i++) {
+            _slots[i].previous = _slots[i].current = initial;
+            _slots[i].time = 0.0;
+        }
+        _back = 0;
+        _middle = 1;
+        _front = 2;
+        _start = _last_print = Clock::now();
+        _running = true;
+        _thread = std::thread(&FixedStepLoop::run, this);
+    }
+
+    void stop() {
+        if (!_running) return;
+        _running = false;
+        _thread.join();
+    }
+
+    float step() const { return _step; }
+
+    /// Runs command before the next tick
+    void post(const Command& command) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _commands.push_back(command);
+        _has_commands = true;
+    }
+
+    /// State at the current time minus one tick, between the last two ticks
+    State state() {
+        if (_middle.load() & FRESH) {
+            _front = _middle.exchange(_front) & ~FRESH;
+        }
+        const Snapshot& snapshot = _slots[_front];
+        double now = seconds(Clock::now());
+        float alpha = std::min(1.0, std::max(0.0, (now - snapshot.time) / _step));
+        return State::lerp(snapshot.previous, snapshot.current, alpha);
+    }
+
+    /// Prints the ticks per second and their cost since the last call
+    void print(std::ostream& out) {
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - _last_print).count();
+        size_t ticks = _ticks.exchange(0);
+        size_t tick_ns = _tick_ns.exchange(0);
+        out << "Simulation: " << (elapsed > 0.0 ? ticks / elapsed : 0.0) << " ticks/s of " << 1.0 / _step << ", "
+            << (ticks ? tick_ns * 1e-6 / ticks : 0.0) << " ms per tick, " << _max_ns.exchange(0) * 1e-6
+            << " ms worst, " << _late.exchange(0) << " late, " << _skipped.exchange(0) << " skipped" << std::endl;
+        _last_print = now;
+    }
+
+protected:
+    double seconds(Clock::time_point t) const {
+        return std::chrono::duration<double>(t - _start).count();
+    }
+
+    void run() {
+        Clock::duration step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_step));
+        Clock::time_point next = _start + step;
+        while (_running) {
+            Clock::time_point now = Clock::now();
+            if (now < next) {
+                std::this_thread::sleep_until(next);
+                continue;
+            }
+            if (now - next > MAX_BEHIND * step) {
+                ///--- Stalled (debugger, suspended machine): drop the backlog
+                _skipped += (now - next) / step;
+                next = now;
+            } else if (now - next > step) {
+                _late++;
+            }
+            run_commands();
+
+            Snapshot& snapshot = _slots[_back];
+            snapshot.previous = _state;
+            _tick(_state, _step);
+            snapshot.current = _state;
+            snapshot.time = seconds(next);
+            _back = _middle.exchange(_back | FRESH) & ~FRESH;
+
+            size_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - now).count();
+            _ticks++;
+            _tick_ns += ns;
+            size_t max = _max_ns;
+            while (ns > max && !_max_ns.compare_exchange_weak(max, ns)) {}
+            next += step;
+        }
+    }
+
+    void run_commands() {
+        if (!_has_commands) return;
+        std::vector<Command> commands;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            commands.swap(_commands);
+            _has_commands = false;
+        }
+        for (size_t i = 0; i < commands.size(); i++) commands[i](_state);
+    }
+};
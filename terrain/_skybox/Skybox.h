@@ -1,4 +1,7 @@
+#pragma once
 #include "icg_common.h"
+#include "../_texture/TextureCache.h"
+#include "../_render/GLState.h"
 
 namespace {
 
@@ -56,10 +59,21 @@ protected:
     GLuint _tex; ///< Texture ID
     mat4   _M;   ///< model matrix
 
-    vector<const GLchar*> faces;
-    GLuint cubemapTexture;
+    GLuint cubemapTexture; ///< owned by the TextureCache
 
 public:
+    /// Cube map faces in the order +x, -x, +y, -y, +z, -z
+    static std::vector<std::string> face_paths() {
+        std::vector<std::string> faces;
+        faces.push_back("_skybox/rt.tga");
+        faces.push_back("_skybox/lt.tga");
+        faces.push_back("_skybox/up.tga");
+        faces.push_back("_skybox/dn.tga");
+        faces.push_back("_skybox/bk.tga");
+        faces.push_back("_skybox/ft.tga");
+        return faces;
+    }
+
     void init(){
         ///--- Compile the shaders
         _pid = opengp::load_shaders("_skybox/skybox_vshader.glsl", "_skybox/skybox_fshader.glsl");
@@ -93,14 +107,8 @@ public:
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
         glBindVertexArray(0);
 
-        //Assign the names of the textures and load them
-        faces.push_back("_skybox/rt.tga");
-        faces.push_back("_skybox/lt.tga");
-        faces.push_back("_skybox/up.tga");
-        faces.push_back("_skybox/dn.tga");
-        faces.push_back("_skybox/bk.tga");
-        faces.push_back("_skybox/ft.tga");
-        cubemapTexture = loadCubemap(faces);
+        ///--- Faces are decoded by the AssetLoader, prefetched by the caller or now
+        cubemapTexture = TextureCache::instance().load_cubemap(face_paths());
 
 
         ///--- to avoid the current object being polluted
@@ -117,47 +125,16 @@ public:
         this->_M = _M.matrix();
     }
 
-    //Function to load the cubemap
-    GLuint loadCubemap(vector<const GLchar*> faces) {
-
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
-
-        int width, height;
-
-        GLFWimage image;
-
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for (GLuint i = 0; i < faces.size(); i++) {
-            if (glfwReadImage(faces[i], &image, GLFW_ORIGIN_UL_BIT)) {
-                glTexImage2D(
-                        GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                        image.Format, image.Width, image.Height, 0, image.Format, GL_UNSIGNED_BYTE,
-                        image.Data
-                        );
-            }
-        }
-
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-        return textureID;
-    }
-
     void cleanup(){
         /// TODO cleanup
     }
 
+    /// Drawn after the opaque geometry at the far plane, with depth test
+    /// GL_LEQUAL and writes off, so covered pixels are rejected early
     void draw(const mat4& V, const mat4& P){
-
-        glDepthMask(GL_FALSE);
-        glUseProgram(_pid);
-        glBindVertexArray(_vao);
+        GLState& state = GLState::instance();
+        state.use_program(_pid);
+        state.bind_vertex_array(_vao);
 
             mat4 skyV = V;
             skyV(0,3) = 0; skyV(1,3) = 0; skyV(2,3) = 0;
@@ -167,12 +144,8 @@ public:
             GLuint MVP_id = glGetUniformLocation(_pid, "MVP");
             glUniformMatrix4fv(MVP_id, 1, GL_FALSE, MVP.data());
 
-            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            state.bind_texture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            state.bind_sampler(0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 36);
-
-
-        glBindVertexArray(0);
-        glDepthMask(GL_TRUE);
-        glUseProgram(0);
     }
 };
@@ -7,6 +7,6 @@ out vec3 texCoords;
 
 
 void main(){
-    gl_Position =  MVP * vec4(vpoint,1); ///< still
+    gl_Position = (MVP * vec4(vpoint,1)).xyww; ///< still, on the far plane
     texCoords = vpoint;
 }
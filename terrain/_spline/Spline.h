@@ -0,0 +1,188 @@
+#pragma once
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "icg_common.h"
+
+/// Piecewise cubic path sampled by arc length. Cubic Bezier segments are
+/// kept as they are, Catmull-Rom splines (uniform, centripetal or chordal)
+/// are converted to them. Each segment is subdivided until its hull is flat
+/// within a tolerance, so near-straight segments cost a few vertices and
+/// tight bends many. The cumulative length at each vertex is a sorted
+/// table, and a sample is found by binary search and then evaluated on the
+/// segment's cubic. Segments are appended without reprocessing the ones
+/// before them.
+class Spline {
+public:
+    /// Catmull-Rom knot spacing: |P_i+1 - P_i|^alpha
+    static constexpr float UNIFORM = 0.0f;
+    static constexpr float CENTRIPETAL = 0.5f;
+    static constexpr float CHORDAL = 1.0f;
+
+protected:
+    struct Segment {
+        vec3 p[4];              ///< Bezier control points
+    };
+
+    /// A vertex of the subdivision: where it lies on which segment
+    struct Knot {
+        int segment;
+        float u;                ///< parameter of the segment
+    };
+
+    float _tolerance;           ///< of the hull flatness, in world units
+    int _max_depth;             ///< of the subdivision of a segment
+    std::vector<Segment> _segments;
+    std::vector<vec3> _vertices;    ///< of the subdivided path
+    std::vector<float> _lengths;    ///< cumulative arc length at each vertex
+    std::vector<Knot> _knots;
+
+public:
+    Spline(float tolerance = 1e-4f, int max_depth = 16) : _tolerance(tolerance), _max_depth(max_depth) {}
+
+    void clear() {
+        _segments.clear();
+        _vertices.clear();
+        _lengths.clear();
+        _knots.clear();
+    }
+
+    /// Appends a cubic Bezier segment from p1 to p4
+    void add_bezier(const vec3& p1, const vec3& p2, const vec3& p3, const vec3& p4) {
+        Segment segment = {{ p1, p2, p3, p4 }};
+        _segments.push_back(segment);
+        tessellate(_segments.size() - 1);
+    }
+
+    /// Appends a Bezier segment continuing from the end of the path
+    void add_bezier(const vec3& p2, const vec3& p3, const vec3& p4) {
+        assert(!_segments.empty());
+        add_bezier(_segments.back().p[3], p2, p3, p4);
+    }
+
+    /// Replaces the path by a Catmull-Rom spline through points, with knot
+    /// spacing alpha (UNIFORM, CENTRIPETAL or CHORDAL); the end tangents
+    /// mirror the neighbouring points
+    void set_catmull_rom(const std::vector<vec3>& points, float alpha = CENTRIPETAL) {
+        clear();
+        size_t n = points.size();
+        if (n < 2) return;
+        for (size_t i = 0; i + 1 < n; i++) {
+            vec3 p1 = points[i], p2 = points[i + 1];
+            vec3 p0 = i > 0 ? points[i - 1] : vec3(2.0f * p1 - p2);
+            vec3 p3 = i + 2 < n ? points[i + 2] : vec3(2.0f * p2 - p1);
+            add_catmull_rom(p0, p1, p2, p3, alpha);
+        }
+    }
+
+    /// Appends the Catmull-Rom segment from p1 to p2
+    void add_catmull_rom(const vec3& p0, const vec3& p1, const vec3& p2, const vec3& p3, float alpha = CENTRIPETAL) {
+        ///--- Knot intervals, kept away from 0 for repeated points
+        float d01 = std::max(std::pow((p1 - p0).norm(), alpha), 1e-6f);
+        float d12 = std::max(std::pow((p2 - p1).norm(), alpha), 1e-6f);
+        float d23 = std::max(std::pow((p3 - p2).norm(), alpha), 1e-6f);
+        ///--- Tangents at p1 and p2 of the interval [0, d12]
+        vec3 m1 = d12 * ((p1 - p0) / d01 - (p2 - p0) / (d01 + d12) + (p2 - p1) / d12);
+        vec3 m2 = d12 * ((p2 - p1) / d12 - (p3 - p1) / (d12 + d23) + (p3 - p2) / d23);
+        add_bezier(p1, p1 + m1 / 3.0f, p2 - m2 / 3.0f, p2);
+    }
+
+    bool empty() const { return _segments.empty(); }
+    int segments() const { return _segments.size(); }
+    float length() const { return _lengths.empty() ? 0.0f : _lengths.back(); }
+
+    /// Vertices of the subdivision, a polyline within the tolerance
+    const std::vector<vec3>& vertices() const { return _vertices; }
+
+    /// Point at arc length s, clamped to the path
+    vec3 point_at_length(float s) const {
+        if (_lengths.empty()) return vec3::Zero();
+        return evaluate(locate(s, 0));
+    }
+
+    /// Point at the fraction t in [0, 1] of the length
+    vec3 point(float t) const {
+        return point_at_length(t * length());
+    }
+
+    /// Unit tangent at the fraction t of the length
+    vec3 tangent(float t) const {
+        if (_lengths.empty()) return vec3::Zero();
+        Knot knot = locate(t * length(), 0);
+        const vec3* p = _segments[knot.segment].p;
+        float u = knot.u, v = 1.0f - u;
+        vec3 d = 3.0f * (v * v * (p[1] - p[0]) + 2.0f * u * v * (p[2] - p[1]) + u * u * (p[3] - p[2]));
+        float norm = d.norm();
+        return norm > 0.0f ? vec3(d / norm) : vec3(p[3] - p[0]).normalized();
+    }
+
+    /// Points at the fractions t[0..n) of the length. Runs of increasing t,
+    /// as of agents spread along the path, narrow each search to the table
+    /// past the previous sample.
+    void points(const float* t, vec3* out, size_t n) const {
+        if (_lengths.empty()) return;
+        float total = length();
+        size_t first = 0;
+        for (size_t i = 0; i < n; i++) {
+            float s = t[i] * total;
+            if (i > 0 && t[i] < t[i - 1]) first = 0;
+            out[i] = evaluate(locate(s, first, &first));
+        }
+    }
+
+protected:
+    /// Segment and parameter at arc length s, searching the table from
+    /// first on; found is set to where the next, longer, search may start
+    Knot locate(float s, size_t first, size_t* found = NULL) const {
+        if (s <= 0.0f) return _knots.front();
+        if (s >= _lengths.back()) return _knots.back();
+        size_t i = std::upper_bound(_lengths.begin() + first, _lengths.end(), s) - _lengths.begin();
+        if (found) *found = i - 1;
+        ///--- _lengths[i - 1] <= s < _lengths[i], both on one segment
+        const Knot& a = _knots[i - 1];
+        const Knot& b = _knots[i];
+        float ratio = (s - _lengths[i - 1]) / (_lengths[i] - _lengths[i - 1]);
+        Knot knot = { a.segment, a.u + ratio * (b.u - a.u) };
+        return knot;
+    }
+
+    vec3 evaluate(const Knot& knot) const {
+        const vec3* p = _segments[knot.segment].p;
+        float u = knot.u, v = 1.0f - u;
+        return v * v * v * p[0] + 3.0f * v * v * u * p[1] + 3.0f * v * u * u * p[2] + u * u * u * p[3];
+    }
+
+    /// Appends the vertices of a segment, its start repeating the end of
+    /// the one before at the same length
+    void tessellate(int index) {
+        const Segment& segment = _segments[index];
+        push(index, 0.0f, segment.p[0]);
+        subdivide(index, segment.p[0], segment.p[1], segment.p[2], segment.p[3], 0.0f, 1.0f, 0);
+    }
+
+    /// de Casteljau at u = 1/2 until the inner control points lie within the
+    /// tolerance of the thirds of the chord
+    void subdivide(int index, const vec3& p1, const vec3& p2, const vec3& p3, const vec3& p4,
+                   float u0, float u1, int depth) {
+        float deviation = std::max((p2 - (2.0f * p1 + p4) / 3.0f).norm(), (p3 - (p1 + 2.0f * p4) / 3.0f).norm());
+        if (deviation <= _tolerance || depth >= _max_depth) {
+            push(index, u1, p4);
+            return;
+        }
+        vec3 p12 = 0.5f * (p1 + p2), p23 = 0.5f * (p2 + p3), p34 = 0.5f * (p3 + p4);
+        vec3 p123 = 0.5f * (p12 + p23), p234 = 0.5f * (p23 + p34);
+        vec3 middle = 0.5f * (p123 + p234);
+        float u = 0.5f * (u0 + u1);
+        subdivide(index, p1, p12, p123, middle, u0, u, depth + 1);
+        subdivide(index, middle, p234, p34, p4, u, u1, depth + 1);
+    }
+
+    void push(int segment, float u, const vec3& vertex) {
+        float length = _vertices.empty() ? 0.0f : _lengths.back();
+        if (!_vertices.empty() && u > 0.0f) length += (vertex - _vertices.back()).norm();
+        Knot knot = { segment, u };
+        _vertices.push_back(vertex);
+        _lengths.push_back(length);
+        _knots.push_back(knot);
+    }
+};
@@ -0,0 +1,354 @@
+#pragma once
+#include "icg_common.h"
+#include <list>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include "../_noise/NoiseEngine.h"
+#include "../_grid/Grid.h"
+
+/// Unbounded terrain made of square tiles generated around the camera.
+///
+/// Tile (tx, tz) holds lattice samples [tx*N - 1, tx*N + N + 1] of the
+/// noise (N cells plus a one sample apron for the normals). Neighbouring
+/// tiles evaluate their shared samples at identical coordinates, and the
+/// vertex shader derives positions from the integer lattice index, so
+/// seams match exactly. Tiles are generated by background threads, uploaded
+/// on the render thread under a per-frame budget and kept in an LRU cache
+/// bounded by a memory budget.
+class TerrainStreamer {
+protected:
+    typedef long long TileKey;
+
+    struct Tile {
+        int tx, tz;
+        GLuint tex;                     ///< (N+3)^2 R32F heights
+        std::vector<float> heights;     ///< CPU copy for height queries
+        std::list<TileKey>::iterator lru;
+    };
+
+    struct Request {
+        int tx, tz;
+        float distance;
+    };
+
+    struct Result {
+        int tx, tz;
+        std::vector<float> heights;
+    };
+
+    GLuint _vao;            ///< vertex array object
+    GLuint _vbo_position;   ///< memory buffer for positions
+    GLuint _vbo_index;      ///< memory buffer for indices
+    GLuint _pid;            ///< GLSL shader program ID
+    GLuint _num_indices;    ///< number of indices of one tile
+    Grid* _materials;       ///< provides the material textures
+
+    NoiseEngine _engine;
+    NoiseParams _params;
+    int _samples;           ///< cells per tile edge (N)
+    double _step;           ///< lattice spacing in uv units
+    int _radius;            ///< tiles drawn around the camera tile
+    int _uploads_per_frame; ///< uploads allowed per update()
+    size_t _budget;         ///< bytes of resident tiles (GPU + CPU copy)
+
+    ///--- Resident tiles, most recently used first
+    std::unordered_map<TileKey, Tile> _tiles;
+    std::list<TileKey> _lru;
+    size_t _resident_bytes;
+
+    ///--- Shared with the generator threads
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Request> _requests;          ///< closest first
+    std::unordered_set<TileKey> _pending;   ///< requested or being generated
+    std::deque<Result> _results;
+    bool _stop;
+
+    int _cam_tx, _cam_tz;
+
+public:
+    TerrainStreamer() : _resident_bytes(0), _stop(false), _cam_tx(0), _cam_tz(0) {}
+
+    ~TerrainStreamer() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (size_t i = 0; i < _threads.size(); i++) {
+            _threads[i].join();
+        }
+    }
+
+    /// @param samples cells per tile edge
+    /// @param tile_size world size of a tile (the original map is 2 wide)
+    /// @param budget_mb memory budget of the resident tiles
+    /// @param num_threads background generator threads
+    void init(Grid* materials, const NoiseParams& params, int samples = 128, float tile_size = 0.5f,
+              int radius = 3, size_t budget_mb = 64, int num_threads = 1) {
+        _materials = materials;
+        _params = params;
+        _samples = samples;
+        _step = 0.5 * tile_size / samples;
+        _radius = radius;
+        _uploads_per_frame = 2;
+        _budget = budget_mb << 20;
+
+        _pid = opengp::load_shaders("_stream/tile_vshader.glsl", "_stream/tile_fshader.glsl");
+        if(!_pid) exit(EXIT_FAILURE);
+        glUseProgram(_pid);
+
+        glGenVertexArrays(1, &_vao);
+        glBindVertexArray(_vao);
+
+        // One (N+1)^2 strip mesh over [0,1]^2 shared by every tile
+        {
+            std::vector<GLfloat> vertices;
+            std::vector<GLuint> indices;
+            int dim = samples + 1;
+            vertices.reserve(2 * dim * dim);
+            indices.reserve((2 * dim + 1) * (dim - 1));
+            for (int y = 0; y < dim; y++) {
+                for (int x = 0; x < dim; x++) {
+                    vertices.push_back(x / float(samples));
+                    vertices.push_back(y / float(samples));
+                }
+            }
+            GLuint primitive_restart_idx = 0xffffffff;
+            for (int y = 0; y < dim - 1; ++y) {
+                for (int x = 0; x < dim; ++x) {
+                    indices.push_back(y * dim + x);
+                    indices.push_back((y + 1) * dim + x);
+                }
+                indices.push_back(primitive_restart_idx);
+            }
+            _num_indices = indices.size();
+
+            glGenBuffers(1, &_vbo_position);
+            glBindBuffer(GL_ARRAY_BUFFER, _vbo_position);
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+
+            glGenBuffers(1, &_vbo_index);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _vbo_index);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+            GLuint loc_position = glGetAttribLocation(_pid, "position");
+            glEnableVertexAttribArray(loc_position);
+            glVertexAttribPointer(loc_position, 2, GL_FLOAT, DONT_NORMALIZE, ZERO_STRIDE, ZERO_BUFFER_OFFSET);
+        }
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+
+        for (int i = 0; i < std::max(1, num_threads); i++) {
+            _threads.push_back(std::thread(&TerrainStreamer::generator_loop, this));
+        }
+    }
+
+    void cleanup() {
+        for (std::unordered_map<TileKey, Tile>::iterator it = _tiles.begin(); it != _tiles.end(); ++it) {
+            glDeleteTextures(1, &it->second.tex);
+        }
+        _tiles.clear();
+        _lru.clear();
+        _resident_bytes = 0;
+        glDeleteBuffers(1, &_vbo_position);
+        glDeleteBuffers(1, &_vbo_index);
+        glDeleteVertexArrays(1, &_vao);
+        glDeleteProgram(_pid);
+    }
+
+    /// Requests the tiles around the camera, uploads finished ones and
+    /// evicts the least recently used tiles above the memory budget
+    void update(const vec3& cam_pos) {
+        _cam_tx = tile_coord(cam_pos.x());
+        _cam_tz = tile_coord(cam_pos.z());
+
+        ///--- Touch resident tiles in range, request the missing ones.
+        /// One ring beyond the drawn radius is prefetched.
+        std::vector<Request> missing;
+        int prefetch = _radius + 1;
+        for (int dz = -prefetch; dz <= prefetch; dz++) {
+            for (int dx = -prefetch; dx <= prefetch; dx++) {
+                Request r = { _cam_tx + dx, _cam_tz + dz, distance_to(_cam_tx + dx, _cam_tz + dz, cam_pos) };
+                std::unordered_map<TileKey, Tile>::iterator it = _tiles.find(key(r.tx, r.tz));
+                if (it != _tiles.end()) {
+                    _lru.splice(_lru.begin(), _lru, it->second.lru);
+                } else {
+                    missing.push_back(r);
+                }
+            }
+        }
+        std::sort(missing.begin(), missing.end(),
+                  [](const Request& a, const Request& b) { return a.distance < b.distance; });
+
+        std::deque<Result> results;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ///--- Requests that fell out of range are dropped
+            for (size_t i = 0; i < _requests.size(); i++) {
+                _pending.erase(key(_requests[i].tx, _requests[i].tz));
+            }
+            _requests.clear();
+            for (size_t i = 0; i < missing.size(); i++) {
+                if (_pending.insert(key(missing[i].tx, missing[i].tz)).second) {
+                    _requests.push_back(missing[i]);
+                }
+            }
+            for (int i = 0; i < _uploads_per_frame && !_results.empty(); i++) {
+                results.push_back(Result());
+                std::swap(results.back(), _results.front());
+                _results.pop_front();
+            }
+        }
+        _cv.notify_all();
+
+        for (size_t i = 0; i < results.size(); i++) {
+            upload(results[i]);
+        }
+        evict(prefetch);
+    }
+
+    void draw(const mat4& VP) {
+        glUseProgram(_pid);
+        glBindVertexArray(_vao);
+
+        glPrimitiveRestartIndex(0xffffffff);
+        glEnable(GL_PRIMITIVE_RESTART);
+
+        GLuint tex_id = glGetUniformLocation(_pid, "tex");
+        glUniform1i(tex_id, 0);
+        _materials->bind_materials(_pid);
+
+        GLuint MVP_id = glGetUniformLocation(_pid, "mvp");
+        glUniformMatrix4fv(MVP_id, 1, GL_FALSE, VP.data());
+        GLuint spacing_id = glGetUniformLocation(_pid, "sample_spacing");
+        glUniform1f(spacing_id, float(2.0 * _step));
+        GLuint first_sample_id = glGetUniformLocation(_pid, "first_sample");
+
+        for (int dz = -_radius; dz <= _radius; dz++) {
+            for (int dx = -_radius; dx <= _radius; dx++) {
+                std::unordered_map<TileKey, Tile>::iterator it = _tiles.find(key(_cam_tx + dx, _cam_tz + dz));
+                if (it == _tiles.end()) continue;
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, it->second.tex);
+                glUniform2i(first_sample_id, it->second.tx * _samples, it->second.tz * _samples);
+                glDrawElements(GL_TRIANGLE_STRIP, _num_indices, GL_UNSIGNED_INT, 0);
+            }
+        }
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+    /// Height at a world position, false if its tile is not resident
+    bool height_at(float x, float z, float& height) const {
+        int tx = tile_coord(x);
+        int tz = tile_coord(z);
+        std::unordered_map<TileKey, Tile>::const_iterator it = _tiles.find(key(tx, tz));
+        if (it == _tiles.end()) return false;
+        double scale = 1.0 / (2.0 * _step);
+        int i = std::min(_samples, std::max(0, (int) std::floor((x + 1.0) * scale + 0.5) - tx * _samples));
+        int j = std::min(_samples, std::max(0, (int) std::floor((z + 1.0) * scale + 0.5) - tz * _samples));
+        height = it->second.heights[(j + 1) * (_samples + 3) + i + 1];
+        return true;
+    }
+
+    size_t resident_tiles() const { return _tiles.size(); }
+    size_t resident_bytes() const { return _resident_bytes; }
+
+protected:
+    /// Tile coordinates go negative: shifted as unsigned, which is defined
+    static TileKey key(int tx, int tz) {
+        return (TileKey) ((unsigned long long) (unsigned int) tx << 32 | (unsigned int) tz);
+    }
+
+    /// index of the tile containing a world coordinate
+    int tile_coord(float world) const {
+        return (int) std::floor((world + 1.0) / (2.0 * _step * _samples));
+    }
+
+    float distance_to(int tx, int tz, const vec3& cam_pos) const {
+        double size = 2.0 * _step * _samples;
+        float cx = float((tx + 0.5) * size - 1.0) - cam_pos.x();
+        float cz = float((tz + 0.5) * size - 1.0) - cam_pos.z();
+        return cx * cx + cz * cz;
+    }
+
+    size_t tile_bytes() const {
+        return 2 * (size_t)(_samples + 3) * (_samples + 3) * sizeof(float);
+    }
+
+    void upload(Result& result) {
+        Tile tile;
+        tile.tx = result.tx;
+        tile.tz = result.tz;
+        tile.heights.swap(result.heights);
+        int dim = _samples + 3;
+
+        glGenTextures(1, &tile.tex);
+        glBindTexture(GL_TEXTURE_2D, tile.tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, dim, dim, 0, GL_RED, GL_FLOAT, &tile.heights[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        TileKey k = key(tile.tx, tile.tz);
+        _lru.push_front(k);
+        tile.lru = _lru.begin();
+        _tiles[k] = std::move(tile);
+        _resident_bytes += tile_bytes();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.erase(k);
+    }
+
+    /// Drops least recently used tiles until under budget, never evicting
+    /// tiles within range of the camera
+    void evict(int keep_radius) {
+        while (_resident_bytes > _budget && !_lru.empty()) {
+            std::unordered_map<TileKey, Tile>::iterator it = _tiles.find(_lru.back());
+            if (std::abs(it->second.tx - _cam_tx) <= keep_radius &&
+                std::abs(it->second.tz - _cam_tz) <= keep_radius) {
+                break;
+            }
+            glDeleteTextures(1, &it->second.tex);
+            _lru.pop_back();
+            _tiles.erase(it);
+            _resident_bytes -= tile_bytes();
+        }
+    }
+
+    void generator_loop() {
+        int dim = _samples + 3;
+        for (;;) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _stop || !_requests.empty(); });
+                if (_stop) return;
+                request = _requests.front();
+                _requests.pop_front();
+            }
+
+            Result result;
+            result.tx = request.tx;
+            result.tz = request.tz;
+            result.heights.resize(dim * dim);
+            _engine.fill_lattice(&result.heights[0], dim,
+                                 (long long) request.tx * _samples - 1, (long long) request.tz * _samples - 1,
+                                 dim, dim, _step, _params);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _results.push_back(Result());
+            std::swap(_results.back(), result);
+        }
+    }
+};
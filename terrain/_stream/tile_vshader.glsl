@@ -0,0 +1,37 @@
+#version 330 core
+uniform mat4 mvp;
+uniform sampler2D tex;          ///< tile heights with a one sample apron
+uniform ivec2 first_sample;     ///< lattice index of the tile's first sample
+uniform float sample_spacing;   ///< world distance between two samples
+
+in vec2 position;
+out vec3 normal;
+out vec2 uv;
+out float height;
+out float gl_ClipDistance[1];
+
+float height_at(ivec2 texel) {
+    return texelFetch(tex, texel, 0).x;
+}
+
+void main() {
+    int n = textureSize(tex, 0).x - 3;
+    ivec2 k = ivec2(round(position * n)) + ivec2(1);
+
+    // world position from the integer lattice index, so the edge vertices
+    // of two neighbouring tiles are bit-identical
+    vec2 world = vec2(first_sample + k - ivec2(1)) * sample_spacing - vec2(1.0);
+    height = height_at(k);
+
+    // same central differences as grid_vshader, the apron holds the
+    // neighbouring tiles' samples so normals match across seams too
+    vec3 x_gradient = normalize(vec3(2.0 * sample_spacing, height_at(k + ivec2(1, 0)) - height_at(k - ivec2(1, 0)), 0.0));
+    vec3 y_gradient = normalize(vec3(0.0, height_at(k + ivec2(0, 1)) - height_at(k - ivec2(0, 1)), 2.0 * sample_spacing));
+    normal = cross(y_gradient, x_gradient);
+
+    // material coordinates keep tiling across the whole world
+    uv = (world + vec2(1.0)) * 0.5;
+
+    gl_Position = mvp * vec4(world.x, height, world.y, 1.0);
+    gl_ClipDistance[0] = height;
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <condition_variable>
+#include "icg_common.h"
+#include "TgaDecoder.h"
+#include "../_threads/ThreadPool.h"
+
+/// Decodes images on the worker threads of a pool while the GL thread
+/// keeps compiling shaders and building meshes. prefetch() reads the
+/// header, maps a pixel buffer object of the right size and queues the
+/// decode, which writes straight into the mapped buffer; wait() unmaps it,
+/// so the texture upload that follows is a copy on the GL side only.
+///
+///     loader.prefetch(path);             // as early as possible
+///     ...                                 // other GL work
+///     const AssetLoader::Image& image = loader.wait(path);
+///     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.pbo);
+///     glTexImage2D(..., image.info.format, GL_UNSIGNED_BYTE, image.pixels);
+///     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+///     loader.release(path);
+///
+/// Without a pool, or when a buffer cannot be mapped, images are decoded
+/// on the calling thread or into client memory instead.
+class AssetLoader {
+public:
+    /// A decoded image, ready for upload
+    struct Image {
+        TgaInfo info;
+        GLuint pbo;                 ///< bind to GL_PIXEL_UNPACK_BUFFER, 0 for client memory
+        const void* pixels;         ///< offset in pbo, or client memory
+        unsigned long long hash;    ///< FNV-1a of the file content
+    };
+
+protected:
+    enum State { DECODING, DECODED, READY, RELEASED };
+
+    struct Asset {
+        std::string path;
+        bool top_row_first;
+        Image image;
+        unsigned char* target;              ///< mapped pbo or client memory the decode writes to
+        std::vector<unsigned char> memory;  ///< client memory fallback
+        State state;
+        bool ok;
+        size_t file_bytes;
+        ///--- Seconds since the loader was created
+        double queued, decode_start, decode_end, ready, released;
+        double blocked;                     ///< seconds the GL thread waited for the decode
+    };
+
+    ThreadPool* _pool;
+    std::map<std::string, Asset*> _assets;  ///< by path and orientation
+    std::vector<Asset*> _order;             ///< in request order, for print()
+    mutable std::mutex _mutex;      ///< guards Asset::state and ok, written by the workers
+    std::condition_variable _decoded;
+    std::chrono::steady_clock::time_point _start;
+
+    AssetLoader() : _pool(NULL), _start(std::chrono::steady_clock::now()) {}
+
+public:
+    /// Loader shared by every object of the application
+    static AssetLoader& instance() {
+        static AssetLoader loader;
+        return loader;
+    }
+
+    /// Pool to decode on, none decodes on the calling thread
+    void set_pool(ThreadPool* pool) {
+        _pool = pool;
+    }
+
+    /// Starts decoding an image unless it is already decoded or decoding
+    void prefetch(const std::string& path, bool top_row_first = false) {
+        Asset* asset = find(path, top_row_first);
+        if (asset && state(asset) != RELEASED) return;
+        if (!asset) {
+            asset = new Asset();
+            asset->path = path;
+            asset->top_row_first = top_row_first;
+            _assets[key(path, top_row_first)] = asset;
+            _order.push_back(asset);
+        }
+        start(asset);
+    }
+
+    void prefetch(const std::vector<std::string>& paths, bool top_row_first = false) {
+        for (size_t i = 0; i < paths.size(); i++) prefetch(paths[i], top_row_first);
+    }
+
+    /// Blocks until the image is decoded, prefetching it if needed.
+    /// Must be called from the GL thread. Exits if the file is not a
+    /// readable TGA image.
+    const Image& wait(const std::string& path, bool top_row_first = false) {
+        prefetch(path, top_row_first);
+        Asset* asset = find(path, top_row_first);
+        if (state(asset) == READY) {
+            asset->ready = now();
+            return asset->image;
+        }
+
+        double before = now();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (asset->state == DECODING) _decoded.wait(lock);
+        }
+        asset->blocked += now() - before;
+        if (asset->image.pbo) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->image.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        if (!asset->ok) {
+            std::cerr << "!!!ERROR: cannot decode texture " << path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        asset->state = READY;
+        asset->ready = now();
+        return asset->image;
+    }
+
+    /// Frees the pixels once uploaded; the timings are kept for print()
+    void release(const std::string& path, bool top_row_first = false) {
+        Asset* asset = find(path, top_row_first);
+        if (!asset || state(asset) == RELEASED) return;
+        if (state(asset) != READY) wait(path, top_row_first);
+        if (asset->image.pbo) glDeleteBuffers(1, &asset->image.pbo);
+        asset->image.pbo = 0;
+        std::vector<unsigned char>().swap(asset->memory);
+        asset->state = RELEASED;
+        asset->released = now();
+    }
+
+    /// Per asset: queue, decode (on a worker), blocked (GL thread waiting)
+    /// and upload (last wait to release) times, in ms
+    void print(std::ostream& out) const {
+        double decode = 0.0, blocked = 0.0;
+        for (size_t i = 0; i < _order.size(); i++) {
+            const Asset* a = _order[i];
+            if (state(a) != RELEASED) continue;
+            char line[256];
+            snprintf(line, sizeof(line), "  %-28s %4dx%-4d %6.0f KB  queue %6.1f  decode %6.1f  blocked %6.1f  upload %6.1f ms",
+                     a->path.c_str(), a->image.info.width, a->image.info.height, a->file_bytes / 1024.0,
+                     1000.0 * (a->decode_start - a->queued), 1000.0 * (a->decode_end - a->decode_start),
+                     1000.0 * a->blocked, 1000.0 * (a->released - a->ready));
+            out << line << std::endl;
+            decode += a->decode_end - a->decode_start;
+            blocked += a->blocked;
+        }
+        out << "Assets: " << _order.size() << " images, " << 1000.0 * decode << " ms decoding on "
+            << (_pool ? _pool->size() : 0) << " workers, GL thread blocked " << 1000.0 * blocked << " ms" << std::endl;
+    }
+
+protected:
+    static std::string key(const std::string& path, bool top_row_first) {
+        return top_row_first ? path + "|top" : path;
+    }
+
+    Asset* find(const std::string& path, bool top_row_first) {
+        std::map<std::string, Asset*>::iterator it = _assets.find(key(path, top_row_first));
+        return it == _assets.end() ? NULL : it->second;
+    }
+
+    /// A worker may be setting it
+    State state(const Asset* asset) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return asset->state;
+    }
+
+    double now() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+    /// Reads the header and sets up the decode target on the GL thread,
+    /// then decodes on the pool
+    void start(Asset* asset) {
+        asset->state = DECODING;
+        asset->ok = false;
+        asset->blocked = 0.0;
+        asset->queued = now();
+        asset->image.pbo = 0;
+        asset->image.pixels = NULL;
+        asset->target = NULL;
+
+        unsigned char header[TgaDecoder::HEADER_SIZE];
+        FILE* file = fopen(asset->path.c_str(), "rb");
+        size_t read = file ? fread(header, 1, sizeof(header), file) : 0;
+        if (file) fclose(file);
+        if (!TgaDecoder::header(header, read, asset->image.info)) {
+            ///--- Let wait() report the error
+            asset->decode_start = asset->decode_end = asset->queued;
+            asset->file_bytes = 0;
+            asset->state = DECODED;
+            return;
+        }
+
+        size_t bytes = asset->image.info.bytes();
+        glGenBuffers(1, &asset->image.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->image.pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        asset->target = (unsigned char*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!asset->target) {
+            glDeleteBuffers(1, &asset->image.pbo);
+            asset->image.pbo = 0;
+            asset->memory.resize(bytes);
+            asset->target = &asset->memory[0];
+            asset->image.pixels = asset->target;
+        }
+
+        if (_pool) {
+            AssetLoader* self = this;
+            _pool->submit([self, asset](int) { self->decode(asset); });
+        } else {
+            decode(asset);
+        }
+    }
+
+    /// Reads, hashes and decodes the file into the target, on any thread
+    void decode(Asset* asset) {
+        asset->decode_start = now();
+        std::vector<unsigned char> bytes;
+        FILE* file = fopen(asset->path.c_str(), "rb");
+        if (file) {
+            fseek(file, 0, SEEK_END);
+            bytes.resize(ftell(file));
+            fseek(file, 0, SEEK_SET);
+            bytes.resize(bytes.empty() ? 0 : fread(&bytes[0], 1, bytes.size(), file));
+            fclose(file);
+        }
+        unsigned long long hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < bytes.size(); i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        bool ok = !bytes.empty() && TgaDecoder::decode(&bytes[0], bytes.size(), asset->image.info,
+                                                       asset->target, asset->top_row_first);
+        asset->image.hash = hash;
+        asset->file_bytes = bytes.size();
+        asset->decode_end = now();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            asset->ok = ok;
+            asset->state = DECODED;
+        }
+        _decoded.notify_all();
+    }
+};
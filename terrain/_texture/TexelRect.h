@@ -0,0 +1,33 @@
+#pragma once
+#include <algorithm>
+
+/// Texel rectangle [x, x + width) x [y, y + height), empty if width or height is 0
+struct TexelRect {
+    int x, y, width, height;
+
+    TexelRect() : x(0), y(0), width(0), height(0) {}
+    TexelRect(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {}
+
+    bool empty() const { return width <= 0 || height <= 0; }
+
+    /// Smallest rectangle holding both
+    TexelRect merge(const TexelRect& o) const {
+        if (empty()) return o;
+        if (o.empty()) return *this;
+        int x0 = std::min(x, o.x), y0 = std::min(y, o.y);
+        int x1 = std::max(x + width, o.x + o.width), y1 = std::max(y + height, o.y + o.height);
+        return TexelRect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    /// Part inside [0, w) x [0, h)
+    TexelRect clip(int w, int h) const {
+        int x0 = std::max(x, 0), y0 = std::max(y, 0);
+        int x1 = std::min(x + width, w), y1 = std::min(y + height, h);
+        return x1 > x0 && y1 > y0 ? TexelRect(x0, y0, x1 - x0, y1 - y0) : TexelRect();
+    }
+
+    /// n more texels on every side
+    TexelRect grow(int n) const {
+        return TexelRect(x - n, y - n, width + 2 * n, height + 2 * n);
+    }
+};
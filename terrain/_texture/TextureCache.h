@@ -0,0 +1,204 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "icg_common.h"
+#include "AssetLoader.h"
+
+/// Content-addressed cache of GL textures. Files are keyed by a hash of
+/// their bytes, so the same image is decoded and uploaded once however
+/// many objects (or paths) ask for it, and every caller shares the handle.
+/// Textures are mipmapped with trilinear filtering; sets of same-sized
+/// images can be packed into one GL_TEXTURE_2D_ARRAY. Images come from
+/// the AssetLoader: prefetch them there to decode them in the background.
+class TextureCache {
+public:
+    typedef unsigned long long Key;
+
+protected:
+    struct Entry {
+        GLuint texture;
+        size_t bytes;       ///< GPU memory estimate, mipmaps included
+    };
+
+    std::map<std::string, Key> _paths;  ///< file -> hash of its content
+    std::map<Key, Entry> _textures;     ///< content (or set of contents) -> texture
+    size_t _loads;                      ///< images decoded
+    size_t _hits;                       ///< requests served from the cache
+
+    TextureCache() : _loads(0), _hits(0) {}
+
+public:
+    /// Cache shared by every object of the application
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    /// Repeating, mipmapped 2D texture of an image file
+    GLuint load(const std::string& path) {
+        Key key = content_key(path);
+        std::map<Key, Entry>::iterator it = _textures.find(key);
+        if (it != _textures.end()) {
+            _hits++;
+            AssetLoader::instance().release(path);
+            return it->second.texture;
+        }
+
+        const AssetLoader::Image& image = read_image(path);
+        Entry entry;
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.pbo);
+        glTexImage2D(GL_TEXTURE_2D, 0, image.info.internal_format, image.info.width, image.info.height, 0,
+                     image.info.format, GL_UNSIGNED_BYTE, image.pixels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        set_parameters(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        entry.bytes = mipmapped_bytes(image.info, 1);
+        AssetLoader::instance().release(path);
+
+        _textures[key] = entry;
+        return entry.texture;
+    }
+
+    /// Repeating, mipmapped texture array with one layer per file, in
+    /// order. All images must have the same size and format.
+    GLuint load_array(const std::vector<std::string>& paths) {
+        ///--- The array is keyed by the ordered contents of its layers
+        Key key = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < paths.size(); i++) {
+            key = (key ^ content_key(paths[i])) * 0x100000001b3ull;
+        }
+        std::map<Key, Entry>::iterator it = _textures.find(key);
+        if (it != _textures.end()) {
+            _hits++;
+            for (size_t i = 0; i < paths.size(); i++) AssetLoader::instance().release(paths[i]);
+            return it->second.texture;
+        }
+
+        Entry entry;
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, entry.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        TgaInfo first;
+        for (size_t i = 0; i < paths.size(); i++) {
+            const AssetLoader::Image& image = read_image(paths[i]);
+            if (i == 0) {
+                first = image.info;
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, first.internal_format, first.width, first.height,
+                             paths.size(), 0, first.format, GL_UNSIGNED_BYTE, NULL);
+                entry.bytes = mipmapped_bytes(first, paths.size());
+            } else if (!same_layout(image.info, first)) {
+                std::cerr << "!!!ERROR: " << paths[i] << " does not match the size or format of "
+                          << paths[0] << " in a texture array" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.pbo);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, first.width, first.height, 1,
+                            first.format, GL_UNSIGNED_BYTE, image.pixels);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            AssetLoader::instance().release(paths[i]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        set_parameters(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        _textures[key] = entry;
+        return entry.texture;
+    }
+
+    /// Cube map with linear filtering and clamped edges from the six faces
+    /// +x, -x, +y, -y, +z, -z, whose rows are stored top first
+    GLuint load_cubemap(const std::vector<std::string>& faces) {
+        ///--- Keyed like an array, salted so the same files as an array differ
+        Key key = 0xcbf29ce484222325ull ^ 0xc0be;
+        for (size_t i = 0; i < faces.size(); i++) {
+            key = (key ^ content_key(faces[i], true)) * 0x100000001b3ull;
+        }
+        std::map<Key, Entry>::iterator it = _textures.find(key);
+        if (it != _textures.end()) {
+            _hits++;
+            for (size_t i = 0; i < faces.size(); i++) AssetLoader::instance().release(faces[i], true);
+            return it->second.texture;
+        }
+
+        Entry entry;
+        entry.bytes = 0;
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, entry.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < faces.size() && i < 6; i++) {
+            const AssetLoader::Image& image = read_image(faces[i], true);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.pbo);
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, image.info.internal_format, image.info.width,
+                         image.info.height, 0, image.info.format, GL_UNSIGNED_BYTE, image.pixels);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            entry.bytes += (size_t) image.info.width * image.info.height * 4;
+            AssetLoader::instance().release(faces[i], true);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        _textures[key] = entry;
+        return entry.texture;
+    }
+
+    void cleanup() {
+        for (std::map<Key, Entry>::iterator it = _textures.begin(); it != _textures.end(); ++it) {
+            glDeleteTextures(1, &it->second.texture);
+        }
+        _textures.clear();
+        _paths.clear();
+    }
+
+    void print(std::ostream& out) const {
+        size_t bytes = 0;
+        for (std::map<Key, Entry>::const_iterator it = _textures.begin(); it != _textures.end(); ++it) {
+            bytes += it->second.bytes;
+        }
+        out << "Texture cache: " << _textures.size() << " textures, " << _loads << " images decoded, "
+            << _hits << " cache hits, " << bytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+
+protected:
+    /// FNV-1a of the file content, memoized per path. Hashed by the
+    /// AssetLoader while decoding, so a miss waits for the decode.
+    Key content_key(const std::string& path, bool top_row_first = false) {
+        std::map<std::string, Key>::iterator it = _paths.find(path);
+        if (it != _paths.end()) return it->second;
+        Key key = AssetLoader::instance().wait(path, top_row_first).hash;
+        _paths[path] = key;
+        return key;
+    }
+
+    const AssetLoader::Image& read_image(const std::string& path, bool top_row_first = false) {
+        _loads++;
+        return AssetLoader::instance().wait(path, top_row_first);
+    }
+
+    static bool same_layout(const TgaInfo& a, const TgaInfo& b) {
+        return a.width == b.width && a.height == b.height && a.format == b.format;
+    }
+
+    /// Drivers pad RGB8 to 4 bytes per texel, mipmaps add a third
+    static size_t mipmapped_bytes(const TgaInfo& info, size_t layers) {
+        return (size_t) info.width * info.height * 4 * layers * 4 / 3;
+    }
+
+    static void set_parameters(GLenum target) {
+        glGenerateMipmap(target);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    }
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include "icg_common.h"
+#include "TexelRect.h"
+
+/// Copies a single channel float texture back to the CPU without stalling
+/// the pipeline. request() marks texels dirty; flush() reads the dirty
+/// rectangle into the next free pixel buffer object of a ring and fences
+/// it; poll() copies every fenced readback the GPU has finished into the
+/// CPU array, a frame or two later. Requests made while the ring is full
+/// are merged into one rectangle and issued as soon as a buffer frees up.
+class TextureReadback {
+protected:
+    struct Slot {
+        GLuint pbo;
+        GLsync fence;       ///< NULL when the slot is free
+        TexelRect rect;
+        int issued_frame;
+    };
+
+    GLuint _fbo;            ///< reads the texture through glReadPixels
+    int _width, _height;
+    std::vector<Slot> _ring;
+    int _next;              ///< next slot to issue on, slots complete in ring order
+    TexelRect _dirty;       ///< requested, not yet issued
+    int _frame;             ///< poll() calls
+
+    ///--- Statistics
+    size_t _issued, _completed, _bytes;
+    size_t _latency;        ///< sum over completed readbacks of the polls they took
+
+public:
+    /// texture is width x height, GL_R32F. Up to ring_size readbacks are
+    /// in flight at a time.
+    void init(GLuint texture, int width, int height, int ring_size = 3) {
+        _width = width;
+        _height = height;
+        _next = 0;
+        _frame = 0;
+        _issued = _completed = _bytes = _latency = 0;
+
+        glGenFramebuffers(1, &_fbo);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        _ring.resize(ring_size);
+        for (size_t i = 0; i < _ring.size(); i++) {
+            glGenBuffers(1, &_ring[i].pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, _ring[i].pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t) width * height * sizeof(float), NULL, GL_STREAM_READ);
+            _ring[i].fence = NULL;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    void cleanup() {
+        for (size_t i = 0; i < _ring.size(); i++) {
+            if (_ring[i].fence) glDeleteSync(_ring[i].fence);
+            glDeleteBuffers(1, &_ring[i].pbo);
+        }
+        _ring.clear();
+        glDeleteFramebuffers(1, &_fbo);
+    }
+
+    /// Marks texels to read back, the whole texture by default
+    void request(const TexelRect& rect) {
+        _dirty = _dirty.merge(rect.clip(_width, _height));
+    }
+
+    void request() {
+        request(TexelRect(0, 0, _width, _height));
+    }
+
+    /// Issues the dirty rectangle if a buffer is free; call after the
+    /// commands writing the texture
+    void flush() {
+        Slot& slot = _ring[_next];
+        if (_dirty.empty() || slot.fence) return;
+
+        GLint read_fbo;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(_dirty.x, _dirty.y, _dirty.width, _dirty.height, GL_RED, GL_FLOAT, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.rect = _dirty;
+        slot.issued_frame = _frame;
+        _dirty = TexelRect();
+        _next = (_next + 1) % _ring.size();
+        _issued++;
+    }
+
+    /// Copies the finished readbacks into dest (width x height floats, rows
+    /// along y) and issues pending requests. Returns the union of the
+    /// rectangles updated, empty if none. With wait, blocks until every
+    /// request made so far has landed.
+    TexelRect poll(float* dest, bool wait = false) {
+        _frame++;
+        TexelRect updated;
+        flush();
+        for (;;) {
+            ///--- Slots are issued in ring order: the oldest in flight follows the last issued
+            Slot* slot = NULL;
+            for (size_t n = 0; n < _ring.size() && !slot; n++) {
+                Slot& s = _ring[(_next + n) % _ring.size()];
+                if (s.fence) slot = &s;
+            }
+            if (!slot) break;
+            GLenum status = glClientWaitSync(slot->fence, 0, 0);
+            while (wait && status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            }
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+            copy(*slot, dest);
+            updated = updated.merge(slot->rect);
+            // requests merged while the ring was full
+            flush();
+        }
+        return updated;
+    }
+
+    /// Reads everything requested so far, blocking
+    TexelRect finish(float* dest) {
+        return poll(dest, true);
+    }
+
+    bool pending() const {
+        if (!_dirty.empty()) return true;
+        for (size_t i = 0; i < _ring.size(); i++) {
+            if (_ring[i].fence) return true;
+        }
+        return false;
+    }
+
+    void print(std::ostream& out) const {
+        out << "Readback: " << _issued << " issued, " << _completed << " completed, "
+            << _bytes / (1024.0 * 1024.0) << " MB, "
+            << (_completed ? (double) _latency / _completed : 0.0) << " frames average latency" << std::endl;
+    }
+
+protected:
+    void copy(Slot& slot, float* dest) {
+        const TexelRect& r = slot.rect;
+        size_t row_bytes = (size_t) r.width * sizeof(float);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const float* src = (const float*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, row_bytes * r.height,
+                                                           GL_MAP_READ_BIT);
+        if (src) {
+            for (int y = 0; y < r.height; y++) {
+                memcpy(dest + (size_t) (r.y + y) * _width + r.x, src + (size_t) y * r.width, row_bytes);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteSync(slot.fence);
+        slot.fence = NULL;
+        _completed++;
+        _bytes += row_bytes * r.height;
+        _latency += _frame - slot.issued_frame;
+    }
+};
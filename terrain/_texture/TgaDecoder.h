@@ -0,0 +1,97 @@
+#pragma once
+#include <cstring>
+#include <algorithm>
+#include <cstddef>
+#include "icg_common.h"
+
+/// Size and pixel layout of a TGA image
+struct TgaInfo {
+    int width;
+    int height;
+    int bytes_per_pixel;    ///< 1, 3 or 4
+    GLenum format;          ///< GL_RED, GL_BGR or GL_BGRA, as stored in the file
+    GLint internal_format;  ///< GL_R8, GL_RGB8 or GL_RGBA8
+    bool rle;
+    bool top_origin;        ///< rows stored top first
+    size_t data_offset;     ///< first byte of the pixel data
+
+    size_t bytes() const { return (size_t) width * height * bytes_per_pixel; }
+};
+
+/// Reentrant decoder for the uncompressed and run-length encoded true
+/// color and grayscale TGA images (types 2, 3, 10 and 11) of the assets.
+/// Pixels keep the BGR(A) order of the file and are uploaded as GL_BGR(A),
+/// so decoding is a copy (or a run expansion) of each row.
+class TgaDecoder {
+public:
+    static const size_t HEADER_SIZE = 18;
+
+    /// Parses the header, the first HEADER_SIZE bytes of the file
+    static bool header(const unsigned char* bytes, size_t size, TgaInfo& info) {
+        if (size < HEADER_SIZE) return false;
+        int type = bytes[2];
+        if (bytes[1] != 0 || (type != 2 && type != 3 && type != 10 && type != 11)) return false;
+        info.width = bytes[12] | bytes[13] << 8;
+        info.height = bytes[14] | bytes[15] << 8;
+        info.bytes_per_pixel = bytes[16] / 8;
+        info.rle = type >= 10;
+        info.top_origin = (bytes[17] & 0x20) != 0;
+        info.data_offset = HEADER_SIZE + bytes[0];
+        switch (info.bytes_per_pixel) {
+            case 1: info.format = GL_RED; info.internal_format = GL_R8; break;
+            case 3: info.format = GL_BGR; info.internal_format = GL_RGB8; break;
+            case 4: info.format = GL_BGRA; info.internal_format = GL_RGBA8; break;
+            default: return false;
+        }
+        return info.width > 0 && info.height > 0;
+    }
+
+    /// Decodes the whole file into out, info.bytes() tightly packed bytes,
+    /// bottom row first like glTexImage2D expects, or top row first for
+    /// cube map faces. False if the file is truncated.
+    static bool decode(const unsigned char* bytes, size_t size, const TgaInfo& info, unsigned char* out,
+                       bool top_row_first = false) {
+        const int bpp = info.bytes_per_pixel;
+        const size_t row_bytes = (size_t) info.width * bpp;
+        const unsigned char* src = bytes + info.data_offset;
+        const unsigned char* end = bytes + size;
+        bool flip = info.top_origin != top_row_first;
+
+        ///--- Runs may cross rows, so expand them pixel by pixel within a row
+        int run = 0;            // pixels left in the current packet
+        bool repeat = false;    // current packet repeats one pixel
+        for (int y = 0; y < info.height; y++) {
+            unsigned char* row = out + (size_t) (flip ? info.height - 1 - y : y) * row_bytes;
+            if (!info.rle) {
+                if (src + row_bytes > end) return false;
+                std::memcpy(row, src, row_bytes);
+                src += row_bytes;
+                continue;
+            }
+            unsigned char* dst = row;
+            unsigned char* row_end = row + row_bytes;
+            while (dst < row_end) {
+                if (run == 0) {
+                    if (src >= end) return false;
+                    repeat = (*src & 0x80) != 0;
+                    run = (*src & 0x7f) + 1;
+                    src++;
+                    if (repeat && src + bpp > end) return false;
+                }
+                int n = std::min(run, (int) ((row_end - dst) / bpp));
+                if (repeat) {
+                    for (int i = 0; i < n; i++, dst += bpp) std::memcpy(dst, src, bpp);
+                    run -= n;
+                    if (run == 0) src += bpp;
+                } else {
+                    if (src + (size_t) n * bpp > end) return false;
+                    std::memcpy(dst, src, (size_t) n * bpp);
+                    dst += (size_t) n * bpp;
+                    src += (size_t) n * bpp;
+                    run -= n;
+                }
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,207 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+/// Work-stealing thread pool. Every worker owns a deque: it pops its own
+/// tasks from the back and steals from the front of the other deques when
+/// it runs dry. parallel_for() waits for its own chunks only, running them
+/// alongside the workers, so it can be called from inside a task and does
+/// not wait for unrelated tasks. The thread calling wait() helps with the
+/// remaining work and runs tasks as worker size(), so only one thread
+/// should wait at a time.
+class ThreadPool {
+public:
+    /// @param worker index in [0, size()], stable for the task's duration
+    typedef std::function<void(int worker)> Task;
+
+protected:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> _threads;
+    std::vector<Queue*> _queues;        ///< one per worker + one for the caller
+    std::atomic<int> _queued;           ///< tasks not yet picked up
+    std::atomic<int> _unfinished;       ///< tasks not yet completed
+    std::atomic<size_t> _steals;        ///< tasks run by another worker than the one they were queued on
+    std::atomic<unsigned int> _next;    ///< round-robin submission cursor
+    std::mutex _mutex;
+    std::condition_variable _work_cv;   ///< signaled when tasks are queued
+    std::condition_variable _done_cv;   ///< signaled when _unfinished or a batch's count drops to 0
+    bool _stop;
+
+    /// Chunks of a parallel_for, claimed in order by whoever runs it
+    struct Batch {
+        std::atomic<int> next;          ///< first chunk not yet claimed
+        std::atomic<int> unfinished;    ///< chunks not yet completed
+    };
+
+public:
+    /// @param num_threads 0 uses one thread per hardware core
+    explicit ThreadPool(int num_threads = 0) :
+        _queued(0), _unfinished(0), _steals(0), _next(0), _stop(false) {
+        if (num_threads <= 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int i = 0; i <= num_threads; i++) {
+            _queues.push_back(new Queue());
+        }
+        for (int i = 0; i < num_threads; i++) {
+            _threads.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _work_cv.notify_all();
+        for (size_t i = 0; i < _threads.size(); i++) {
+            _threads[i].join();
+        }
+        for (size_t i = 0; i < _queues.size(); i++) {
+            delete _queues[i];
+        }
+    }
+
+    /// number of worker threads (the waiting thread is an extra worker)
+    int size() const {
+        return (int) _threads.size();
+    }
+
+    size_t steals() const {
+        return _steals;
+    }
+
+    /// Queues a task on the next worker in round-robin order
+    void submit(const Task& task) {
+        submit(task, _next++ % _threads.size());
+    }
+
+    /// Queues a task on a given worker's deque
+    void submit(const Task& task, int worker) {
+        _unfinished++;
+        {
+            Queue* q = _queues[worker];
+            std::lock_guard<std::mutex> lock(q->mutex);
+            q->tasks.push_back(task);
+        }
+        _queued++;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+        }
+        _work_cv.notify_one();
+    }
+
+    /// Blocks until every submitted task completed, running tasks meanwhile;
+    /// for shutdown, parallel_for() waits for its own chunks only
+    void wait() {
+        const int self = size();
+        while (_unfinished > 0) {
+            if (!run_one(self)) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _done_cv.wait_for(lock, std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    /// Runs f(i, worker) for i in [begin, end) in chunks of grain and waits
+    /// for them. The calling thread claims chunks too, as its worker index
+    /// if it is one of this pool's and as size() otherwise; the tasks
+    /// submitted to the workers claim the rest and return once none is left.
+    template <class F> void parallel_for(int begin, int end, int grain, F f) {
+        grain = std::max(1, grain);
+        if (begin >= end) return;
+        const int chunks = (end - begin + grain - 1) / grain;
+        std::shared_ptr<Batch> batch(new Batch());
+        batch->next = 0;
+        batch->unfinished = chunks;
+        ThreadPool* self = this;
+        Task run = [=](int worker) {
+            for (int c; (c = batch->next++) < chunks;) {
+                int start = begin + c * grain, stop = std::min(end, start + grain);
+                for (int i = start; i < stop; i++) f(i, worker);
+                if (--batch->unfinished == 0) {
+                    std::lock_guard<std::mutex> lock(self->_mutex);
+                    self->_done_cv.notify_all();
+                }
+            }
+        };
+        for (int i = 0; i < std::min(chunks - 1, size()); i++) submit(run);
+        run(current_worker());
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock, [&]() { return batch->unfinished == 0; });
+    }
+
+protected:
+    /// This pool's worker running on the calling thread, as set by
+    /// worker_loop(); NULL elsewhere
+    static const ThreadPool*& thread_pool() {
+        static thread_local const ThreadPool* pool = NULL;
+        return pool;
+    }
+    static int& thread_worker() {
+        static thread_local int worker = 0;
+        return worker;
+    }
+
+    int current_worker() const {
+        return thread_pool() == this ? thread_worker() : size();
+    }
+
+    bool pop(int worker, Task& task) {
+        Queue* q = _queues[worker];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if (q->tasks.empty()) return false;
+        task = q->tasks.back();
+        q->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int victim, Task& task) {
+        Queue* q = _queues[victim];
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if (q->tasks.empty()) return false;
+        task = q->tasks.front();
+        q->tasks.pop_front();
+        return true;
+    }
+
+    bool run_one(int worker) {
+        Task task;
+        bool found = pop(worker, task);
+        for (size_t i = 1; !found && i < _queues.size(); i++) {
+            found = steal((worker + i) % _queues.size(), task);
+            if (found) _steals++;
+        }
+        if (!found) return false;
+        _queued--;
+        task(worker);
+        if (--_unfinished == 0) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _done_cv.notify_all();
+        }
+        return true;
+    }
+
+    void worker_loop(int worker) {
+        thread_pool() = this;
+        thread_worker() = worker;
+        for (;;) {
+            if (run_one(worker)) continue;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _work_cv.wait(lock, [this]() { return _stop || _queued > 0; });
+            if (_stop) return;
+        }
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <iostream>
+#include <algorithm>
+#include "icg_common.h"
+#include "../FrameBuffer.h"
+
+/// Planar reflection of the scene in the water, rendered by the caller
+/// between begin() and end() from the mirrored camera. The pass renders at
+/// a fraction of the window resolution, is skipped while no water is
+/// visible, and can be refreshed only every few frames: the water shader
+/// reprojects the last reflection with the view-projection it was
+/// rendered with, which holds for anything on the water plane. The GPU
+/// time of the pass is the FrameProfiler's, which times its render graph
+/// pass.
+class Reflection {
+protected:
+    FrameBuffer* _fb;
+    GLuint _tex;
+    int _width, _height;        ///< of the reflection texture
+    int _interval;              ///< frames between refreshes
+    int _age;                   ///< frames since the last refresh
+    bool _valid;                ///< the texture holds a reflection
+    mat4 _VP;                   ///< mirrored view-projection of the texture
+
+    ///--- Statistics, since the last print
+    int _rendered, _reused, _skipped;
+
+public:
+    Reflection() : _fb(NULL), _tex(0), _width(0), _height(0), _interval(1), _age(0), _valid(false),
+        _rendered(0), _reused(0), _skipped(0) {}
+
+    /// Reflection of a window_width x window_height view, scaled by scale
+    /// and refreshed every interval frames while water is visible
+    void init(int window_width, int window_height, float scale = 0.5f, int interval = 2) {
+        _width = std::max(1, (int) (window_width * scale));
+        _height = std::max(1, (int) (window_height * scale));
+        _interval = std::max(1, interval);
+        _fb = new FrameBuffer(_width, _height);
+        _tex = _fb->init(true, true);
+        _VP = mat4::Identity();
+    }
+
+    void cleanup() {
+        _fb->cleanup();
+        delete _fb;
+        _fb = NULL;
+    }
+
+    /// Starts the pass if it is due, binding the reflection framebuffer.
+    /// Returns false when the last reflection is reused, or when no water
+    /// is visible and nothing needs one.
+    bool begin(const mat4& mirror_VP, bool water_visible) {
+        _age++;
+        if (!water_visible) {
+            _skipped++;
+            return false;
+        }
+        if (_valid && _age < _interval) {
+            _reused++;
+            return false;
+        }
+        _VP = mirror_VP;
+        _fb->bind();
+        return true;
+    }
+
+    /// Ends a pass begun by begin(), restoring the window viewport
+    void end(int window_width, int window_height) {
+        _fb->unbind();
+        glViewport(0, 0, window_width, window_height);
+        _valid = true;
+        _age = 0;
+        _rendered++;
+    }
+
+    GLuint texture() const { return _tex; }
+
+    /// Mirrored view-projection the texture was rendered with
+    const mat4& view_projection() const { return _VP; }
+
+    /// Prints the passes since the last call. frame_gpu_ms is the GPU time
+    /// of the pass averaged over every frame, rendered or not, as the
+    /// FrameProfiler measures it; frame_ms the average frame time.
+    void print(std::ostream& out, double frame_ms, double frame_gpu_ms) {
+        int frames = _rendered + _reused + _skipped;
+        double pass_ms = _rendered ? frame_gpu_ms * frames / _rendered : 0.0;
+        out << "Reflection " << _width << "x" << _height << ": " << _rendered << " rendered, " << _reused
+            << " reused, " << _skipped << " skipped, " << pass_ms << " ms GPU per pass, "
+            << (frame_ms > 0.0 ? 100.0 * frame_gpu_ms / frame_ms : 0.0) << "% of the frame" << std::endl;
+        _rendered = _reused = _skipped = 0;
+    }
+};
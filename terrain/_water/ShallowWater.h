@@ -0,0 +1,330 @@
+#pragma once
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include "icg_common.h"
+#include "../_noise/NoiseEngine.h"
+#include "../_threads/ThreadPool.h"
+#include "../_texture/TexelRect.h"
+
+/// Parameters of the shallow water solver, in world units and seconds
+struct WaterParams {
+    float timestep;     ///< fixed step of the simulation
+    int max_steps;      ///< per advance(), the simulation slows down beyond
+    float gravity;      ///< scaled down so that waves over the deepest water stay stable at timestep
+    float damping;      ///< fraction of the pipe flow lost per step
+
+    WaterParams() : timestep(1.0f / 120.0f), max_steps(4), gravity(0.04f), damping(0.002f) {}
+};
+
+/// Shallow water on the heightmap grid, with the virtual pipes model: every
+/// cell has four outflow pipes to its neighbours, accelerated by the
+/// difference of water surface heights and scaled down so that no cell
+/// gives more water than it has. Each step makes two passes over the grid,
+/// fluxes then depths and velocities, each split in row blocks on a pool
+/// and processed 8 cells at a time with noise::float8.
+///
+/// Arrays have a one cell border of walls (very high ground, no flow), so
+/// the passes need no bounds checks; texel k sits at world
+/// -1 + 2k / (dim - 1) like the heights.
+class ShallowWater {
+protected:
+    ThreadPool& _pool;
+    WaterParams _params;
+    int _dim;
+    int _stride;                ///< dim + 2 border cells
+    float _cell;                ///< world distance between two cells
+    float _level;               ///< of the still water of fill()
+    std::vector<float> _ground; ///< terrain height
+    std::vector<float> _depth;
+    std::vector<float> _next_depth;
+    std::vector<float> _left, _right, _down, _up;   ///< outflow towards -x, +x, -y, +y, volume per second
+    std::vector<float> _u, _v;                      ///< velocity along +x, +y
+    std::vector<float> _velocity;                   ///< u, v interleaved for upload, dim x dim
+    std::vector<float> _tile_depth;                 ///< deepest water of every TILE, as of the last upload
+    int _tiles;                 ///< TILEs per side
+    double _pending;            ///< seconds not yet simulated
+
+    GLuint _depth_tex;          ///< R32F water depth
+    GLuint _velocity_tex;       ///< RG16F velocity
+
+    ///--- Statistics
+    size_t _steps;
+    double _step_ms;            ///< time spent stepping
+
+    static const int ROWS = 16; ///< rows per pool task
+    static constexpr float WALL = 1e6f;
+
+public:
+    static const int TILE = 64;         ///< cells per side of the tiles of tile_depth()
+    static constexpr float DRY = 1e-4f; ///< depth below which a cell counts as dry, as in the water shaders
+
+    explicit ShallowWater(ThreadPool& pool) :
+        _pool(pool), _dim(0), _stride(0), _level(0.0f), _tiles(0), _pending(0.0), _depth_tex(0), _velocity_tex(0), _steps(0), _step_ms(0.0) {}
+
+    /// dim x dim cells over the heights, filled with still water up to level
+    void init(int dim, const float* heights, float level, const WaterParams& params = WaterParams()) {
+        _params = params;
+        _dim = dim;
+        _stride = dim + 2;
+        _cell = 2.0f / (dim - 1);
+        size_t cells = (size_t) _stride * _stride;
+        _ground.assign(cells, (float) WALL);
+        _depth.assign(cells, 0.0f);
+        _next_depth.assign(cells, 0.0f);
+        _left.assign(cells, 0.0f);
+        _right.assign(cells, 0.0f);
+        _down.assign(cells, 0.0f);
+        _up.assign(cells, 0.0f);
+        _u.assign(cells, 0.0f);
+        _v.assign(cells, 0.0f);
+        _velocity.assign((size_t) dim * dim * 2, 0.0f);
+        _tiles = (dim - 2) / TILE + 1;
+        _tile_depth.assign((size_t) _tiles * _tiles, 0.0f);
+        _level = level;
+        set_ground(heights, TexelRect(0, 0, dim, dim));
+        fill(level);
+    }
+
+    /// Creates the textures the water shaders read; the simulation itself
+    /// does not need a GL context
+    void init_textures() {
+        glGenTextures(1, &_depth_tex);
+        glBindTexture(GL_TEXTURE_2D, _depth_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, _dim, _dim, 0, GL_RED, GL_FLOAT, NULL);
+        set_parameters();
+        glGenTextures(1, &_velocity_tex);
+        glBindTexture(GL_TEXTURE_2D, _velocity_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, _dim, _dim, 0, GL_RG, GL_FLOAT, NULL);
+        set_parameters();
+        glBindTexture(GL_TEXTURE_2D, 0);
+        upload();
+    }
+
+    void cleanup() {
+        glDeleteTextures(1, &_depth_tex);
+        glDeleteTextures(1, &_velocity_tex);
+    }
+
+    /// Copies the terrain heights of rect, after they changed, and puts
+    /// still water up to the level of fill() over them: the old depths
+    /// would flood ground that rose and leave new basins dry
+    void set_ground(const float* heights, const TexelRect& rect) {
+        for (int y = rect.y; y < rect.y + rect.height; y++) {
+            std::copy(heights + (size_t) y * _dim + rect.x, heights + (size_t) y * _dim + rect.x + rect.width,
+                      &_ground[index(rect.x, y)]);
+        }
+        still(rect);
+    }
+
+    /// Still water up to level everywhere, no flow
+    void fill(float level) {
+        _level = level;
+        still(TexelRect(0, 0, _dim, _dim));
+        _pending = 0.0;
+    }
+
+    /// Pours a column of water of the given depth over a disk, world units
+    void add_water(float x, float z, float radius, float depth) {
+        float cx = (x + 1.0f) / _cell, cy = (z + 1.0f) / _cell, r = radius / _cell;
+        int x0 = std::max(0, (int) (cx - r)), x1 = std::min(_dim - 1, (int) (cx + r) + 1);
+        int y0 = std::max(0, (int) (cy - r)), y1 = std::min(_dim - 1, (int) (cy + r) + 1);
+        for (int y = y0; y <= y1; y++) {
+            for (int px = x0; px <= x1; px++) {
+                float d2 = (px - cx) * (px - cx) + (y - cy) * (y - cy);
+                if (d2 <= r * r) _depth[index(px, y)] += depth * (1.0f - d2 / (r * r));
+            }
+        }
+    }
+
+    /// Simulates the fixed steps that fit in the seconds elapsed, carrying
+    /// the remainder over; returns the number of steps
+    int advance(double seconds) {
+        _pending += seconds;
+        int steps = 0;
+        while (_pending >= _params.timestep && steps < _params.max_steps) {
+            step();
+            _pending -= _params.timestep;
+            steps++;
+        }
+        ///--- Too far behind: drop the time rather than spiral
+        if (steps == _params.max_steps) _pending = std::min(_pending, (double) _params.timestep);
+        return steps;
+    }
+
+    /// One fixed step: fluxes, then depths and velocities
+    void step() {
+        typedef std::chrono::high_resolution_clock Clock;
+        Clock::time_point start = Clock::now();
+        ShallowWater* self = this;
+        int blocks = (_dim + ROWS - 1) / ROWS;
+        _pool.parallel_for(0, blocks, 1, [=](int block, int) {
+            for (int y = block * ROWS; y < std::min(self->_dim, (block + 1) * ROWS); y++) self->flux_row(y);
+        });
+        _pool.parallel_for(0, blocks, 1, [=](int block, int) {
+            for (int y = block * ROWS; y < std::min(self->_dim, (block + 1) * ROWS); y++) self->depth_row(y);
+        });
+        _depth.swap(_next_depth);
+        _steps++;
+        _step_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    /// Uploads depths and velocities to the textures, and finds the
+    /// deepest water of every tile
+    void upload() {
+        if (!_depth_tex) return;
+        ShallowWater* self = this;
+        _pool.parallel_for(0, _tiles, 1, [=](int ty, int) { self->tile_row_depths(ty); });
+        _pool.parallel_for(0, _dim, ROWS, [=](int y, int) {
+            const float* u = &self->_u[self->index(0, y)];
+            const float* v = &self->_v[self->index(0, y)];
+            float* out = &self->_velocity[(size_t) y * self->_dim * 2];
+            for (int x = 0; x < self->_dim; x++) {
+                out[2 * x] = u[x];
+                out[2 * x + 1] = v[x];
+            }
+        });
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, _stride);
+        glBindTexture(GL_TEXTURE_2D, _depth_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _dim, _dim, GL_RED, GL_FLOAT, &_depth[index(0, 0)]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, _velocity_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _dim, _dim, GL_RG, GL_FLOAT, &_velocity[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    GLuint depth_texture() const { return _depth_tex; }
+    GLuint velocity_texture() const { return _velocity_tex; }
+
+    float depth(int x, int y) const { return _depth[index(x, y)]; }
+
+    /// Deepest water over the quads [tx, tx + 1) x [ty, ty + 1) * TILE and
+    /// their corner texels, as uploaded last; tiles line up with the level
+    /// of HeightPyramid whose cells span TILE quads
+    float tile_depth(int tx, int ty) const {
+        return _tile_depth[(size_t) std::min(ty, _tiles - 1) * _tiles + std::min(tx, _tiles - 1)];
+    }
+
+    /// Water volume, in world units^3
+    double volume() const {
+        double sum = 0.0;
+        for (int y = 0; y < _dim; y++) {
+            for (int x = 0; x < _dim; x++) sum += _depth[index(x, y)];
+        }
+        return sum * _cell * _cell;
+    }
+
+    size_t steps() const { return _steps; }
+
+    void print(std::ostream& out) const {
+        double ms = _steps ? _step_ms / _steps : 0.0;
+        out << "Water: " << _dim << "x" << _dim << " cells, " << _steps << " steps of " << ms << " ms on "
+            << _pool.size() << " threads (" << (ms > 0.0 ? (double) _dim * _dim / (ms * 1e3) : 0.0)
+            << " M cell updates/s)" << std::endl;
+    }
+
+protected:
+    size_t index(int x, int y) const {
+        return (size_t) (y + 1) * _stride + x + 1;
+    }
+
+    /// Still water up to _level over rect, no flow
+    void still(const TexelRect& rect) {
+        for (int y = rect.y; y < rect.y + rect.height; y++) {
+            for (int x = rect.x; x < rect.x + rect.width; x++) {
+                size_t i = index(x, y);
+                _depth[i] = std::max(0.0f, _level - _ground[i]);
+                _left[i] = _right[i] = _down[i] = _up[i] = _u[i] = _v[i] = 0.0f;
+            }
+        }
+    }
+
+    void set_parameters() {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    void tile_row_depths(int ty) {
+        for (int tx = 0; tx < _tiles; tx++) {
+            float deepest = 0.0f;
+            int x1 = std::min(_dim - 1, (tx + 1) * TILE), y1 = std::min(_dim - 1, (ty + 1) * TILE);
+            for (int y = ty * TILE; y <= y1; y++) {
+                const float* d = &_depth[index(0, y)];
+                for (int x = tx * TILE; x <= x1; x++) deepest = std::max(deepest, d[x]);
+            }
+            _tile_depth[(size_t) ty * _tiles + tx] = deepest;
+        }
+    }
+
+    void flux_row(int y) {
+        size_t i = index(0, y);
+        int x = 0;
+        for (; x + 8 <= _dim; x += 8) flux<noise::float8>(i + x);
+        for (; x < _dim; x++) flux<float>(i + x);
+    }
+
+    void depth_row(int y) {
+        size_t i = index(0, y);
+        int x = 0;
+        for (; x + 8 <= _dim; x += 8) update<noise::float8>(i + x);
+        for (; x < _dim; x++) update<float>(i + x);
+    }
+
+    static float load(const float* p, float) { return *p; }
+    static noise::float8 load(const float* p, noise::float8) { return noise::float8::load(p); }
+    static void store(float* p, float a) { *p = a; }
+    static void store(float* p, noise::float8 a) { a.store(p); }
+
+    /// Outflows of cells i.., accelerated by the surface height differences
+    /// (pipes of section cell^2 and length cell) then scaled so that they
+    /// drain at most the water of the cell in one step
+    template <class T> void flux(size_t i) {
+        using namespace noise;
+        const T zero(0.0f);
+        const T keep(1.0f - _params.damping);
+        const T accel(_params.timestep * _params.gravity * _cell);
+        const float* g = &_ground[i];
+        const float* d = &_depth[i];
+        T h = load(g, zero) + load(d, zero);
+        T left = vmax(zero, load(&_left[i], zero) * keep + accel * (h - load(g - 1, zero) - load(d - 1, zero)));
+        T right = vmax(zero, load(&_right[i], zero) * keep + accel * (h - load(g + 1, zero) - load(d + 1, zero)));
+        T down = vmax(zero, load(&_down[i], zero) * keep +
+                            accel * (h - load(g - _stride, zero) - load(d - _stride, zero)));
+        T up = vmax(zero, load(&_up[i], zero) * keep +
+                          accel * (h - load(g + _stride, zero) - load(d + _stride, zero)));
+
+        T outflow = (left + right + down + up) * T(_params.timestep);
+        T scale = vmin(T(1.0f), load(d, zero) * T(_cell * _cell) / vmax(outflow, T(1e-12f)));
+        store(&_left[i], left * scale);
+        store(&_right[i], right * scale);
+        store(&_down[i], down * scale);
+        store(&_up[i], up * scale);
+    }
+
+    /// New depths of cells i.. from the flows in and out, and velocities
+    /// from the flows through them
+    template <class T> void update(size_t i) {
+        using namespace noise;
+        const T zero(0.0f);
+        T left = load(&_left[i], zero), right = load(&_right[i], zero);
+        T down = load(&_down[i], zero), up = load(&_up[i], zero);
+        T from_left = load(&_right[i - 1], zero), from_right = load(&_left[i + 1], zero);
+        T from_down = load(&_up[i - _stride], zero), from_up = load(&_down[i + _stride], zero);
+
+        T d = load(&_depth[i], zero);
+        T inflow = from_left + from_right + from_down + from_up;
+        T outflow = left + right + down + up;
+        T next = vmax(zero, d + (inflow - outflow) * T(_params.timestep / (_cell * _cell)));
+        store(&_next_depth[i], next);
+
+        ///--- Mean flow through the cell over the mean depth, 0 when dry
+        T mean_depth = (d + next) * T(0.5f);
+        T section = vmax(mean_depth, T(1e-4f)) * T(_cell);
+        store(&_u[i], (from_left - left + right - from_right) * T(0.5f) / section);
+        store(&_v[i], (from_down - down + up - from_up) * T(0.5f) / section);
+    }
+};
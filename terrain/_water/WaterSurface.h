@@ -0,0 +1,123 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "icg_common.h"
+#include "ShallowWater.h"
+#include "../_heightmap/HeightPyramid.h"
+#include "../_culling/Frustum.h"
+#include "../_render/GLState.h"
+#include "../_grid/PatchMesh.h"
+
+/// Tiles picked and skipped by the last WaterSurface::select, and drawn
+struct WaterStats {
+    int drawn;
+    int dry;            ///< tiles with neither sea nor simulated water
+    int culled;         ///< wet tiles outside the frustum
+    size_t triangles;
+};
+
+/// Draws the water as a coarse mesh, one patch per ShallowWater::TILE
+/// heightmap quads, and only over the tiles that hold water: those whose
+/// terrain dips below the water level, read from the height pyramid, or
+/// where the simulation has water. water_vshader.glsl lifts the patch
+/// vertices to the simulated surface, water_fshader.glsl still hides what
+/// lies over dry land inside a drawn tile. select() picks the tiles ahead
+/// of draw(), so the reflection pass can be skipped when there are none.
+class WaterSurface {
+protected:
+    PatchMesh _patch;           ///< one tile
+    GLuint _pid;                ///< GLSL shader program ID
+    GLuint _tex;                ///< heightmap texture
+    int _patch_cells;           ///< cells per patch edge
+    int _tiles;                 ///< tiles per side
+    int _pyramid_level;         ///< pyramid level whose cells are the tiles
+    float _tile_size;           ///< world edge length of a tile
+    const HeightPyramid* _pyramid;
+    const ShallowWater* _water;
+    std::vector<vec3> _selection;   ///< world origin x, z and size of the tiles to draw
+    WaterStats _stats;
+
+public:
+    /// pyramid is built from the CPU copy of texture; every tile is drawn
+    /// with patch_cells^2 quads, a divisor of ShallowWater::TILE
+    void init(GLuint texture, const HeightPyramid* pyramid, const ShallowWater* water, int patch_cells = 16) {
+        _tex = texture;
+        _pyramid = pyramid;
+        _water = water;
+        _patch_cells = patch_cells;
+        _tiles = (pyramid->dim() - 2) / ShallowWater::TILE + 1;
+        _tile_size = 2.0f * ShallowWater::TILE / (pyramid->dim() - 1);
+        _pyramid_level = 0;
+        while ((1 << _pyramid_level) < ShallowWater::TILE) _pyramid_level++;
+
+        _pid = opengp::load_shaders("_water/water_vshader.glsl", "_water/water_fshader.glsl");
+        if(!_pid) exit(EXIT_FAILURE);
+        glUseProgram(_pid);
+
+        _patch.init(_patch_cells, std::vector<int>(1, 1), true);
+        glUseProgram(0);
+    }
+
+    void cleanup() {
+        _patch.cleanup();
+        glDeleteProgram(_pid);
+    }
+
+    /// Picks the wet tiles intersecting frustum, returns how many
+    int select(const Frustum& frustum, float water_level) {
+        _selection.clear();
+        _stats.dry = 0;
+        _stats.culled = 0;
+        for (int tz = 0; tz < _tiles; tz++) {
+            for (int tx = 0; tx < _tiles; tx++) {
+                float lo = _pyramid->min_at(_pyramid_level, tx, tz);
+                float depth = _water->tile_depth(tx, tz);
+                if (lo >= water_level && depth <= ShallowWater::DRY) {
+                    _stats.dry++;
+                    continue;
+                }
+                ///--- The surface lies between the still water and the highest ground plus the deepest water
+                float x0 = -1.0f + tx * _tile_size, z0 = -1.0f + tz * _tile_size;
+                float hi = std::max(water_level, _pyramid->max_at(_pyramid_level, tx, tz) + depth);
+                if (!frustum.intersects(x0, std::min(lo, water_level), z0, std::min(x0 + _tile_size, 1.0f),
+                                        hi, std::min(z0 + _tile_size, 1.0f))) {
+                    _stats.culled++;
+                    continue;
+                }
+                _selection.push_back(vec3(x0, z0, _tile_size));
+            }
+        }
+        return _selection.size();
+    }
+
+    /// Draws the selected tiles, reflecting mirror_tex as rendered with
+    /// mirror_VP; blending is up to the caller, bindings go through GLState
+    void draw(const mat4& VP, GLuint mirror_tex, const mat4& mirror_VP) {
+        GLState& state = GLState::instance();
+        state.use_program(_pid);
+        state.bind_vertex_array(_patch.vao());
+
+        state.bind_texture(0, GL_TEXTURE_2D, _tex);
+        state.bind_sampler(0, 0);
+        glUniform1i(glGetUniformLocation(_pid, "tex"), 0);
+        state.bind_texture(6, GL_TEXTURE_2D, mirror_tex);
+        glUniform1i(glGetUniformLocation(_pid, "mirror_tex"), 6);
+        state.bind_texture(9, GL_TEXTURE_2D, _water->depth_texture());
+        glUniform1i(glGetUniformLocation(_pid, "water_depth"), 9);
+        state.bind_texture(10, GL_TEXTURE_2D, _water->velocity_texture());
+        glUniform1i(glGetUniformLocation(_pid, "water_velocity"), 10);
+
+        glUniformMatrix4fv(glGetUniformLocation(_pid, "mvp"), 1, GL_FALSE, VP.data());
+        glUniformMatrix4fv(glGetUniformLocation(_pid, "mirror_vp"), 1, GL_FALSE, mirror_VP.data());
+        glUniform1i(glGetUniformLocation(_pid, "patch_side"), _patch_cells + 1);
+        GLint tile_id = glGetUniformLocation(_pid, "tile");
+        for (size_t i = 0; i < _selection.size(); i++) {
+            glUniform3fv(tile_id, 1, _selection[i].data());
+            _patch.draw(0);
+        }
+        _stats.drawn = _selection.size();
+        _stats.triangles = 2 * (size_t) _patch_cells * _patch_cells * _selection.size();
+    }
+
+    const WaterStats& stats() const { return _stats; }
+};
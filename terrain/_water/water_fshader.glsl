@@ -0,0 +1,41 @@
+#version 330 core
+uniform sampler2D tex;
+uniform sampler2D mirror_tex;
+uniform mat4 mirror_vp;             ///< mirrored view-projection mirror_tex was rendered with
+uniform sampler2D water_depth;      ///< simulated by ShallowWater, 0 where dry
+uniform sampler2D water_velocity;   ///< world units per second along x, z
+
+in vec2 uv;
+in vec3 surface_pos;
+out vec4 color;
+
+const float WATER_LEVEL = -0.00f;
+const vec3 water_color = vec3(0.05, 0.3, 0.5);
+const vec3 foam_color = vec3(0.85, 0.9, 0.95);
+const float DRY = 1e-4;
+
+void main() {
+    float transparency = 0.7f;
+    float height = texture(tex, uv).x;
+    float depth = texture(water_depth, uv).x;
+    if (height > WATER_LEVEL && depth <= DRY) {
+        transparency = 0.0f;    
+    }
+    // fast water foams and ripples the reflection
+    vec2 velocity = texture(water_velocity, uv).xy;
+    float speed = length(velocity);
+    vec4 color_from_water = vec4(mix(water_color, foam_color, clamp(4.0 * speed, 0.0, 0.6)), 1.0);
+
+    // the mirrored camera saw the mirror image of this point, possibly a
+    // few frames ago
+    vec4 mirror_clip = mirror_vp * vec4(surface_pos.x, -surface_pos.y, surface_pos.z, 1.0);
+    vec2 _uv = mirror_clip.xy / mirror_clip.w * 0.5 + vec2(0.5) + 0.02 * velocity;
+
+    vec4 color_from_mirror = vec4(texture(mirror_tex, _uv).rgb, 1.0);
+
+   	vec4 mixed = mix(color_from_water, color_from_mirror, 0.3);
+    color = vec4(mixed.rgb, transparency);
+
+    
+    //color = color_from_mirror;
+}
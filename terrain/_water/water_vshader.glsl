@@ -0,0 +1,28 @@
+#version 330 core
+uniform mat4 mvp;
+uniform sampler2D tex;
+uniform sampler2D water_depth;  ///< simulated by ShallowWater, 0 where dry
+uniform vec3 tile;              ///< xy world origin, z world size
+uniform int patch_side;         ///< vertices per edge of the patch, indexed by gl_VertexID
+out vec2 uv;
+out vec3 surface_pos;            ///< world position on the water surface
+
+const float WATER_LEVEL = -0.00f;
+const float DRY = 1e-4;
+const float SKIRT = 0.002;
+
+void main() {
+    vec2 position = vec2(gl_VertexID % patch_side, gl_VertexID / patch_side) / float(patch_side - 1);
+    vec2 world = min(tile.xy + position * tile.z, vec2(1.0));
+    uv = (world + vec2(1.0, 1.0)) * 0.5;
+
+    // dry vertices hide just under the terrain, or on the still water plane
+    // along the shore
+    float ground = texture(tex, uv).x;
+    float depth = texture(water_depth, uv).x;
+    float surface = depth > DRY ? ground + depth : max(ground - SKIRT, WATER_LEVEL);
+    vec3 pos_3d = vec3(world.x, surface, world.y);
+    surface_pos = pos_3d;
+
+    gl_Position = mvp * vec4(pos_3d, 1.0);
+}
@@ -1,10 +1,36 @@
 #include "icg_common.h"
+#include <sstream>
+#include <fstream>
 #include "FrameBuffer.h"
 #include "_grid/Grid.h"
 #include "_perlin/PerlinQuad.h"
 #include "_skybox/Skybox.h"
 #include "_point/Point.h"
 #include "_bezier/Bezier.h"
+#include "_noise/TiledGenerator.h"
+#include "_noise/IncrementalGenerator.h"
+#include "_stream/TerrainStreamer.h"
+#include "_dem/DemTerrain.h"
+#include "_lod/LodTerrain.h"
+#include "_heightmap/HeightPyramid.h"
+#include "_heightmap/TerrainQuery.h"
+#include "_heightmap/TerrainRaycaster.h"
+#include "_heightmap/TerrainBaker.h"
+#include "_heightmap/HeightmapCache.h"
+#include "_erosion/DropletErosion.h"
+#include "_water/ShallowWater.h"
+#include "_water/WaterSurface.h"
+#include "_water/Reflection.h"
+#include "_render/RenderGraph.h"
+#include "_render/HeadlessContext.h"
+#include "_sim/FixedStepLoop.h"
+#include "_sim/CameraState.h"
+#include "_profile/FrameProfiler.h"
+#include "_texture/TextureReadback.h"
+#include "_culling/Frustum.h"
+#ifdef WITH_ANTTWEAKBAR
+    #include <AntTweakBar.h>
+#endif
 
 #define GRID_WIDTH 1024
 
@@ -13,19 +39,30 @@ int grid_width = GRID_WIDTH;
 
 FrameBuffer fb(grid_width, grid_width);
 
-FrameBuffer fb_mirror(width, height);
+Reflection reflection;
 
 PerlinQuad perlin;
 Grid grid;
-Grid water;
+WaterSurface water;
 Skybox skybox;
+TerrainStreamer streamer;
+DemTerrain dem;
+LodTerrain lod;
+HeightPyramid pyramid;
+TerrainRaycaster raycaster(pyramid);
+TerrainBaker baker;
+GLuint height_tex = 0;           ///< heightmap texture, the color attachment of fb
+TextureReadback height_readback; ///< height_map follows height_tex through it
+mat4 pick_VP;                    ///< view-projection of the last frame, for picking
 
 BezierCurve cam_pos_curve;
 BezierCurve cam_look_curve;
 std::vector<ControlPoint> cam_pos_points;
 std::vector<ControlPoint> cam_look_points;
 
-GLfloat height_map[GRID_WIDTH * GRID_WIDTH];
+GLfloat generated_height_map[GRID_WIDTH * GRID_WIDTH];
+GLfloat* height_map = generated_height_map;  ///< or the heights mapped from the heightmap cache
+TerrainQuery query(height_map, GRID_WIDTH);
 
 vec3 cam_pos(0.0f, 0.2f, 3.0f);
 vec3 cam_up(0.0f, 1.0f, 0.0f);
@@ -36,28 +73,343 @@ vec3 mirror_cam_front(0.0f, 0.0f, -1.0f);
 
 
 
-vec3 cam_speed(0.0f, 0.0f, 0.0f);
-
 bool keys[1024];
+const char MOVEMENT_KEYS[] = "WSQEAD";
+std::atomic<unsigned int> camera_keys(0);  ///< movement keys held, read by the simulation thread
+void camera_movement(CameraState& camera, float dt);
+FixedStepLoop<CameraState> camera_loop(camera_movement, 60.0);  ///< ticks the free camera
+bool validate_noise = false;
+bool cpu_noise = false;          ///< generate the heightmap on the CPU instead of with perlin
+int num_threads = 0;             ///< 0: one worker per core
+int tile_size = 128;
+int generate_size = 0;           ///< > 0: headless generation of a map this wide, no window
+const char* output_path = NULL;  ///< raw float32 dump of the headless map
+bool stream_terrain = false;     ///< unbounded tiled terrain around the camera
+int stream_radius = 3;           ///< tiles drawn around the camera tile
+int stream_budget = 64;          ///< MB of resident tiles
+const char* dem_path = NULL;     ///< tiled DEM (see DemFile) drawn instead of the generated map
+int dem_budget = 64;             ///< MB of the DEM tile atlas
+float dem_height = 0.5f;         ///< world height between the lowest and highest DEM sample
+const char* import_input = NULL; ///< raw or PGM DEM converted to import_output, no window
+const char* import_output = NULL;
+int import_tile = 128;           ///< cells per side of the imported tiles
+int import_width = 0, import_height = 0;    ///< of a raw DEM, 0 to guess a square
+bool bench_query = false;        ///< time the terrain query API and exit
+bool bench_rays = false;         ///< time the ray caster and exit
+bool bench_readback = false;     ///< time synchronous against fenced heightmap readbacks and exit
+bool bench_tuning = false;       ///< time incremental regeneration for a series of tweaks and exit
+double tune_budget_ms = 8.0;     ///< per frame time given to regenerating tuned terrain
+size_t erode_droplets = 0;       ///< > 0: droplets rained on the generated heightmap, R rains as many again
+bool bench_erosion = false;      ///< time droplet erosion for growing thread counts and exit
+bool simulate_water = true;      ///< shallow water instead of a still plane
+bool bench_water = false;        ///< time the shallow water solver for growing thread counts and exit
+bool bench_splines = false;      ///< time arc-length sampling of many camera paths and exit
+bool bench_noise = false;        ///< time the specialised noise kernels against the run time loop and exit
+float reflection_scale = 0.5f;   ///< of the window resolution, for the reflection pass
+int reflection_interval = 2;     ///< frames between reflection refreshes, reprojected in between
+bool use_lod = true;             ///< CDLOD terrain instead of the fixed grid, toggled with L
+const char* cache_dir = "_cache";  ///< heightmap cache, NULL disables it
+const char* trace_path = NULL;   ///< Chrome trace of the profiled passes, written on exit
+int bench_frames = 0;            ///< > 0: replay the Bezier camera path offscreen for as many frames and exit
+double bench_step = 1.0 / 60.0;  ///< seconds between the replayed frames
+const char* bench_output = "benchmark.json";  ///< frame time percentiles and pass timings of the replay
+double replay_time = -1.0;       ///< >= 0: the time display() renders, stepped by the replay
+
+ThreadPool* pool = NULL;
+HeightmapCache* heightmap_cache = NULL;
+NoiseEngine noise_engine;
+IncrementalGenerator* tuner = NULL;     ///< regenerates height_map as the noise parameters change
+DropletErosion* erosion = NULL;
+unsigned int erosion_seed = 1;          ///< of the next erosion run
+const float SEDIMENT_DEPTH = 0.01f;     ///< deposited height fully covered with sediment
+ShallowWater* water_sim = NULL;
+float pour_x = 0.0f, pour_z = 0.0f;     ///< where F pours water, the last picked point
+std::chrono::steady_clock::time_point launch_time;  ///< start of main, for the time to first frame
 enum Camera_mode {FREE, FPS, BEZIER};
 Camera_mode cam_mode = FREE;
 
-void fill_height_map(GLuint texture) {
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, (void*)height_map);
-  glBindTexture(GL_TEXTURE_2D, 0);
+/// Cameras of the frame being rendered, set by display() for the passes of
+/// the render graph, and what the passes drew
+struct Frame {
+    mat4 view, projection, VP;
+    mat4 mirror_view, mirror_VP;
+    vec3 mirror_cam_pos;
+    size_t triangles;       ///< terrain and water, reflection included
+    int drawn, culled;      ///< terrain chunks or CDLOD nodes
+    int water_tiles;        ///< visible wet tiles
+};
+Frame frame;
+RenderGraph render_graph;
+FrameProfiler profiler;             ///< times the passes of render_graph
+bool heightmap_requested = false;   ///< the heightmap pass renders the noise on the next frame
+
+/// Renders the noise into the heightmap texture
+void render_height_map() {
+    fb.bind();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        perlin.draw();
+    fb.unbind();
+    // fb.display_color_attachment("FB - Color"); ///< debug
+}
+
+/// The heightmap is being replaced: what was eroded no longer applies
+void clear_sediment() {
+    erosion->reset();
+    baker.set_sediment(NULL, NULL, SEDIMENT_DEPTH);
+}
+
+/// Regenerates the heightmap on the GPU in the next frame; height_map and
+/// what derives from it follow a frame or two later, without stalling
+void regenerate_height_map() {
+    clear_sediment();
+    heightmap_requested = true;
+}
+
+/// Brings the CPU side up to date once texels of height_map changed
+void height_map_changed(const TexelRect& rect) {
+    pyramid.update(rect.x, rect.y, rect.width, rect.height);
+    baker.bake_region(height_map, rect, pool);
+    water_sim->set_ground(height_map, rect);
+    water_sim->upload();
+}
+
+/// Copies texels of height_map to the heightmap texture
+void upload_height_map(const TexelRect& rect) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, GRID_WIDTH);
+    glBindTexture(GL_TEXTURE_2D, height_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, GL_RED, GL_FLOAT,
+                    height_map + (size_t) rect.y * GRID_WIDTH + rect.x);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+/// Call after changing the parameters of perlin: the terrain follows over
+/// the next frames, the tiles around the camera first
+void tune_height_map() {
+    clear_sediment();
+    tuner->set_params(perlin.params());
+}
+
+/// Rains erode_droplets droplets (a million by default) on height_map,
+/// uploads it and rebakes with sediment where they deposited
+void erode_height_map() {
+    ErosionParams params;
+    if (erode_droplets > 0) params.droplets = erode_droplets;
+    params.seed = erosion_seed++;
+    erosion->erode(height_map, GRID_WIDTH, params).print(std::cout);
+    baker.set_sediment(erosion->deposited(), erosion->eroded(), SEDIMENT_DEPTH);
+    TexelRect all(0, 0, GRID_WIDTH, GRID_WIDTH);
+    upload_height_map(all);
+    height_map_changed(all);
+}
+
+/// Regenerates part of the tuned terrain within the frame budget
+void update_tuned_height_map() {
+    if (!tuner->busy()) return;
+    float focus_x = (cam_pos.x() + 1.0f) * 0.5f * (GRID_WIDTH - 1);
+    float focus_y = (cam_pos.z() + 1.0f) * 0.5f * (GRID_WIDTH - 1);
+    TexelRect changed = tuner->update(height_map, tune_budget_ms, focus_x, focus_y);
+    if (changed.empty()) return;
+    upload_height_map(changed);
+    height_map_changed(changed);
+}
+
+/// Time of the frame being rendered: the clock, or the replayed time
+double frame_time() {
+    return replay_time >= 0.0 ? replay_time : glfwGetTime();
+}
+
+/// Advances the water by the fixed steps that fit in the time since the
+/// last frame
+void update_water() {
+    static double last = frame_time();
+    double now = frame_time();
+    if (simulate_water && water_sim->advance(now - last) > 0) {
+        water_sim->upload();
+    }
+    last = now;
+}
+
+#ifdef WITH_ANTTWEAKBAR
+///--- Tuning panel: the setters write perlin's parameters and retune
+void TW_CALL set_float_param(const void* value, void* field) {
+    *(float*) field = *(const float*) value;
+    tune_height_map();
+}
+void TW_CALL get_float_param(void* value, void* field) {
+    *(float*) value = *(float*) field;
+}
+void TW_CALL set_octaves(const void* value, void*) {
+    perlin.octaves = *(const unsigned int*) value;
+    tune_height_map();
+}
+void TW_CALL get_octaves(void* value, void*) {
+    *(unsigned int*) value = perlin.octaves;
+}
+void TW_CALL get_tiles_left(void* value, void*) {
+    *(unsigned int*) value = tuner->remaining();
+}
+
+void init_tweak_bar() {
+    TwInit(TW_OPENGL_CORE, NULL);
+    TwWindowSize(width, height);
+    TwBar* bar = TwNewBar("Terrain");
+    TwDefine(" Terrain size='240 170' valueswidth=80 ");
+    TwAddVarCB(bar, "frequency", TW_TYPE_FLOAT, set_float_param, get_float_param, &perlin.frequency,
+               " min=0.05 max=8 step=0.01 ");
+    TwAddVarCB(bar, "H", TW_TYPE_FLOAT, set_float_param, get_float_param, &perlin.H,
+               " min=0 max=2 step=0.01 ");
+    TwAddVarCB(bar, "lacunarity", TW_TYPE_FLOAT, set_float_param, get_float_param, &perlin.lacunarity,
+               " min=1 max=4 step=0.01 ");
+    TwAddVarCB(bar, "octaves", TW_TYPE_UINT32, set_octaves, get_octaves, NULL, " min=1 max=16 ");
+    TwAddSeparator(bar, NULL, NULL);
+    TwAddVarRW(bar, "budget (ms)", TW_TYPE_DOUBLE, &tune_budget_ms, " min=1 max=100 step=1 ");
+    TwAddVarCB(bar, "tiles left", TW_TYPE_UINT32, NULL, get_tiles_left, NULL, NULL);
+}
+
+/// Average CPU and GPU ms of the frame and of every pass, refreshed by the
+/// profiler once per second
+void init_profiler_bar() {
+    TwBar* bar = TwNewBar("Profiler");
+    TwDefine(" Profiler position='16 200' size='240 320' valueswidth=60 refresh=1 ");
+    std::vector<std::string> scopes = render_graph.names();
+    scopes.insert(scopes.begin(), "update");
+    scopes.insert(scopes.begin(), "frame");
+    for (size_t i = 0; i < scopes.size(); i++) {
+        FrameProfiler::PassStats& stats = profiler.stats(scopes[i]);
+        TwAddVarRO(bar, (scopes[i] + " CPU").c_str(), TW_TYPE_DOUBLE, &stats.cpu_ms, " precision=2 ");
+        TwAddVarRO(bar, (scopes[i] + " GPU").c_str(), TW_TYPE_DOUBLE, &stats.gpu_ms, " precision=2 ");
+    }
+}
+#endif
+
+/// Window title naming the pass that took the most GPU time
+std::string profiled_title() {
+    std::vector<std::string> passes = render_graph.names();
+    std::string slowest;
+    double slowest_ms = 0.0;
+    for (size_t i = 0; i < passes.size(); i++) {
+        double ms = profiler.stats(passes[i]).gpu_ms;
+        if (ms <= slowest_ms) continue;
+        slowest = passes[i];
+        slowest_ms = ms;
+    }
+    if (slowest.empty()) return "FrameBuffer";
+    std::ostringstream title;
+    title.precision(2);
+    title << "FrameBuffer | " << slowest << " " << std::fixed << slowest_ms << " ms GPU";
+    return title.str();
 }
 
 void init_cam_pos_curve();
 void init_cam_look_curve();
 
+/// Draws the terrain from camera_pos, adding to the frame statistics
+void draw_terrain(const mat4& VP, const Frustum& frustum, const vec3& camera_pos, float lod_bias = 1.0f) {
+    if (use_lod) {
+        lod.draw(VP, frustum, camera_pos, lod_bias);
+        frame.triangles += lod.stats().triangles;
+        frame.drawn += lod.stats().nodes;
+        frame.culled += lod.stats().culled;
+    } else {
+        grid.draw(VP, frustum, pyramid);
+        frame.triangles += grid.stats().triangles;
+        frame.drawn += grid.stats().drawn;
+        frame.culled += grid.stats().culled;
+    }
+}
+
+/// Declares the passes of a frame; the graph orders them by what they read
+/// and write, which puts the sky after the opaque terrain
+void init_render_graph() {
+    render_graph.add_pass("heightmap", {}, {"heightmap"}, [] {
+        if (!heightmap_requested) return;
+        heightmap_requested = false;
+        render_height_map();
+        height_readback.request();
+        height_readback.flush();
+    }, false);
+
+    render_graph.add_pass("water tiles", {"heightmap"}, {"water tiles"}, [] {
+        frame.water_tiles = stream_terrain || dem_path ? 0 : water.select(Frustum(frame.VP), TerrainBaker::WATER_LEVEL);
+    });
+
+    // water becomes lava
+    render_graph.add_pass("reflection", {"heightmap", "water tiles"}, {"reflection"}, [] {
+        GLState& state = GLState::instance();
+        if (!reflection.begin(frame.mirror_VP, frame.water_tiles > 0)) return;
+        state.depth(true);
+        state.blend(false);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        ///--- terrain under the water is clipped away, cull it as well
+        state.clip(true);
+        Frustum mirror_frustum(frame.mirror_VP);
+        mirror_frustum.add_plane(0.0f, 1.0f, 0.0f, 0.0f);
+        ///--- the reflection is distorted by the waves, coarser LOD is enough
+        draw_terrain(frame.mirror_VP, mirror_frustum, frame.mirror_cam_pos, 2.0f);
+        state.clip(false);
+        state.depth(true, false, GL_LEQUAL);
+        skybox.draw(frame.mirror_view, frame.projection);
+        reflection.end(width, height);
+    });
+
+    ///--- Streamed tiles or a DEM replace the fixed map, water and its reflection
+    render_graph.add_pass("terrain", {"heightmap"}, {"opaque"}, [] {
+        GLState& state = GLState::instance();
+        glViewport(0, 0, width, height);
+        state.depth(true);
+        state.blend(false);
+        state.clip(false);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (stream_terrain) {
+            streamer.update(cam_pos);
+            streamer.draw(frame.VP);
+        } else if (dem_path) {
+            dem.draw(frame.VP, Frustum(frame.VP), cam_pos);
+            frame.triangles += dem.stats().triangles;
+            frame.drawn += dem.stats().nodes;
+            frame.culled += dem.stats().culled;
+        } else {
+            draw_terrain(frame.VP, Frustum(frame.VP), cam_pos);
+        }
+    }, !stream_terrain);
+
+    render_graph.add_pass("sky", {"opaque"}, {"background"}, [] {
+        GLState& state = GLState::instance();
+        state.depth(true, false, GL_LEQUAL);
+        skybox.draw(frame.view, frame.projection);
+    });
+
+    render_graph.add_pass("water", {"background", "reflection", "water tiles"}, {"scene"}, [] {
+        GLState& state = GLState::instance();
+        if (!frame.water_tiles) return;
+        state.depth(true);
+        state.blend(true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        water.draw(frame.VP, reflection.texture(), reflection.view_projection());
+        frame.triangles += water.stats().triangles;
+    });
+
+#ifdef WITH_ANTTWEAKBAR
+    render_graph.add_pass("overlay", {"scene"}, {"frame"}, [] { TwDraw(); }, false);
+#endif
+    render_graph.compile();
+    render_graph.print(std::cout);
+}
+
 void init(){
+    ///--- Decode the images on the workers while the GL thread compiles
+    /// shaders and builds meshes; the objects wait for them in their init
+    AssetLoader& assets = AssetLoader::instance();
+    assets.set_pool(pool);
+    assets.prefetch(Grid::material_paths());
+    assets.prefetch(Skybox::face_paths(), true);
+
     glClearColor(1,1,1, /*solid*/1.0 );
     glEnable(GL_DEPTH_TEST);
     GLuint fb_tex = fb.init();
-    GLuint mirror_tex = fb_mirror.init(false, true);
-    grid.init(grid_width, fb_tex, mirror_tex, "_grid/grid_vshader.glsl", "_grid/grid_fshader.glsl");
-    water.init(grid_width, fb_tex, mirror_tex, "_grid/water_vshader.glsl", "_grid/water_fshader.glsl");
+    height_tex = fb_tex;
+    reflection.init(width, height, reflection_scale, reflection_interval);
+    grid.init(grid_width, fb_tex, reflection.texture(), "_grid/grid_vshader.glsl", "_grid/grid_fshader.glsl");
     perlin.init();
     skybox.init();
 
@@ -65,29 +417,119 @@ void init(){
 
     init_cam_look_curve();
 
-    ///--- Render to FB
-    fb.bind();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        perlin.draw();
-    fb.unbind();
-    // fb.display_color_attachment("FB - Color"); ///< debug
+    if (stream_terrain) {
+        streamer.init(&grid, perlin.params(), 128, 0.5f, stream_radius, stream_budget,
+                      std::max(1, pool->size() - 1));
+    }
+    if (dem_path && !dem.init(dem_path, &grid, dem_budget, dem_height)) {
+        exit(EXIT_FAILURE);
+    }
+
+    height_readback.init(fb_tex, GRID_WIDTH, GRID_WIDTH);
+
+    ///--- Heightmap and baked maps from the cache when nothing they depend on changed
+    const char* source = cpu_noise ? "cpu" : "gpu";
+    char eroded_source[64];
+    if (erode_droplets > 0) {
+        snprintf(eroded_source, sizeof(eroded_source), "%s eroded by %zu droplets", source, erode_droplets);
+        source = eroded_source;
+    }
+    HeightmapCache::Key cache_key = HeightmapCache::key(perlin.params(), perlin.fragment_shader(), perlin_gradients,
+                                                        GRAD_SIZE * 3, GRID_WIDTH, source);
+    bool cached = heightmap_cache && heightmap_cache->open(cache_key, GRID_WIDTH);
+    if (cached) {
+        double load_start = glfwGetTime();
+        height_map = (GLfloat*) heightmap_cache->section(HeightmapCache::HEIGHTS);
+        glBindTexture(GL_TEXTURE_2D, fb_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GRID_WIDTH, GRID_WIDTH, GL_RED, GL_FLOAT, height_map);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        std::cout << "Heightmap mapped from " << heightmap_cache->path(cache_key) << " in "
+                  << 1000.0 * (glfwGetTime() - load_start) << " ms" << std::endl;
+    } else if (cpu_noise) {
+        ///--- Generate on the CPU straight into height_map, then upload
+        NoiseEngine engine;
+        TiledGenerator generator(engine, *pool, tile_size);
+        generator.generate(height_map, GRID_WIDTH, GRID_WIDTH, perlin.params()).print(std::cout);
+        glBindTexture(GL_TEXTURE_2D, fb_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GRID_WIDTH, GRID_WIDTH, GL_RED, GL_FLOAT, height_map);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    } else {
+        ///--- Render to FB, then wait for it once: nothing can be drawn before
+        render_height_map();
+        height_readback.request();
+        height_readback.finish(height_map);
+    }
+    query = TerrainQuery(height_map, GRID_WIDTH);
+
+    ///--- Weather the generated heightmap; cached ones were saved eroded
+    if (erode_droplets > 0 && !cached) {
+        ErosionParams erosion_params;
+        erosion_params.droplets = erode_droplets;
+        erosion_params.seed = erosion_seed++;
+        erosion->erode(height_map, GRID_WIDTH, erosion_params).print(std::cout);
+        glBindTexture(GL_TEXTURE_2D, fb_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GRID_WIDTH, GRID_WIDTH, GL_RED, GL_FLOAT, height_map);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    pyramid.build(height_map, GRID_WIDTH);
 
-    // fill height_map
-    fill_height_map(fb_tex);
+    ///--- Bake normals and material weights once for the terrain shaders
+    double bake_start = glfwGetTime();
+    baker.init(GRID_WIDTH);
+    if (erode_droplets > 0) {
+        baker.set_sediment(erosion->deposited(), erosion->eroded(), SEDIMENT_DEPTH);
+    }
+    const float* cached_normals = cached ? (const float*) heightmap_cache->section(HeightmapCache::NORMALS) : NULL;
+    const unsigned char* cached_splat = cached ? (const unsigned char*) heightmap_cache->section(HeightmapCache::SPLAT) : NULL;
+    if (cached_normals && cached_splat) {
+        baker.upload(cached_normals, cached_splat);
+        std::cout << "Uploaded cached normal and splat maps in ";
+    } else {
+        baker.bake(height_map, pool);
+        std::cout << "Baked normal and splat maps in ";
+    }
+    grid.set_baked_maps(baker.normal_texture(), baker.splat_texture());
+    std::cout << 1000.0 * (glfwGetTime() - bake_start) << " ms" << std::endl;
+    if (heightmap_cache && !cached) {
+        heightmap_cache->save(cache_key, GRID_WIDTH, height_map, baker.normals(), baker.splat());
+    }
+    TextureCache::instance().print(std::cout);
+    assets.print(std::cout);
+    lod.init(fb_tex, &pyramid, &grid);
+
+    ///--- Still water up to the water level, flowing once disturbed
+    water_sim->init(GRID_WIDTH, height_map, TerrainBaker::WATER_LEVEL);
+    water_sim->init_textures();
+    water.init(fb_tex, &pyramid, water_sim);
+
+    tuner = new IncrementalGenerator(noise_engine, *pool);
+    tuner->init(GRID_WIDTH);
+    tuner->seed(perlin.params());   ///< caches the octaves of the startup map over the first frames
+#ifdef WITH_ANTTWEAKBAR
+    init_tweak_bar();
+#endif
+    init_render_graph();
+    profiler.init();
+    if (trace_path) profiler.start_trace();
+#ifdef WITH_ANTTWEAKBAR
+    init_profiler_bar();
+#endif
 }
 
-GLfloat get_height(GLint x, GLint y) {
-  GLfloat offset = 0.2f;
-  if (x < 0 || x > GRID_WIDTH || y < 0 || y > GRID_WIDTH) {
-    return 0.0f;
-  }
-  GLint index = GRID_WIDTH * (y) + x;
-  return height_map[index] + offset;
+/// Bit of camera_keys for a movement key, 0 for other keys
+unsigned int movement_bit(int key) {
+  const char* found = key > 0 && key < 128 ? strchr(MOVEMENT_KEYS, key) : NULL;
+  return found ? 1u << (found - MOVEMENT_KEYS) : 0u;
 }
 
-void camera_movement() {
+/// One tick of the free camera, on the simulation thread: the held keys
+/// accelerate it, friction slows it down
+void camera_movement(CameraState& camera, float) {
   GLfloat speed_increment = 0.01f;
   GLfloat rotation_increment = M_PI/512.0f;
+  unsigned int held = camera_keys;
+  vec3& cam_speed = camera.speed;
 
   // friction factor
   GLfloat mu = 0.2f;
@@ -96,29 +538,29 @@ void camera_movement() {
   typedef Eigen::Transform<float,3,Eigen::Affine> Transform;
   Transform pitch = Transform::Identity();
   Transform mirror_pitch = Transform::Identity();
-  vec3 cam_x = cam_up.cross(cam_front);
+  vec3 cam_x = camera.up.cross(camera.front);
   pitch *= Eigen::AngleAxisf(cam_speed.y(), cam_x);
   mirror_pitch *= Eigen::AngleAxisf(-cam_speed.y(), cam_x);
 
   Transform yaw = Transform::Identity();
-  yaw *= Eigen::AngleAxisf(cam_speed.z(), cam_up);
+  yaw *= Eigen::AngleAxisf(cam_speed.z(), camera.up);
 
-  if (keys['W']) {
+  if (held & movement_bit('W')) {
     cam_speed.x() += speed_increment;
   }
-  if (keys['S']) {
+  if (held & movement_bit('S')) {
     cam_speed.x() -= speed_increment;
   }
-  if (keys['Q']) {
+  if (held & movement_bit('Q')) {
     cam_speed.y() += rotation_increment;
   }
-  if (keys['E']) {
+  if (held & movement_bit('E')) {
     cam_speed.y() -= rotation_increment;
   }
-  if (keys['A']) {
+  if (held & movement_bit('A')) {
     cam_speed.z() += rotation_increment;
   }
-  if (keys['D']) {
+  if (held & movement_bit('D')) {
     cam_speed.z() -= rotation_increment;
   }
   // compute friction
@@ -130,29 +572,46 @@ void camera_movement() {
   cam_speed.z() += z_friction;
 
   // update velocity of camera
-  cam_pos += cam_speed.x() * cam_front;
-  cam_front = pitch * cam_front;
-  cam_up = pitch * cam_up;
-  mirror_cam_up = mirror_pitch * mirror_cam_up;
-  cam_front = yaw * cam_front;
+  camera.pos += cam_speed.x() * camera.front;
+  camera.front = pitch * camera.front;
+  camera.up = pitch * camera.up;
+  camera.mirror_up = mirror_pitch * camera.mirror_up;
+  camera.front = yaw * camera.front;
+}
+
+/// Moves the simulated camera back to the start
+void reset_camera() {
+  camera_loop.post([](CameraState& camera) {
+    camera.pos = vec3(0, 0.2, 3);
+    camera.speed = vec3::Zero();
+  });
 }
 
 void snap_to_terrain() {
-  GLint grid_x = (cam_pos.x() + 1)/2.0f * GRID_WIDTH;
-  GLint grid_z = (cam_pos.z() + 1)/2.0f * GRID_WIDTH;
-  cam_pos.y() = get_height(grid_x, grid_z);
+  if (stream_terrain) {
+    GLfloat height;
+    if (streamer.height_at(cam_pos.x(), cam_pos.z(), height)) {
+      cam_pos.y() = height + 0.2f;
+    }
+    return;
+  }
+  if (dem_path) {
+    cam_pos.y() = dem.height(cam_pos.x(), cam_pos.z()) + 0.2f;
+    return;
+  }
+  cam_pos.y() = query.height(cam_pos.x(), cam_pos.z()) + 0.2f;
 }
 
 void check_camera_mode() {
   if (keys['0']) {
     cam_mode = FREE;
     std::cout << "Free camera mode activated." << std::endl;
-    cam_pos = vec3(0, 0.2, 3);
+    reset_camera();
   }
   if (keys['1']) {
     cam_mode = FPS;
     std::cout << "FPS camera mode activated." << std::endl;
-    cam_pos = vec3(0, 0.2, 3);
+    reset_camera();
   }
   if (keys['2']) {
     cam_mode = BEZIER;
@@ -160,16 +619,75 @@ void check_camera_mode() {
   }
 }
 
+// prints terrain and water triangles, culled chunks, water tiles and frame
+// time once per second, to compare CDLOD with the fixed grid
+void report_terrain_stats(size_t triangles, int drawn, int culled, int water_tiles) {
+    static double last_report = glfwGetTime();
+    static int frames = 0;
+    static size_t total_triangles = 0;
+    static int total_drawn = 0, total_culled = 0, total_water = 0;
+    frames++;
+    total_triangles += triangles;
+    total_drawn += drawn;
+    total_culled += culled;
+    total_water += water_tiles;
+    double now = glfwGetTime();
+    if (now - last_report < 1.0) return;
+    std::cout << (dem_path ? "DEM: " : use_lod ? "CDLOD: " : "Fixed grid: ")
+              << total_drawn / frames << " chunks drawn, " << total_culled / frames << " culled, "
+              << total_water / frames << " water tiles, "
+              << total_triangles / frames / 1000 << "k triangles/frame, "
+              << 1000.0 * (now - last_report) / frames << " ms/frame" << std::endl;
+    reflection.print(std::cout, 1000.0 * (now - last_report) / frames, profiler.stats("reflection").gpu_ms);
+    GLState::instance().print(std::cout);
+    if (dem_path) dem.print(std::cout);
+    profiler.print(std::cout);
+    camera_loop.print(std::cout);
+    last_report = now;
+    frames = 0;
+    total_triangles = 0;
+    total_drawn = 0;
+    total_culled = 0;
+    total_water = 0;
+}
+
+/// Prints once how long the first frame took to reach the screen since launch
+void report_first_frame() {
+    static bool reported = false;
+    if (reported) return;
+    reported = true;
+    glFinish();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - launch_time).count();
+    std::cout << "First frame after " << ms << " ms" << std::endl;
+}
+
 void display() {
+    profiler.begin_frame();
+    profiler.begin("frame");
+    {
+        ProfileScope scope(&profiler, "update");
+        TexelRect changed = height_readback.poll(height_map);
+        if (!changed.empty()) {
+            height_map_changed(changed);
+        }
+        update_tuned_height_map();
+        update_water();
+    }
+
     check_camera_mode();
     if (cam_mode != BEZIER) {
-        camera_movement();
+        CameraState camera = camera_loop.state();
+        cam_pos = camera.pos;
+        cam_front = camera.front;
+        cam_up = camera.up;
+        mirror_cam_up = camera.mirror_up;
     }
     if (cam_mode == FPS) {
       snap_to_terrain();
     }
 
-    opengp::update_title_fps("FrameBuffer");
+    static std::string title = "FrameBuffer";
+    opengp::update_title_fps(title);
     glViewport(0,0,width,height);
 
     ///--- Setup view-projection matrix
@@ -179,57 +697,608 @@ void display() {
     mat4 view = Eigen::lookAt(cam_pos, cam_look, cam_up);
     
     if (cam_mode == BEZIER) {
-        float t = (sin(glfwGetTime() * 1/7.5) + 1) / 2.0;
+        float t = (sin(frame_time() * 1/7.5) + 1) / 2.0;
         cam_pos_curve.sample_point(t, cam_pos);
         cam_look_curve.sample_point(t, cam_look);
         view = Eigen::lookAt(cam_pos, cam_look, cam_up);
     }
 
     mat4 VP = projection * view;
+    pick_VP = VP;
 
-    vec3 water_normal(0.0f, -1.0f, 0.0f);
-    vec3 u = water_normal * (cam_pos.dot(water_normal));
-    vec3 mirror_cam_pos = vec3(cam_pos.x(), -cam_pos.y(), cam_pos.z());
+    frame.view = view;
+    frame.projection = projection;
+    frame.VP = VP;
+    frame.mirror_cam_pos = vec3(cam_pos.x(), -cam_pos.y(), cam_pos.z());
     vec3 mirror_cam_look = vec3(cam_look.x(), -cam_look.y(), cam_look.z());
-    mat4 mirror_view = Eigen::lookAt(mirror_cam_pos, mirror_cam_look, mirror_cam_up);
-    mat4 mirror_VP = projection * mirror_view;
-
+    frame.mirror_view = Eigen::lookAt(frame.mirror_cam_pos, mirror_cam_look, mirror_cam_up);
+    frame.mirror_VP = projection * frame.mirror_view;
+    frame.triangles = 0;
+    frame.drawn = frame.culled = frame.water_tiles = 0;
 
-    
+    render_graph.execute(&profiler);
+    profiler.end();
+    if (profiler.end_frame()) {
+        title = profiled_title();
+    }
+    if (stream_terrain) return;
 
+    report_terrain_stats(frame.triangles, frame.drawn, frame.culled, frame.water_tiles);
+    report_first_frame();
+}
 
+/// A graph using every node type, and the kernel of its shape
+NoiseGraph every_node_graph(const NoiseParams& p) {
+    NoiseGraph g;
+    int pe = g.perlin(), si = g.simplex();
+    int f = g.fbm(si, 5, 3.0f, 2.1f, 0.8f);
+    int r = g.ridged(pe, 8, p.frequency, p.lacunarity, p.H);
+    int w = g.warp(r, f, 0.1f);
+    int t = g.terrace(w, 4.0f, 0.5f);
+    int c = g.clamp(t, -0.8f, 0.6f);
+    int f2 = g.fbm(pe, 3, 1.5f, 2.0f, 1.0f);
+    g.set_output(g.blend(c, f, f2), 0.5f);
+    return g;
+}
 
-    ///--- Render to Window
-    glViewport(0, 0, width, height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+typedef noise::Kernel<noise::Blend<noise::Clamp<noise::Terrace<noise::Warp<noise::Ridged<noise::Perlin, 8>,
+                                                                           noise::Fbm<noise::Simplex, 5> > > >,
+                                   noise::Fbm<noise::Simplex, 5>, noise::Fbm<noise::Perlin, 3> > > EveryNodeKernel;
 
-    skybox.draw(view, projection);
-    grid.draw(VP);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    water.draw(VP);
-    glDisable(GL_BLEND);
+void print_validation(const char* what, const NoiseValidation& res) {
+    std::cout << what << " (" << NoiseEngine::isa() << ") vs GLSL: "
+              << "max error " << res.max_error << ", mean error " << res.mean_error << ", "
+              << res.outliers << "/" << res.samples << " samples above tolerance -> "
+              << (res.passed ? "PASSED" : "FAILED") << std::endl;
+}
 
+/// Compares the CPU noise engine with the heightmap rendered by perlin,
+/// then the kernel of every_node_graph() with its generated shader
+int validate_cpu_noise() {
+    NoiseEngine engine;
+    NoiseValidation res = engine.validate(height_map, GRID_WIDTH, GRID_WIDTH, perlin.params());
+    print_validation("CPU noise", res);
 
-    // water becomes lava
-    fb_mirror.bind();
+    ///--- Then the kernels of the other node types against their shaders;
+    /// terrace steps fall on either side of a floor() at a few texels
+    NoiseGraph graph = every_node_graph(perlin.params());
+    std::vector<float> reference(GRID_WIDTH * GRID_WIDTH);
+    fb.bind();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        skybox.draw(mirror_view, projection);
-        glEnable(GL_CLIP_PLANE0);
-        grid.draw(mirror_VP);
-        glDisable(GL_CLIP_PLANE0);
+        perlin.draw(graph);
+    fb.unbind();
+    height_readback.request();
+    height_readback.finish(&reference[0]);
+    NoiseValidation every = NoiseEngine::validate_kernel(EveryNodeKernel(graph, engine.gradients()), &reference[0],
+                                                         GRID_WIDTH, GRID_WIDTH, 1e-4f, 1e-4f);
+    print_validation("Every node type", every);
+    return res.passed && every.passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// times batched height and normal queries against one at a time lookups
+int benchmark_queries() {
+    typedef std::chrono::high_resolution_clock Clock;
+    const size_t n = 1 << 20;
+    std::vector<float> x(n), z(n), h(n), nx(n), ny(n), nz(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = 2.2f * rand() / RAND_MAX - 1.1f;
+        z[i] = 2.2f * rand() / RAND_MAX - 1.1f;
+    }
+
+    Clock::time_point t0 = Clock::now();
+    for (size_t i = 0; i < n; i++) h[i] = query.height(x[i], z[i]);
+    Clock::time_point t1 = Clock::now();
+    query.heights(&x[0], &z[0], &h[0], n);
+    Clock::time_point t2 = Clock::now();
+    query.heights(&x[0], &z[0], &h[0], n, pool);
+    Clock::time_point t3 = Clock::now();
+    query.normals(&x[0], &z[0], &nx[0], &ny[0], &nz[0], n, pool);
+    Clock::time_point t4 = Clock::now();
+
+    double us[4] = {
+        std::chrono::duration<double, std::micro>(t1 - t0).count(),
+        std::chrono::duration<double, std::micro>(t2 - t1).count(),
+        std::chrono::duration<double, std::micro>(t3 - t2).count(),
+        std::chrono::duration<double, std::micro>(t4 - t3).count()
+    };
+    std::cout << n << " terrain queries (" << NoiseEngine::isa() << ", " << pool->size() << " threads): "
+              << n / us[0] << " M heights/s one at a time, "
+              << n / us[1] << " M heights/s batched, "
+              << n / us[2] << " M heights/s parallel, "
+              << n / us[3] << " M normals/s parallel" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// times batches of rays cast from above the map towards random points of it
+int benchmark_rays() {
+    typedef std::chrono::high_resolution_clock Clock;
+    const size_t n = 1 << 18;
+    std::vector<TerrainRay> rays(n);
+    std::vector<TerrainHit> hits(n);
+    for (size_t i = 0; i < n; i++) {
+        float ox = 2.0f * rand() / RAND_MAX - 1.0f, oz = 2.0f * rand() / RAND_MAX - 1.0f;
+        float tx = 2.0f * rand() / RAND_MAX - 1.0f, tz = 2.0f * rand() / RAND_MAX - 1.0f;
+        rays[i] = TerrainRay(ox, 1.0f, oz, tx - ox, -1.0f, tz - oz);
+    }
+
+    Clock::time_point t0 = Clock::now();
+    raycaster.intersect(&rays[0], &hits[0], n);
+    Clock::time_point t1 = Clock::now();
+    raycaster.intersect(&rays[0], &hits[0], n, pool);
+    Clock::time_point t2 = Clock::now();
+
+    size_t hit_count = 0, steps = 0;
+    for (size_t i = 0; i < n; i++) {
+        hit_count += hits[i].hit;
+        steps += hits[i].steps;
+    }
+    std::cout << n << " terrain rays (" << pool->size() << " threads): "
+              << n / std::chrono::duration<double, std::micro>(t1 - t0).count() << " M rays/s serial, "
+              << n / std::chrono::duration<double, std::micro>(t2 - t1).count() << " M rays/s parallel, "
+              << hit_count << " hits, " << (double) steps / n << " cells visited per ray" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// times how long the CPU is blocked by a synchronous heightmap readback
+// and by fenced ones of the whole map and of a dirty rectangle
+int benchmark_readback() {
+    typedef std::chrono::high_resolution_clock Clock;
+    const int runs = 10;
+    std::vector<float> copy((size_t) GRID_WIDTH * GRID_WIDTH);
+    double sync_ms = 0.0, issue_ms = 0.0, land_ms = 0.0, rect_issue_ms = 0.0, rect_land_ms = 0.0;
+    for (int run = 0; run < runs; run++) {
+        ///--- Synchronous: glGetTexImage waits for the render and the copy
+        render_height_map();
+        Clock::time_point t0 = Clock::now();
+        glBindTexture(GL_TEXTURE_2D, height_tex);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, &copy[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        Clock::time_point t1 = Clock::now();
+        sync_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+        ///--- Fenced, whole map then a 128^2 dirty rectangle: time to issue, then to land
+        for (int rect = 0; rect < 2; rect++) {
+            render_height_map();
+            Clock::time_point t2 = Clock::now();
+            if (rect) {
+                height_readback.request(TexelRect(448, 448, 128, 128));
+            } else {
+                height_readback.request();
+            }
+            height_readback.flush();
+            Clock::time_point t3 = Clock::now();
+            while (height_readback.poll(&copy[0]).empty()) {
+                glFlush();
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            Clock::time_point t4 = Clock::now();
+            (rect ? rect_issue_ms : issue_ms) += std::chrono::duration<double, std::milli>(t3 - t2).count();
+            (rect ? rect_land_ms : land_ms) += std::chrono::duration<double, std::milli>(t4 - t3).count();
+        }
+    }
+    std::cout << GRID_WIDTH << "^2 heightmap readback, averages of " << runs << " runs: "
+              << sync_ms / runs << " ms blocked by glGetTexImage; fenced: "
+              << issue_ms / runs << " ms to issue, lands " << land_ms / runs << " ms later; 128^2 rect: "
+              << rect_issue_ms / runs << " ms to issue, lands " << rect_land_ms / runs << " ms later" << std::endl;
+    height_readback.print(std::cout);
+    return EXIT_SUCCESS;
+}
+
+// replays a series of parameter tweaks on the incremental generator, one
+// budgeted update per frame, and checks the result against a full generation
+int benchmark_tuning() {
+    typedef std::chrono::high_resolution_clock Clock;
+    std::vector<float> map((size_t) GRID_WIDTH * GRID_WIDTH), reference(map.size());
+    IncrementalGenerator generator(noise_engine, *pool);
+    generator.init(GRID_WIDTH);
+
+    ///--- As at startup: the map is generated at once, then seeds the cache
+    NoiseParams p = perlin.params();
+    noise_engine.fill(&map[0], GRID_WIDTH, GRID_WIDTH, p);
+    generator.seed(p);
+
+    const char* names[] = { "seed", "H", "octaves + 1", "octaves - 2", "octaves + 1", "lacunarity", "frequency" };
+    for (int step = 0; step < 7; step++) {
+        switch (step) {
+            case 1: p.H = 0.8f; break;
+            case 2: p.octaves += 1; break;
+            case 3: p.octaves -= 2; break;
+            case 4: p.octaves += 1; break;
+            case 5: p.lacunarity = 2.5f; break;
+            case 6: p.frequency = 1.1f; break;
+        }
+        if (step > 0) generator.set_params(p);
+        int frames = 0;
+        double worst = 0.0;
+        Clock::time_point start = Clock::now();
+        while (generator.busy()) {
+            generator.update(&map[0], tune_budget_ms, GRID_WIDTH / 2, GRID_WIDTH / 2);
+            worst = std::max(worst, generator.last_ms());
+            frames++;
+        }
+        double total = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        Clock::time_point t0 = Clock::now();
+        noise_engine.fill(&reference[0], GRID_WIDTH, GRID_WIDTH, p);
+        double full = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        float error = 0.0f;
+        for (size_t i = 0; i < map.size(); i++) error = std::max(error, std::fabs(map[i] - reference[i]));
+
+        std::cout << names[step] << ": " << frames << " frames of at most " << worst << " ms, " << total
+                  << " ms in total (full serial generation " << full << " ms), max error " << error << std::endl;
+    }
+    generator.print(std::cout);
+    return EXIT_SUCCESS;
+}
+
+// erodes the same map with pools of 1, 2, 4... threads up to one per core,
+// and checks that every thread count gives the same terrain
+int benchmark_erosion() {
+    std::vector<float> generated((size_t) GRID_WIDTH * GRID_WIDTH), reference, map;
+    noise_engine.fill(&generated[0], GRID_WIDTH, GRID_WIDTH, perlin.params());
+    ErosionParams params;
+    if (erode_droplets > 0) params.droplets = erode_droplets;
+
+    int cores = std::max(num_threads, (int) std::max(1u, std::thread::hardware_concurrency()));
+    double serial_ms = 0.0;
+    for (int threads = 1; ; threads = std::min(2 * threads, cores)) {
+        ThreadPool threads_pool(threads);
+        DropletErosion droplets(threads_pool);
+        map = generated;
+        ErosionStats stats = droplets.erode(&map[0], GRID_WIDTH, params);
+        stats.print(std::cout);
+        if (reference.empty()) {
+            reference = map;
+            serial_ms = stats.total_ms;
+        }
+        float difference = 0.0f;
+        for (size_t i = 0; i < map.size(); i++) difference = std::max(difference, std::fabs(map[i] - reference[i]));
+        std::cout << "  " << threads << " threads: speedup " << serial_ms / stats.total_ms
+                  << ", max difference to 1 thread " << difference << std::endl;
+        if (threads >= cores) break;
+    }
+    return EXIT_SUCCESS;
+}
+
+// steps the shallow water over the generated map, flooded in the middle,
+// with pools of 1, 2, 4... threads up to one per core
+int benchmark_water() {
+    std::vector<float> map((size_t) GRID_WIDTH * GRID_WIDTH);
+    noise_engine.fill(&map[0], GRID_WIDTH, GRID_WIDTH, perlin.params());
+    const int steps = 120;
+    WaterParams params;
+
+    int cores = std::max(num_threads, (int) std::max(1u, std::thread::hardware_concurrency()));
+    for (int threads = 1; ; threads = std::min(2 * threads, cores)) {
+        ThreadPool threads_pool(threads);
+        ShallowWater water(threads_pool);
+        water.init(GRID_WIDTH, &map[0], TerrainBaker::WATER_LEVEL, params);
+        water.add_water(0.0f, 0.0f, 0.2f, 0.05f);
+        double volume = water.volume();
+        for (int i = 0; i < steps; i++) water.step();
+        water.print(std::cout);
+        double step_ms = 0.0;
+        {
+            typedef std::chrono::high_resolution_clock Clock;
+            Clock::time_point t0 = Clock::now();
+            for (int i = 0; i < steps; i++) water.step();
+            step_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count() / steps;
+        }
+        std::cout << "  " << threads << " threads: " << step_ms << " ms per step, "
+                  << 1000.0 * params.timestep / step_ms << "x real time at " << 1.0f / params.timestep
+                  << " steps/s, volume drift " << (water.volume() - volume) / volume << std::endl;
+        if (threads >= cores) break;
+    }
+    return EXIT_SUCCESS;
+}
+
+// samples hundreds of centripetal Catmull-Rom paths at random fractions of
+// their length one at a time, and at sorted fractions in batches
+int benchmark_splines() {
+    typedef std::chrono::high_resolution_clock Clock;
+    const int paths = 256, points_per_path = 32;
+    const size_t samples = 1 << 16;     ///< per path
+    std::vector<Spline> splines(paths);
+    Clock::time_point t0 = Clock::now();
+    size_t vertices = 0;
+    for (int p = 0; p < paths; p++) {
+        std::vector<vec3> points;
+        for (int i = 0; i < points_per_path; i++) {
+            points.push_back(vec3(2.0f * rand() / RAND_MAX - 1.0f, 0.5f * rand() / RAND_MAX, 2.0f * rand() / RAND_MAX - 1.0f));
+        }
+        splines[p].set_catmull_rom(points, Spline::CENTRIPETAL);
+        vertices += splines[p].vertices().size();
+    }
+    double build_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    std::vector<float> random(samples), sorted(samples);
+    for (size_t i = 0; i < samples; i++) random[i] = (float) rand() / RAND_MAX;
+    sorted = random;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<vec3> out(samples);
+    vec3 sum = vec3::Zero();
+
+    Clock::time_point t1 = Clock::now();
+    for (int p = 0; p < paths; p++) {
+        for (size_t i = 0; i < samples; i++) out[i] = splines[p].point(random[i]);
+        sum += out[samples - 1];
+    }
+    Clock::time_point t2 = Clock::now();
+    for (int p = 0; p < paths; p++) {
+        splines[p].points(&sorted[0], &out[0], samples);
+        sum += out[samples - 1];
+    }
+    Clock::time_point t3 = Clock::now();
+
+    double n = (double) paths * samples;
+    std::cout << paths << " centripetal paths of " << points_per_path - 1 << " segments: "
+              << (double) vertices / (paths * (points_per_path - 1)) << " vertices per segment, built in "
+              << build_ms << " ms, " << n / std::chrono::duration<double, std::micro>(t2 - t1).count()
+              << " M samples/s one at a time, " << n / std::chrono::duration<double, std::micro>(t3 - t2).count()
+              << " M samples/s batched (checksum " << sum.sum() << ")" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// fills the heightmap on one thread with the octave loop run at run time
+// and with the kernel specialised for the octave count, then 8 octaves of
+// fBm over Perlin and over simplex noise
+int benchmark_noise() {
+    typedef std::chrono::high_resolution_clock Clock;
+    const int n = GRID_WIDTH;
+    NoiseParams p = perlin.params();
+    std::vector<float> loop((size_t) n * n), specialised((size_t) n * n), u(n), v(n);
+    for (int i = 0; i < n; i++) u[i] = v[i] = (i + 0.5f) / n;
+
+    Clock::time_point t0 = Clock::now();
+    float uu[8], vv[8];
+    for (int y = 0; y < n; y++) {
+        std::fill(vv, vv + 8, v[y]);
+        for (int x = 0; x < n; x += 8) {
+            std::copy(&u[x], &u[x] + 8, uu);
+            noise_engine.height8(uu, vv, &loop[(size_t) y * n + x], p);
+        }
+    }
+    Clock::time_point t1 = Clock::now();
+    noise_engine.fill_grid(&specialised[0], n, &u[0], &v[0], n, n, p);
+    Clock::time_point t2 = Clock::now();
+    float max_diff = 0.0f;
+    for (size_t i = 0; i < loop.size(); i++) max_diff = std::max(max_diff, std::fabs(loop[i] - specialised[i]));
+
+    ///--- Same combiner over each source
+    NoiseGraph perlin_graph, simplex_graph;
+    perlin_graph.set_output(perlin_graph.fbm(perlin_graph.perlin(), 8, p.frequency, p.lacunarity, p.H));
+    simplex_graph.set_output(simplex_graph.fbm(simplex_graph.simplex(), 8, p.frequency, p.lacunarity, p.H));
+    Clock::time_point t3 = Clock::now();
+    NoiseEngine::fill_kernel(noise::Kernel<noise::Fbm<noise::Perlin, 8> >(perlin_graph, noise_engine.gradients()),
+                             &loop[0], n, &u[0], &v[0], n, n);
+    Clock::time_point t4 = Clock::now();
+    NoiseEngine::fill_kernel(noise::Kernel<noise::Fbm<noise::Simplex, 8> >(simplex_graph, noise_engine.gradients()),
+                             &specialised[0], n, &u[0], &v[0], n, n);
+    Clock::time_point t5 = Clock::now();
+
+    double samples = (double) n * n;
+    std::cout << "Noise (" << NoiseEngine::isa() << ", 1 thread), " << p.octaves << " octaves ridged: "
+              << samples / std::chrono::duration<double, std::micro>(t1 - t0).count() << " M samples/s looped, "
+              << samples / std::chrono::duration<double, std::micro>(t2 - t1).count()
+              << " M samples/s specialised (max difference " << max_diff << "); 8 octaves fBm: "
+              << samples / std::chrono::duration<double, std::micro>(t4 - t3).count() << " M samples/s Perlin, "
+              << samples / std::chrono::duration<double, std::micro>(t5 - t4).count() << " M samples/s simplex"
+              << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// generates a generate_size^2 heightmap without opening a window
+int generate_headless() {
+    NoiseEngine engine;
+    TiledGenerator generator(engine, *pool, tile_size);
+    std::vector<float> map((size_t) generate_size * generate_size);
+    generator.generate(&map[0], generate_size, generate_size, perlin.params()).print(std::cout);
+    if (output_path) {
+        FILE* file = fopen(output_path, "wb");
+        if (!file || fwrite(&map[0], sizeof(float), map.size(), file) != map.size()) {
+            std::cerr << "!!!ERROR: cannot write " << output_path << std::endl;
+            if (file) fclose(file);
+            return EXIT_FAILURE;
+        }
+        fclose(file);
+    }
+    return EXIT_SUCCESS;
+}
 
-        //glEnable(GL_BLEND);
-        //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        //glDisable(GL_BLEND);*/
-    fb_mirror.unbind();
+// replays bench_frames frames of the Bezier camera path bench_step apart,
+// offscreen when there is a headless context, and writes the frame time
+// percentiles and the average time of every pass to bench_output
+int benchmark_frames() {
+    typedef std::chrono::steady_clock Clock;
+    const int WARMUP = 10;      ///< frames rendered before timing, shaders and caches settle
+    HeadlessContext context;
+    glfwInit();                 ///< timer only, fails harmlessly without a display
+    bool headless = context.init(width, height);
+    if (!headless) {
+        std::cout << "No headless context, benchmarking in a window" << std::endl;
+        glfwInitWindowSize(width, height);
+        if (glfwCreateWindow() != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+    init();
+    cam_mode = BEZIER;
+    profiler.set_interval(0.0);
+
+    std::vector<double> frame_ms;
+    for (int f = -WARMUP; f < bench_frames; f++) {
+        replay_time = (f + WARMUP) * bench_step;
+        if (f == 0) profiler.finish();
+        Clock::time_point t0 = Clock::now();
+        display();
+        if (headless) context.swap();
+        else glfwSwapBuffers();
+        glFinish();
+        if (f >= 0) frame_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+    }
+    profiler.finish();
+
+    std::vector<double> sorted(frame_ms);
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0.0;
+    for (size_t i = 0; i < sorted.size(); i++) mean += sorted[i] / sorted.size();
+    auto percentile = [&sorted](double p) {     // nearest rank
+        return sorted[std::max(0, (int) std::ceil(p / 100.0 * sorted.size()) - 1)];
+    };
+
+    std::ofstream out(bench_output);
+    out << "{\n  \"frames\": " << bench_frames << ",\n  \"step\": " << bench_step
+        << ",\n  \"width\": " << width << ",\n  \"height\": " << height
+        << ",\n  \"headless\": " << (headless ? "true" : "false")
+        << ",\n  \"renderer\": \"" << (const char*) glGetString(GL_RENDERER) << "\""
+        << ",\n  \"frame_ms\": {\"mean\": " << mean << ", \"p50\": " << percentile(50)
+        << ", \"p95\": " << percentile(95) << ", \"p99\": " << percentile(99)
+        << ", \"max\": " << sorted.back() << "},\n  \"grid_mesh\": ";
+    grid.patch().print_json(out);
+    out << ",\n  \"lod_mesh\": ";
+    lod.patch().print_json(out);
+    out << ",\n  \"passes\": ";
+    profiler.print_json(out);
+    out << "\n}\n";
+    out.close();
+    if (!out) {
+        std::cerr << "!!!ERROR: cannot write " << bench_output << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << bench_frames << " frames replayed: " << mean << " ms mean, " << percentile(50) << " ms p50, "
+              << percentile(95) << " ms p95, " << percentile(99) << " ms p99 -> " << bench_output << std::endl;
+    if (trace_path && !profiler.write_trace(trace_path)) return EXIT_FAILURE;
+    if (headless) context.cleanup();
+    return EXIT_SUCCESS;
+}
+
+void parse_arguments(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--validate-noise")) {
+            validate_noise = true;
+        } else if (!strcmp(argv[i], "--cpu-noise")) {
+            cpu_noise = true;
+        } else if (!strcmp(argv[i], "--threads") && has_value) {
+            num_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--tile") && has_value) {
+            tile_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--generate") && has_value) {
+            generate_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--output") && has_value) {
+            output_path = argv[++i];
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream_terrain = true;
+        } else if (!strcmp(argv[i], "--stream-radius") && has_value) {
+            stream_radius = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--stream-budget") && has_value) {
+            stream_budget = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--dem") && has_value) {
+            dem_path = argv[++i];
+        } else if (!strcmp(argv[i], "--dem-budget") && has_value) {
+            dem_budget = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--dem-height") && has_value) {
+            dem_height = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--import-dem") && i + 2 < argc) {
+            import_input = argv[++i];
+            import_output = argv[++i];
+        } else if (!strcmp(argv[i], "--dem-tile") && has_value) {
+            import_tile = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--dem-size") && has_value) {
+            sscanf(argv[++i], "%dx%d", &import_width, &import_height);
+        } else if (!strcmp(argv[i], "--bench-query")) {
+            bench_query = true;
+        } else if (!strcmp(argv[i], "--bench-rays")) {
+            bench_rays = true;
+        } else if (!strcmp(argv[i], "--cache-dir") && has_value) {
+            cache_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            cache_dir = NULL;
+        } else if (!strcmp(argv[i], "--bench-readback")) {
+            bench_readback = true;
+        } else if (!strcmp(argv[i], "--bench-tuning")) {
+            bench_tuning = true;
+        } else if (!strcmp(argv[i], "--tune-budget") && has_value) {
+            tune_budget_ms = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--erode") && has_value) {
+            erode_droplets = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--bench-erosion")) {
+            bench_erosion = true;
+        } else if (!strcmp(argv[i], "--no-water")) {
+            simulate_water = false;
+        } else if (!strcmp(argv[i], "--bench-water")) {
+            bench_water = true;
+        } else if (!strcmp(argv[i], "--bench-splines")) {
+            bench_splines = true;
+        } else if (!strcmp(argv[i], "--bench-noise")) {
+            bench_noise = true;
+        } else if (!strcmp(argv[i], "--reflection-scale") && has_value) {
+            reflection_scale = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--reflection-interval") && has_value) {
+            reflection_interval = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--trace") && has_value) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--bench-frames") && has_value) {
+            bench_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--bench-step") && has_value) {
+            bench_step = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--bench-output") && has_value) {
+            bench_output = argv[++i];
+        } else if (!strcmp(argv[i], "--no-lod")) {
+            use_lod = false;
+        } else {
+            std::cout << "Unknown argument " << argv[i] << std::endl;
+        }
+    }
 }
 
 void keyboard(int key, int action) {
+#ifdef WITH_ANTTWEAKBAR
+  if (TwEventKeyGLFW(key, action)) return;
+#endif
   if (action == GLFW_PRESS) {
     keys[key] = true;
+    camera_keys |= movement_bit(key);
+    if (key == 'L') {
+      use_lod = !use_lod;
+      std::cout << (use_lod ? "CDLOD" : "Fixed grid") << " terrain activated." << std::endl;
+    }
+    if (key == 'G') {
+      regenerate_height_map();
+    }
+    if (key == 'R') {
+      erode_height_map();
+    }
+    if (key == 'F') {
+      water_sim->add_water(pour_x, pour_z, 0.05f, 0.05f);
+    }
   } else if (action == GLFW_RELEASE) {
     keys[key] = false;
+    camera_keys &= ~movement_bit(key);
+  }
+}
+
+// picks the terrain point under the cursor
+void mouse_button(int button, int action) {
+#ifdef WITH_ANTTWEAKBAR
+  if (TwEventMouseButtonGLFW(button, action)) return;
+#endif
+  if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS || stream_terrain || dem_path) {
+    return;
+  }
+  int x, y;
+  glfwGetMousePos(&x, &y);
+  mat4 inverse = pick_VP.inverse();
+  vec4 near_point = inverse * vec4(2.0f * x / width - 1.0f, 1.0f - 2.0f * y / height, -1.0f, 1.0f);
+  vec4 far_point = inverse * vec4(2.0f * x / width - 1.0f, 1.0f - 2.0f * y / height, 1.0f, 1.0f);
+  vec3 origin = near_point.head<3>() / near_point.w();
+  vec3 direction = far_point.head<3>() / far_point.w() - origin;
+
+  TerrainHit hit;
+  if (raycaster.intersect(TerrainRay(origin.x(), origin.y(), origin.z(),
+                                     direction.x(), direction.y(), direction.z()), hit)) {
+    std::cout << "Picked terrain at (" << hit.x << ", " << hit.y << ", " << hit.z << "), "
+              << hit.distance << " from the camera" << std::endl;
+    pour_x = hit.x;
+    pour_z = hit.z;
   }
 }
 
@@ -267,14 +1336,74 @@ void init_cam_pos_curve() {
     cam_pos_curve.add_segment(cam_pos_points[4].position(), cam_pos_points[5].position(), cam_pos_points[6].position());
 }
 
-int main(int, char**){
+int main(int argc, char** argv){
+    launch_time = std::chrono::steady_clock::now();
+    parse_arguments(argc, argv);
+    pool = new ThreadPool(num_threads);
+    if (cache_dir) {
+        heightmap_cache = new HeightmapCache(cache_dir);
+    }
+    if (generate_size > 0) {
+        return generate_headless();
+    }
+    if (import_input) {
+        return DemFile::import(import_input, import_output, import_tile, import_width, import_height) ?
+               EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    erosion = new DropletErosion(*pool);
+    water_sim = new ShallowWater(*pool);
+    if (bench_tuning) {
+        return benchmark_tuning();
+    }
+    if (bench_erosion) {
+        return benchmark_erosion();
+    }
+    if (bench_water) {
+        return benchmark_water();
+    }
+    if (bench_splines) {
+        return benchmark_splines();
+    }
+    if (bench_noise) {
+        return benchmark_noise();
+    }
+    if (bench_frames > 0) {
+        return benchmark_frames();
+    }
     glfwInitWindowSize(width, height);
     glfwCreateWindow();
     glfwDisplayFunc(display);
     glfwSetKeyCallback(keyboard);
+    glfwSetMouseButtonCallback(mouse_button);
+#ifdef WITH_ANTTWEAKBAR
+    glfwSetMousePosCallback((GLFWmouseposfun) TwEventMousePosGLFW);
+    glfwSetMouseWheelCallback((GLFWmousewheelfun) TwEventMouseWheelGLFW);
+    glfwSetCharCallback((GLFWcharfun) TwEventCharGLFW);
+#endif
     init();
+    if (validate_noise) {
+        return validate_cpu_noise();
+    }
+    if (bench_query) {
+        return benchmark_queries();
+    }
+    if (bench_rays) {
+        return benchmark_rays();
+    }
+    if (bench_readback) {
+        return benchmark_readback();
+    }
     keyboard(GLFW_KEY_KP_1, 0);
     //glfwSwapInterval(0); ///< disable VSYNC (allows framerate>30)
+    CameraState camera = { cam_pos, cam_front, cam_up, mirror_cam_up, vec3::Zero() };
+    camera_loop.start(camera);
     glfwMainLoop();
+    camera_loop.stop();
+#ifdef WITH_ANTTWEAKBAR
+    TwTerminate();
+#endif
+    if (trace_path && !profiler.write_trace(trace_path)) {
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }